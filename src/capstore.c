@@ -0,0 +1,666 @@
+/* Copyright (C) 2011 Fantayeneh Asres Gizaw, Filippo De Luca
+ *
+ * This file is part of libWURFL.
+ *
+ * libWURFL is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * any later version.
+ *
+ * libWURFL is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with libWURFL.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/* Written by Filippo De Luca <me@filippodeluca.com>.  */
+
+#include "capstore.h"
+
+#include "devicedef.h"
+#include "virtualcap.h"
+#include "snapshot.h"
+#include "utils/hashmap.h"
+#include "utils/strpool.h"
+#include "utils/mphf.h"
+#include "utils/error.h"
+
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <math.h>
+#include <limits.h>
+#include <assert.h>
+#include <errno.h>
+
+#define BITSET_WORDS(bits) (((bits) + 31) / 32)
+
+#define NO_PARENT UINT32_MAX
+
+#define BLOOM_BIT(capability) (((uint64_t)1) << ((capability) % 64))
+
+extern int errno;
+
+enum flatten_state {FLATTEN_TODO = 0, FLATTEN_RUNNING, FLATTEN_DONE};
+
+typedef struct {
+	uint32_t capability;
+	// value id + 1
+	uint32_t value;
+} capstore_override_t;
+
+typedef struct {
+	uint32_t mode;
+	uint32_t devices_size;
+	uint32_t capabilities_size;
+	uint32_t values_size;
+	uint64_t overrides_size;
+} capstore_meta_t;
+
+struct _capstore_t {
+	capstore_mode_t mode;
+	// The arrays are in a snapshot, not owned by the store
+	bool mapped;
+
+	strpool_t* capabilities;
+	uint32_t capabilities_size;
+
+	devicedef_t** devices;
+	uint32_t devices_size;
+	// The fall_back device index, NO_PARENT for the roots
+	uint32_t* parents;
+	// The device index of an id is device_ids[mphf_get(device_mphf, id)]
+	mphf_t* device_mphf;
+	uint32_t* device_ids;
+
+	// CAPSTORE_FLAT: devices_size * capabilities_size value ids + 1, 0 if
+	// missing
+	uint32_t* records;
+
+	// CAPSTORE_LAZY: the capabilities each device overrides, sorted by
+	// capability, from overrides[overrides_start[index]] to
+	// overrides[overrides_start[index + 1]]. The bloom of a device has the
+	// BLOOM_BIT of each capability it overrides.
+	capstore_override_t* overrides;
+	uint32_t* overrides_start;
+	uint64_t* blooms;
+
+	// The virtual capabilities flags by device index
+	uint64_t* virtual_flags;
+
+	// Typed columns indexed by value id
+	strpool_t* values;
+	uint32_t* bools_valid;
+	uint32_t* bools;
+	uint32_t* ints_valid;
+	int32_t* ints;
+	uint32_t* floats_valid;
+	float* floats;
+};
+
+typedef struct {
+	capstore_t* store;
+	uint32_t index;
+} index_data_t;
+
+static inline bool bitset_get(const uint32_t* bitset, uint32_t bit) {
+	return (bitset[bit / 32] >> (bit % 32)) & 1;
+}
+
+static inline void bitset_set(uint32_t* bitset, uint32_t bit) {
+	bitset[bit / 32] |= 1U << (bit % 32);
+}
+
+static void* calloc_or_die(size_t nmemb, size_t size, const char* what) {
+
+	void* allocated = calloc(nmemb, size);
+	if(allocated==NULL && nmemb > 0) {
+		error(1, errno, "error allocating %s", what);
+	}
+
+	return allocated;
+}
+
+static bool index_device(const void* item, void* xtra) {
+	devicedef_t* devicedef = (devicedef_t*)item;
+	index_data_t* data = (index_data_t*)xtra;
+
+	data->store->devices[data->index++] = devicedef;
+
+	return false;
+}
+
+static int devicedef_id_cmp(const void* litem, const void* ritem) {
+	const devicedef_t* ldevicedef = *(const devicedef_t* const*)litem;
+	const devicedef_t* rdevicedef = *(const devicedef_t* const*)ritem;
+
+	return strcmp(ldevicedef->id, rdevicedef->id);
+}
+
+/*
+ * The devices map iterates in hash order and the hash is seeded per process.
+ * The devices are indexed in id order instead, so the index of a device is
+ * the same in every process: among devices with the same user agent, the
+ * matcher keeps the last one.
+ */
+static void index_devices(capstore_t* store, hashmap_t* devices) {
+
+	index_data_t index_data;
+	index_data.store = store;
+	index_data.index = 0;
+	hashmap_foreach_value(devices, &index_device, &index_data);
+
+	qsort(store->devices, store->devices_size, sizeof(devicedef_t*), &devicedef_id_cmp);
+
+	uint32_t index;
+	for(index=0; index<store->devices_size; index++) {
+		store->devices[index]->index = index;
+	}
+}
+
+static void init_device_mphf(capstore_t* store) {
+
+	const char** ids = calloc_or_die(store->devices_size, sizeof(char*), "capstore device ids");
+
+	uint32_t index;
+	for(index=0; index<store->devices_size; index++) {
+		ids[index] = store->devices[index]->id;
+	}
+
+	store->device_mphf = mphf_init(ids, store->devices_size);
+	store->device_ids = calloc_or_die(store->devices_size, sizeof(uint32_t), "capstore device ids");
+	for(index=0; index<store->devices_size; index++) {
+		store->device_ids[mphf_get(store->device_mphf, ids[index])] = index;
+	}
+
+	free(ids);
+}
+
+/*
+ * A chain longer than the devices has a loop.
+ */
+static void check_parents(const capstore_t* store) {
+
+	uint32_t index;
+	for(index=0; index<store->devices_size; index++) {
+		uint32_t ancestor = index;
+		uint32_t depth = 0;
+		while(ancestor!=NO_PARENT) {
+			if(depth++ > store->devices_size) {
+				error(2, 0, "fall_back loop detected at device %s", store->devices[index]->id);
+			}
+			ancestor = store->parents[ancestor];
+		}
+	}
+}
+
+static void init_parents(capstore_t* store) {
+
+	store->parents = calloc_or_die(store->devices_size, sizeof(uint32_t), "capstore parents");
+
+	uint32_t index;
+	for(index=0; index<store->devices_size; index++) {
+		devicedef_t* devicedef = store->devices[index];
+		const devicedef_t* parent = devicedef->fall_back!=NULL ? capstore_device_by_id(store, devicedef->fall_back) : NULL;
+
+		store->parents[index] = parent!=NULL ? parent->index : NO_PARENT;
+	}
+
+	check_parents(store);
+}
+
+static void flatten_device(capstore_t* store, uint8_t* states, uint32_t index) {
+
+	uint32_t* record = store->records + (size_t)index * store->capabilities_size;
+
+	if(states[index]==FLATTEN_DONE) {
+		return;
+	}
+	states[index] = FLATTEN_RUNNING;
+
+	uint32_t parent = store->parents[index];
+	if(parent!=NO_PARENT) {
+		flatten_device(store, states, parent);
+
+		uint32_t* parent_record = store->records + (size_t)parent * store->capabilities_size;
+		memcpy(record, parent_record, sizeof(uint32_t) * store->capabilities_size);
+	}
+
+	const devicedef_t* devicedef = store->devices[index];
+	uint32_t capability;
+	for(capability=0; capability<devicedef->capabilities_size; capability++) {
+		const devicedef_capability_t* override = devicedef->capabilities + capability;
+		record[override->capability] = strpool_add(store->values, override->value) + 1;
+	}
+
+	states[index] = FLATTEN_DONE;
+}
+
+static void init_records(capstore_t* store) {
+
+	size_t records_size = (size_t)store->devices_size * store->capabilities_size;
+	store->records = calloc_or_die(records_size, sizeof(uint32_t), "capstore records");
+
+	uint8_t* states = calloc_or_die(store->devices_size, sizeof(uint8_t), "flatten states");
+	uint32_t index;
+	for(index=0; index<store->devices_size; index++) {
+		flatten_device(store, states, index);
+	}
+	free(states);
+}
+
+static void init_overrides(capstore_t* store) {
+
+	store->overrides_start = calloc_or_die(store->devices_size + 1, sizeof(uint32_t), "capstore overrides");
+	store->blooms = calloc_or_die(store->devices_size, sizeof(uint64_t), "capstore blooms");
+
+	size_t overrides_size = 0;
+	uint32_t index;
+	for(index=0; index<store->devices_size; index++) {
+		overrides_size += store->devices[index]->capabilities_size;
+	}
+	store->overrides = calloc_or_die(overrides_size, sizeof(capstore_override_t), "capstore overrides");
+
+	// The device capabilities are already sorted by capability
+	uint32_t size = 0;
+	for(index=0; index<store->devices_size; index++) {
+		const devicedef_t* devicedef = store->devices[index];
+		store->overrides_start[index] = size;
+
+		uint32_t capability;
+		for(capability=0; capability<devicedef->capabilities_size; capability++) {
+			capstore_override_t* override = store->overrides + size++;
+			override->capability = devicedef->capabilities[capability].capability;
+			override->value = strpool_add(store->values, devicedef->capabilities[capability].value) + 1;
+
+			store->blooms[index] |= BLOOM_BIT(override->capability);
+		}
+	}
+	store->overrides_start[store->devices_size] = size;
+}
+
+/**
+ * Parse the values once. A value is a valid bool if it is "true" or
+ * "false", a valid int if it is a decimal integer in the int32_t range and
+ * a valid float if it is a finite decimal number.
+ */
+static void parse_values(capstore_t* store) {
+
+	uint32_t size = strpool_size(store->values);
+	uint32_t words = BITSET_WORDS(size);
+
+	store->bools_valid = calloc_or_die(words, sizeof(uint32_t), "bool column");
+	store->bools = calloc_or_die(words, sizeof(uint32_t), "bool column");
+	store->ints_valid = calloc_or_die(words, sizeof(uint32_t), "int column");
+	store->ints = calloc_or_die(size, sizeof(int32_t), "int column");
+	store->floats_valid = calloc_or_die(words, sizeof(uint32_t), "float column");
+	store->floats = calloc_or_die(size, sizeof(float), "float column");
+
+	uint32_t id;
+	for(id=0; id<size; id++) {
+		const char* value = strpool_get(store->values, id);
+		char* end;
+
+		if(strcmp(value, "true")==0) {
+			bitset_set(store->bools_valid, id);
+			bitset_set(store->bools, id);
+		}
+		else if(strcmp(value, "false")==0) {
+			bitset_set(store->bools_valid, id);
+		}
+
+		// strtol and strtof skip leading spaces, we do not
+		if(*value=='\0' || !(*value=='-' || *value=='+' || *value=='.' || (*value>='0' && *value<='9'))) {
+			continue;
+		}
+
+		errno = 0;
+		long int_value = strtol(value, &end, 10);
+		if(*end=='\0' && errno==0 && int_value>=INT32_MIN && int_value<=INT32_MAX) {
+			bitset_set(store->ints_valid, id);
+			store->ints[id] = (int32_t)int_value;
+		}
+
+		errno = 0;
+		float float_value = strtof(value, &end);
+		if(*end=='\0' && errno==0 && isfinite(float_value)) {
+			bitset_set(store->floats_valid, id);
+			store->floats[id] = float_value;
+		}
+	}
+}
+
+capstore_t* capstore_init(hashmap_t* devices, strpool_t* capabilities, capstore_mode_t mode) {
+
+	capstore_t* store = malloc(sizeof(capstore_t));
+	if(!store) {
+		error(1, errno, "error allocating capstore");
+	}
+	memset(store, 0, sizeof(capstore_t));
+
+	store->mode = mode;
+	store->capabilities = capabilities;
+	store->capabilities_size = strpool_size(capabilities);
+	store->values = strpool_init();
+
+	store->devices_size = hashmap_size(devices);
+	store->devices = calloc_or_die(store->devices_size, sizeof(devicedef_t*), "capstore devices");
+
+	index_devices(store, devices);
+	init_device_mphf(store);
+
+	init_parents(store);
+	if(mode==CAPSTORE_LAZY) {
+		init_overrides(store);
+	}
+	else {
+		init_records(store);
+	}
+
+	parse_values(store);
+
+	store->virtual_flags = calloc_or_die(store->devices_size, sizeof(uint64_t), "capstore virtual flags");
+	uint32_t index;
+	for(index=0; index<store->devices_size; index++) {
+		store->virtual_flags[index] = virtualcap_eval(store, store->devices[index]);
+	}
+
+	return store;
+}
+
+capstore_t* capstore_init_snapshot(const snapshot_t* snapshot, devicedef_t** devices, uint32_t devices_size, strpool_t* capabilities) {
+
+	const capstore_meta_t* meta = snapshot_array(snapshot, SNAPSHOT_CAPSTORE, 1, sizeof(capstore_meta_t));
+	if(meta->devices_size!=devices_size || meta->capabilities_size!=strpool_size(capabilities)
+			|| (meta->mode!=CAPSTORE_FLAT && meta->mode!=CAPSTORE_LAZY)) {
+		error(2, 0, "snapshot capabilities do not match its devices");
+	}
+
+	capstore_t* store = malloc(sizeof(capstore_t));
+	if(!store) {
+		error(1, errno, "error allocating capstore");
+	}
+	memset(store, 0, sizeof(capstore_t));
+
+	store->mode = meta->mode;
+	store->mapped = true;
+	store->capabilities = capabilities;
+	store->capabilities_size = meta->capabilities_size;
+	store->values = snapshot_strpool(snapshot, SNAPSHOT_CAPSTORE_VALUES, SNAPSHOT_CAPSTORE_VALUE_OFFSETS, meta->values_size, NULL, NULL);
+
+	store->devices_size = devices_size;
+	store->devices = calloc_or_die(devices_size, sizeof(devicedef_t*), "capstore devices");
+	memcpy(store->devices, devices, sizeof(devicedef_t*) * devices_size);
+
+	uint32_t index;
+	for(index=0; index<devices_size; index++) {
+		store->devices[index]->index = index;
+	}
+
+	store->device_mphf = snapshot_mphf(snapshot, SNAPSHOT_CAPSTORE_DEVICE_MPHF, SNAPSHOT_CAPSTORE_DEVICE_MPHF_IDS, devices_size, (const uint32_t**)&store->device_ids);
+
+	store->parents = (uint32_t*)snapshot_array(snapshot, SNAPSHOT_CAPSTORE_PARENTS, devices_size, sizeof(uint32_t));
+	for(index=0; index<devices_size; index++) {
+		if(store->parents[index]!=NO_PARENT && store->parents[index] >= devices_size) {
+			error(2, 0, "snapshot has a corrupted fall_back index");
+		}
+	}
+	check_parents(store);
+
+	// The checksum is only checked by snapshot_verify, the indexes are
+	// checked here since a corrupted one reads out of the arrays
+	if(store->mode==CAPSTORE_LAZY) {
+		store->overrides_start = (uint32_t*)snapshot_array(snapshot, SNAPSHOT_CAPSTORE_OVERRIDES_START, (size_t)devices_size + 1, sizeof(uint32_t));
+		store->overrides = (capstore_override_t*)snapshot_array(snapshot, SNAPSHOT_CAPSTORE_OVERRIDES, meta->overrides_size, sizeof(capstore_override_t));
+		store->blooms = (uint64_t*)snapshot_array(snapshot, SNAPSHOT_CAPSTORE_BLOOMS, devices_size, sizeof(uint64_t));
+
+		for(index=0; index<devices_size; index++) {
+			if(store->overrides_start[index] > store->overrides_start[index + 1]) {
+				error(2, 0, "snapshot has a corrupted overrides index");
+			}
+		}
+		if(store->overrides_start[devices_size] > meta->overrides_size) {
+			error(2, 0, "snapshot has a corrupted overrides index");
+		}
+
+		uint64_t override;
+		for(override=0; override<meta->overrides_size; override++) {
+			const capstore_override_t* entry = store->overrides + override;
+			if(entry->capability >= meta->capabilities_size || entry->value==0 || entry->value > meta->values_size) {
+				error(2, 0, "snapshot has a corrupted capability value");
+			}
+		}
+	}
+	else {
+		store->records = (uint32_t*)snapshot_array(snapshot, SNAPSHOT_CAPSTORE_RECORDS, (size_t)devices_size * meta->capabilities_size, sizeof(uint32_t));
+
+		size_t records_size = (size_t)devices_size * meta->capabilities_size;
+		size_t record;
+		for(record=0; record<records_size; record++) {
+			if(store->records[record] > meta->values_size) {
+				error(2, 0, "snapshot has a corrupted capability value");
+			}
+		}
+	}
+
+	uint32_t words = BITSET_WORDS(meta->values_size);
+	store->bools_valid = (uint32_t*)snapshot_array(snapshot, SNAPSHOT_CAPSTORE_BOOLS_VALID, words, sizeof(uint32_t));
+	store->bools = (uint32_t*)snapshot_array(snapshot, SNAPSHOT_CAPSTORE_BOOLS, words, sizeof(uint32_t));
+	store->ints_valid = (uint32_t*)snapshot_array(snapshot, SNAPSHOT_CAPSTORE_INTS_VALID, words, sizeof(uint32_t));
+	store->ints = (int32_t*)snapshot_array(snapshot, SNAPSHOT_CAPSTORE_INTS, meta->values_size, sizeof(int32_t));
+	store->floats_valid = (uint32_t*)snapshot_array(snapshot, SNAPSHOT_CAPSTORE_FLOATS_VALID, words, sizeof(uint32_t));
+	store->floats = (float*)snapshot_array(snapshot, SNAPSHOT_CAPSTORE_FLOATS, meta->values_size, sizeof(float));
+	store->virtual_flags = (uint64_t*)snapshot_array(snapshot, SNAPSHOT_CAPSTORE_VIRTUAL_FLAGS, devices_size, sizeof(uint64_t));
+
+	return store;
+}
+
+void capstore_write(const capstore_t* store, snapshot_writer_t* writer) {
+
+	capstore_meta_t meta;
+	memset(&meta, 0, sizeof(meta));
+	meta.mode = store->mode;
+	meta.devices_size = store->devices_size;
+	meta.capabilities_size = store->capabilities_size;
+	meta.values_size = strpool_size(store->values);
+	meta.overrides_size = store->mode==CAPSTORE_LAZY ? store->overrides_start[store->devices_size] : 0;
+
+	uint32_t words = BITSET_WORDS(meta.values_size);
+
+	snapshot_writer_section(writer, SNAPSHOT_CAPSTORE, &meta, sizeof(meta));
+	snapshot_writer_strpool(writer, SNAPSHOT_CAPSTORE_VALUES, SNAPSHOT_CAPSTORE_VALUE_OFFSETS, store->values);
+	snapshot_writer_mphf(writer, SNAPSHOT_CAPSTORE_DEVICE_MPHF, SNAPSHOT_CAPSTORE_DEVICE_MPHF_IDS, store->device_mphf, store->device_ids);
+	snapshot_writer_section(writer, SNAPSHOT_CAPSTORE_PARENTS, store->parents, sizeof(uint32_t) * store->devices_size);
+
+	if(store->mode==CAPSTORE_LAZY) {
+		snapshot_writer_section(writer, SNAPSHOT_CAPSTORE_OVERRIDES_START, store->overrides_start, sizeof(uint32_t) * (store->devices_size + 1));
+		snapshot_writer_section(writer, SNAPSHOT_CAPSTORE_OVERRIDES, store->overrides, sizeof(capstore_override_t) * meta.overrides_size);
+		snapshot_writer_section(writer, SNAPSHOT_CAPSTORE_BLOOMS, store->blooms, sizeof(uint64_t) * store->devices_size);
+	}
+	else {
+		snapshot_writer_section(writer, SNAPSHOT_CAPSTORE_RECORDS, store->records, sizeof(uint32_t) * store->devices_size * store->capabilities_size);
+	}
+
+	snapshot_writer_section(writer, SNAPSHOT_CAPSTORE_BOOLS_VALID, store->bools_valid, sizeof(uint32_t) * words);
+	snapshot_writer_section(writer, SNAPSHOT_CAPSTORE_BOOLS, store->bools, sizeof(uint32_t) * words);
+	snapshot_writer_section(writer, SNAPSHOT_CAPSTORE_INTS_VALID, store->ints_valid, sizeof(uint32_t) * words);
+	snapshot_writer_section(writer, SNAPSHOT_CAPSTORE_INTS, store->ints, sizeof(int32_t) * meta.values_size);
+	snapshot_writer_section(writer, SNAPSHOT_CAPSTORE_FLOATS_VALID, store->floats_valid, sizeof(uint32_t) * words);
+	snapshot_writer_section(writer, SNAPSHOT_CAPSTORE_FLOATS, store->floats, sizeof(float) * meta.values_size);
+	snapshot_writer_section(writer, SNAPSHOT_CAPSTORE_VIRTUAL_FLAGS, store->virtual_flags, sizeof(uint64_t) * store->devices_size);
+}
+
+void capstore_free(capstore_t* store) {
+
+	strpool_free(store->values);
+	free(store->devices);
+	mphf_free(store->device_mphf);
+
+	if(!store->mapped) {
+		free(store->bools_valid);
+		free(store->bools);
+		free(store->ints_valid);
+		free(store->ints);
+		free(store->floats_valid);
+		free(store->floats);
+		free(store->virtual_flags);
+		free(store->records);
+		free(store->overrides);
+		free(store->overrides_start);
+		free(store->blooms);
+		free(store->parents);
+		free(store->device_ids);
+	}
+
+	free(store);
+}
+
+capstore_mode_t capstore_mode(const capstore_t* store) {
+	return store->mode;
+}
+
+uint32_t capstore_devices_size(const capstore_t* store) {
+	return store->devices_size;
+}
+
+devicedef_t* const* capstore_devices(const capstore_t* store) {
+	return store->devices;
+}
+
+const devicedef_t* capstore_device(const capstore_t* store, uint32_t index) {
+
+	assert(index < store->devices_size);
+
+	return store->devices[index];
+}
+
+const devicedef_t* capstore_device_by_id(const capstore_t* store, const char* id) {
+
+	uint32_t position = mphf_get(store->device_mphf, id);
+	if(position==MPHF_NONE) {
+		return NULL;
+	}
+
+	// Every id has a position, only the device one is there
+	const devicedef_t* devicedef = store->devices[store->device_ids[position]];
+
+	return strcmp(devicedef->id, id)==0 ? devicedef : NULL;
+}
+
+uint32_t capstore_capability(const capstore_t* store, const char* name) {
+	return strpool_id(store->capabilities, name);
+}
+
+const char* capstore_capability_name(const capstore_t* store, uint32_t capability) {
+	return strpool_get(store->capabilities, capability);
+}
+
+uint32_t capstore_capabilities_size(const capstore_t* store) {
+	return store->capabilities_size;
+}
+
+/**
+ * Walk the fall_back chain looking for the first device overriding the
+ * capability. The devices whose bloom does not have the capability bit are
+ * skipped without searching their overrides.
+ */
+static uint32_t lazy_value(const capstore_t* store, uint32_t index, uint32_t capability) {
+
+	uint64_t bit = BLOOM_BIT(capability);
+
+	for(; index!=NO_PARENT; index=store->parents[index]) {
+		if((store->blooms[index] & bit)==0) {
+			continue;
+		}
+
+		const capstore_override_t* overrides = store->overrides + store->overrides_start[index];
+		uint32_t low = 0;
+		uint32_t high = store->overrides_start[index + 1] - store->overrides_start[index];
+		while(low < high) {
+			uint32_t middle = (low + high) / 2;
+			if(overrides[middle].capability < capability) {
+				low = middle + 1;
+			}
+			else {
+				high = middle;
+			}
+		}
+
+		if(low < store->overrides_start[index + 1] - store->overrides_start[index] && overrides[low].capability==capability) {
+			return overrides[low].value;
+		}
+	}
+
+	return 0;
+}
+
+static inline uint32_t record_value(const capstore_t* store, const devicedef_t* devicedef, uint32_t capability) {
+
+	assert(devicedef->index < store->devices_size);
+	assert(capability < store->capabilities_size);
+
+	if(store->mode==CAPSTORE_LAZY) {
+		return lazy_value(store, devicedef->index, capability);
+	}
+	else {
+		return store->records[(size_t)devicedef->index * store->capabilities_size + capability];
+	}
+}
+
+const char* capstore_value(const capstore_t* store, const devicedef_t* devicedef, uint32_t capability) {
+
+	uint32_t value = record_value(store, devicedef, capability);
+
+	return value!=0 ? strpool_get(store->values, value - 1) : NULL;
+}
+
+const devicedef_t* capstore_fall_back(const capstore_t* store, const devicedef_t* devicedef) {
+
+	uint32_t parent = store->parents[devicedef->index];
+
+	return parent!=NO_PARENT ? store->devices[parent] : NULL;
+}
+
+uint64_t capstore_virtual_flags(const capstore_t* store, const devicedef_t* devicedef) {
+
+	assert(devicedef->index < store->devices_size);
+
+	return store->virtual_flags[devicedef->index];
+}
+
+bool capstore_bool(const capstore_t* store, const devicedef_t* devicedef, uint32_t capability, bool* value) {
+
+	uint32_t id = record_value(store, devicedef, capability);
+	if(id==0 || !bitset_get(store->bools_valid, id - 1)) {
+		return false;
+	}
+
+	*value = bitset_get(store->bools, id - 1);
+	return true;
+}
+
+bool capstore_int(const capstore_t* store, const devicedef_t* devicedef, uint32_t capability, int32_t* value) {
+
+	uint32_t id = record_value(store, devicedef, capability);
+	if(id==0 || !bitset_get(store->ints_valid, id - 1)) {
+		return false;
+	}
+
+	*value = store->ints[id - 1];
+	return true;
+}
+
+bool capstore_float(const capstore_t* store, const devicedef_t* devicedef, uint32_t capability, float* value) {
+
+	uint32_t id = record_value(store, devicedef, capability);
+	if(id==0 || !bitset_get(store->floats_valid, id - 1)) {
+		return false;
+	}
+
+	*value = store->floats[id - 1];
+	return true;
+}
@@ -0,0 +1,139 @@
+/* Copyright (C) 2011 Fantayeneh Asres Gizaw, Filippo De Luca
+ *
+ * This file is part of libWURFL.
+ *
+ * libWURFL is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * any later version.
+ *
+ * libWURFL is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with libWURFL.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/* Written by Filippo De Luca <me@filippodeluca.com>.  */
+
+#ifndef CAPSTORE_H_
+#define CAPSTORE_H_
+
+#include "devicedef.h"
+#include "utils/hashmap.h"
+#include "utils/strpool.h"
+#include "snapshot.h"
+
+#include <stdint.h>
+#include <stdbool.h>
+
+/**
+ * The capstore_t type.
+ *
+ * It holds the capabilities of every device already resolved through the
+ * fall_back chain. The values are interned and the typed values (bool,
+ * int, float) are parsed once, when the store is built.
+ */
+typedef struct _capstore_t capstore_t;
+
+typedef enum {
+	/**
+	 * Every device stores the value of every capability, a lookup is an
+	 * array access.
+	 */
+	CAPSTORE_FLAT = 0,
+	/**
+	 * Every device stores only the capabilities it overrides, a lookup walks
+	 * the fall_back chain.
+	 */
+	CAPSTORE_LAZY
+} capstore_mode_t;
+
+/**
+ * Build the store of the given devices. Every devicedef gets its index
+ * in the store. The devicedef capabilities are not referenced after
+ * this call.
+ *
+ * @param devices The devicedef_t map by id.
+ * @param capabilities The capability names, their ids are the
+ *        capabilities ids.
+ * @param mode The way capabilities are stored.
+ */
+capstore_t* capstore_init(hashmap_t* devices, strpool_t* capabilities, capstore_mode_t mode);
+
+/**
+ * Map the store written by capstore_write. The arrays stay in the snapshot,
+ * which must outlive the store.
+ *
+ * @param snapshot The snapshot to read.
+ * @param devices The devices in store index order, each one gets its index.
+ * @param devices_size The number of devices.
+ * @param capabilities The capability names, their ids are the
+ *        capabilities ids.
+ */
+capstore_t* capstore_init_snapshot(const snapshot_t* snapshot, devicedef_t** devices, uint32_t devices_size, strpool_t* capabilities);
+
+/**
+ * Write the store sections to a snapshot.
+ */
+void capstore_write(const capstore_t* store, snapshot_writer_t* writer);
+
+void capstore_free(capstore_t* store);
+
+/**
+ * @return the way the capabilities are stored, the written one for a
+ * mapped store.
+ */
+capstore_mode_t capstore_mode(const capstore_t* store);
+
+uint32_t capstore_devices_size(const capstore_t* store);
+
+/**
+ * @return the devices in index order.
+ */
+devicedef_t* const* capstore_devices(const capstore_t* store);
+
+/**
+ * @return the device with the given index.
+ */
+const devicedef_t* capstore_device(const capstore_t* store, uint32_t index);
+
+/**
+ * @return the device with the given id, NULL if there is none.
+ */
+const devicedef_t* capstore_device_by_id(const capstore_t* store, const char* id);
+
+/**
+ * @return the capability id or STRPOOL_NONE if it is unknown.
+ */
+uint32_t capstore_capability(const capstore_t* store, const char* name);
+
+const char* capstore_capability_name(const capstore_t* store, uint32_t capability);
+
+uint32_t capstore_capabilities_size(const capstore_t* store);
+
+/**
+ * @return the device capability value or NULL if the device does not have
+ *         the capability.
+ */
+const char* capstore_value(const capstore_t* store, const devicedef_t* devicedef, uint32_t capability);
+
+/**
+ * @return the device the given one falls back to, NULL for the roots.
+ */
+const devicedef_t* capstore_fall_back(const capstore_t* store, const devicedef_t* devicedef);
+
+/**
+ * @return the virtual capabilities flags of the device.
+ */
+uint64_t capstore_virtual_flags(const capstore_t* store, const devicedef_t* devicedef);
+
+bool capstore_bool(const capstore_t* store, const devicedef_t* devicedef, uint32_t capability, bool* value);
+
+bool capstore_int(const capstore_t* store, const devicedef_t* devicedef, uint32_t capability, int32_t* value);
+
+bool capstore_float(const capstore_t* store, const devicedef_t* devicedef, uint32_t capability, float* value);
+
+#endif /* CAPSTORE_H_ */
@@ -23,14 +23,15 @@
 
 #include "device.h"
 #include "devicedef.h"
-#include "utils/hashmap.h"
+#include "capstore.h"
 
 struct _device_t {
 	const char* id;
 	const char* user_agent;
-	hashmap_t* capabilities;
+	const devicedef_t* devicedef;
+	const capstore_t* capstore;
 };
 
-device_t* device_init(hashmap_t* devices, const devicedef_t* devicedef);
+device_t* device_init(const capstore_t* capstore, const devicedef_t* devicedef);
 
 #endif /* DEVICE_IMPL_H_ */
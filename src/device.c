@@ -21,24 +21,22 @@
 #include "device-impl.h"
 
 #include "devicedef.h"
+#include "capstore.h"
+#include "virtualcap.h"
 #include "utils/error.h"
 #include "utils/utils.h"
-#include "utils/functors.h"
-#include "utils/hashmap.h"
+#include "utils/strpool.h"
 
 #include <stdlib.h>
 #include <stdio.h>
+#include <string.h>
 #include <strings.h>
 #include <assert.h>
 #include <errno.h>
 
 extern int errno;
 
-static bool capability_toarray(void* item, void* xtra);
-
-static hashmap_t* explode_capabilities(const devicedef_t* devicedef, hashmap_t* devices);
-
-device_t* device_init(hashmap_t* devices, const devicedef_t* devicedef) {
+device_t* device_init(const capstore_t* capstore, const devicedef_t* devicedef) {
 
 	device_t* device = malloc(sizeof(device_t));
 	if(device==NULL) {
@@ -48,19 +46,63 @@ device_t* device_init(hashmap_t* devices, const devicedef_t* devicedef) {
 	// TODO copy values?
 	device->id = devicedef->id;
 	device->user_agent = devicedef->user_agent;
-	device->capabilities = explode_capabilities(devicedef, devices);
+	device->devicedef = devicedef;
+	device->capstore = capstore;
 
 	return device;
 }
 
 void device_free(device_t* device) {
-	hashmap_free(device->capabilities, NULL, NULL);
 	free(device);
 }
 
 char* device_capability(const device_t* device, const char* name) {
 
-	return (char*)hashmap_get(device->capabilities, name);
+	char* value = NULL;
+
+	uint32_t capability = capstore_capability(device->capstore, name);
+	if(capability!=STRPOOL_NONE) {
+		value = (char*)capstore_value(device->capstore, device->devicedef, capability);
+	}
+
+	return value;
+}
+
+bool device_capability_bool(const device_t* device, const char* name, bool* value) {
+
+	uint32_t capability = capstore_capability(device->capstore, name);
+
+	return capability!=STRPOOL_NONE && capstore_bool(device->capstore, device->devicedef, capability, value);
+}
+
+bool device_capability_int(const device_t* device, const char* name, int32_t* value) {
+
+	uint32_t capability = capstore_capability(device->capstore, name);
+
+	return capability!=STRPOOL_NONE && capstore_int(device->capstore, device->devicedef, capability, value);
+}
+
+bool device_capability_float(const device_t* device, const char* name, float* value) {
+
+	uint32_t capability = capstore_capability(device->capstore, name);
+
+	return capability!=STRPOOL_NONE && capstore_float(device->capstore, device->devicedef, capability, value);
+}
+
+uint64_t device_virtual_flags(const device_t* device) {
+
+	return capstore_virtual_flags(device->capstore, device->devicedef);
+}
+
+bool device_virtual_capability(const device_t* device, const char* name, bool* value) {
+
+	uint64_t flag = virtualcap_flag(name);
+	if(flag==0) {
+		return false;
+	}
+
+	*value = (device_virtual_flags(device) & flag)!=0;
+	return true;
 }
 
 char** device_capabilities(const device_t* device, void* (dupe)(size_t size)) {
@@ -69,20 +111,57 @@ char** device_capabilities(const device_t* device, void* (dupe)(size_t size)) {
 		dupe = &malloc;
 	}
 
-	size_t size = hashmap_size(device->capabilities);
+	device_capability_iter_t iter;
+	const char* name;
+	const char* value;
+
+	size_t size = 0;
+	device_capabilities_iter(device, &iter);
+	while(device_capabilities_next(&iter, &name, &value)) {
+		size++;
+	}
 
-	functor_toarray_data_t toarray_data;
-	toarray_data.index = 0;
-	toarray_data.size = (size * 2) + 1;
-	toarray_data.array = dupe(sizeof(char*) * toarray_data.size);
-	if(!toarray_data.array) {
+	size_t array_size = (size * 2) + 1;
+	char** capabilities = dupe(sizeof(char*) * array_size);
+	if(!capabilities) {
 		error(1, errno, "error allocating array for capabilities");
 	}
-	memset(toarray_data.array, NULL, sizeof(char*) * toarray_data.size);
+	memset(capabilities, 0, sizeof(char*) * array_size);
+
+	size_t index = 0;
+	device_capabilities_iter(device, &iter);
+	while(device_capabilities_next(&iter, &name, &value)) {
+		capabilities[index] = (char*)name;
+		capabilities[index + 1] = (char*)value;
+		index+=2;
+	}
+
+	return capabilities;
+}
 
-	hashmap_foreach(device->capabilities, &capability_toarray, &toarray_data);
+void device_capabilities_iter(const device_t* device, device_capability_iter_t* iter) {
 
-	return (char**)toarray_data.array;
+	iter->device = device;
+	iter->capability = 0;
+}
+
+bool device_capabilities_next(device_capability_iter_t* iter, const char** name, const char** value) {
+
+	const capstore_t* capstore = iter->device->capstore;
+	uint32_t capabilities_size = capstore_capabilities_size(capstore);
+
+	while(iter->capability < capabilities_size) {
+		uint32_t capability = iter->capability++;
+
+		const char* found = capstore_value(capstore, iter->device->devicedef, capability);
+		if(found!=NULL) {
+			*name = capstore_capability_name(capstore, capability);
+			*value = found;
+			return true;
+		}
+	}
+
+	return false;
 }
 
 char* device_id(const device_t* device) {
@@ -117,35 +196,3 @@ bool device_eq(const void* left, const void* right) {
 
 	return string_eq(ldevice->id, rdevice->id);
 }
-
-static bool capability_toarray(void* item, void* xtra) {
-	functor_toarray_data_t* data = (functor_toarray_data_t*)xtra;
-	char** kv = (char**)item;
-
-	char* name = kv[0];
-	char* value = kv[1];
-
-	data->array[data->index] = name;
-	data->array[data->index + 1] = value;
-	data->index+=2;
-
-	return false;
-}
-
-static hashmap_t* explode_capabilities(const devicedef_t* devicedef, hashmap_t* devices) {
-
-	hashmap_t *parent_capabilities;
-
-	if(devicedef == NULL) {
-		parent_capabilities = hashmap_init(&string_eq, &string_hash, NULL);
-	}
-	else {
-		devicedef_t* parent = devicedef->fall_back!=NULL?hashmap_get(devices, devicedef->fall_back):NULL;
-
-		parent_capabilities = explode_capabilities(parent, devices);
-		hashmap_putall(parent_capabilities, devicedef->capabilities);
-	}
-
-	return parent_capabilities;
-}
-
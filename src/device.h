@@ -27,6 +27,27 @@
 
 typedef struct _device_t device_t;
 
+/*
+ * The virtual capabilities flags, see device_virtual_flags. They are
+ * derived from the raw capabilities when wurfl is loaded.
+ */
+#define DEVICE_VIRTUAL_IS_MOBILE (((uint64_t)1) << 0)
+#define DEVICE_VIRTUAL_IS_SMARTPHONE (((uint64_t)1) << 1)
+#define DEVICE_VIRTUAL_IS_TABLET (((uint64_t)1) << 2)
+#define DEVICE_VIRTUAL_IS_TOUCHSCREEN (((uint64_t)1) << 3)
+#define DEVICE_VIRTUAL_IS_FULL_DESKTOP (((uint64_t)1) << 4)
+#define DEVICE_VIRTUAL_IS_ROBOT (((uint64_t)1) << 5)
+#define DEVICE_VIRTUAL_IS_APP_WEBVIEW (((uint64_t)1) << 6)
+
+/**
+ * The device capabilities iterator. It lives wherever the caller puts it,
+ * nothing is allocated to iterate.
+ */
+typedef struct {
+	const device_t* device;
+	uint32_t capability;
+} device_capability_iter_t;
+
 /**
  * This function free a device obtained from wurfl.
  *
@@ -59,6 +80,62 @@ char* device_user_agent(const device_t* device);
  */
 char* device_capability(const device_t* device, const char* name);
 
+/**
+ * This function returns a boolean device capability by its name. The
+ * value is parsed when wurfl is loaded, so no string parsing is done here.
+ *
+ * @param device The device to query.
+ * @param name The capability name.
+ * @param value It is set to the capability value.
+ * @return true if the device contains the capability and its value is
+ *         "true" or "false", false otherwise.
+ */
+bool device_capability_bool(const device_t* device, const char* name, bool* value);
+
+/**
+ * This function returns an integer device capability by its name. The
+ * value is parsed when wurfl is loaded, so no string parsing is done here.
+ *
+ * @param device The device to query.
+ * @param name The capability name.
+ * @param value It is set to the capability value.
+ * @return true if the device contains the capability and its value is a
+ *         decimal integer fitting int32_t, false otherwise.
+ */
+bool device_capability_int(const device_t* device, const char* name, int32_t* value);
+
+/**
+ * This function returns a decimal device capability by its name. The
+ * value is parsed when wurfl is loaded, so no string parsing is done here.
+ *
+ * @param device The device to query.
+ * @param name The capability name.
+ * @param value It is set to the capability value.
+ * @return true if the device contains the capability and its value is a
+ *         finite decimal number (integers included), false otherwise.
+ */
+bool device_capability_float(const device_t* device, const char* name, float* value);
+
+/**
+ * This function returns the device virtual capabilities. They are evaluated
+ * once per device when wurfl is loaded.
+ *
+ * @param device The device to query.
+ * @return the DEVICE_VIRTUAL_* flags the device has.
+ */
+uint64_t device_virtual_flags(const device_t* device);
+
+/**
+ * This function returns a device virtual capability by its name, like
+ * "is_smartphone" or "is_robot".
+ *
+ * @param device The device to query.
+ * @param name The virtual capability name.
+ * @param value It is set to the virtual capability value.
+ * @return true if the virtual capability exists, false otherwise.
+ */
+bool device_virtual_capability(const device_t* device, const char* name, bool* value);
+
 /**
  * This function returns the device capabilities stored in array as sequence of name,value terminated by NULL.
  *
@@ -68,6 +145,25 @@ char* device_capability(const device_t* device, const char* name);
  */
 char** device_capabilities(const device_t* device, void* (dupe)(size_t size));
 
+/**
+ * This function initializes an iterator over the device capabilities. The
+ * capabilities are iterated in a stable order, the same for every device.
+ *
+ * @param device The device to query.
+ * @param iter The iterator to initialize.
+ */
+void device_capabilities_iter(const device_t* device, device_capability_iter_t* iter);
+
+/**
+ * This function advances the iterator to the next device capability.
+ *
+ * @param iter The iterator initialized by device_capabilities_iter.
+ * @param name It is set to the capability name.
+ * @param value It is set to the capability value.
+ * @return false if there are no more capabilities, true otherwise.
+ */
+bool device_capabilities_next(device_capability_iter_t* iter, const char** name, const char** value);
+
 /**
  * This is the device cmp function.
  *
@@ -21,6 +21,7 @@
 #include "devicedef.h"
 
 #include "utils/utils.h"
+#include "utils/arena.h"
 #include "utils/error.h"
 
 #include <stdlib.h>
@@ -30,47 +31,147 @@
 
 extern int errno;
 
-devicedef_t* devicedef_init(char* id,
+devicedef_t* devicedef_init(arena_t* arena,
+		char* id,
 		char* user_agent,
 		char* fallback,
-		bool actual_device_root,
-		hashmap_t* capabilities) {
+		bool actual_device_root) {
 
-	devicedef_t* device = malloc(sizeof(devicedef_t));
-	if(device==NULL) {
-		error(1, errno, "error allocating device");
-	}
+	devicedef_t* device = arena_alloc(arena, sizeof(devicedef_t));
 
 	device->id = id;
 	device->user_agent = user_agent;
 	device->fall_back = fallback;
-	device->capabilities = capabilities;
+	device->actual_device_root = actual_device_root;
+	device->capabilities = NULL;
+	device->capabilities_size = 0;
 
 	return device;
 }
 
+static devicedef_capability_t* capabilities_alloc(uint32_t size) {
+
+	devicedef_capability_t* capabilities = malloc(sizeof(devicedef_capability_t) * size);
+	if(!capabilities) {
+		error(1, errno, "error allocating device capabilities");
+	}
+
+	return capabilities;
+}
+
+void devicedef_set_capabilities(devicedef_t* device, devicedef_capability_t* capabilities, uint32_t size) {
+
+	devicedef_release_capabilities(device);
+	if(size==0) {
+		return;
+	}
+
+	// The ids are given in document order, so the capabilities come almost
+	// sorted. The insertion sort is linear on them and it is stable, the
+	// last value of a repeated capability stays the last one.
+	uint32_t index;
+	for(index=1; index<size; index++) {
+		devicedef_capability_t current = capabilities[index];
+
+		uint32_t position = index;
+		while(position > 0 && capabilities[position - 1].capability > current.capability) {
+			capabilities[position] = capabilities[position - 1];
+			position--;
+		}
+		capabilities[position] = current;
+	}
+
+	uint32_t unique = 0;
+	for(index=0; index<size; index++) {
+		if(unique > 0 && capabilities[unique - 1].capability==capabilities[index].capability) {
+			capabilities[unique - 1].value = capabilities[index].value;
+		}
+		else {
+			capabilities[unique++] = capabilities[index];
+		}
+	}
+
+	device->capabilities = capabilities_alloc(unique);
+	memcpy(device->capabilities, capabilities, sizeof(devicedef_capability_t) * unique);
+	device->capabilities_size = unique;
+}
+
 void devicedef_free(devicedef_t* device) {
 
-	hashmap_free(device->capabilities, &coll_default_unduper, NULL);
-	free(device);
+	devicedef_release_capabilities(device);
 }
 
-devicedef_t* devicedef_patch(devicedef_t* patching, const devicedef_t* patcher) {
+void devicedef_release_capabilities(devicedef_t* device) {
+
+	free(device->capabilities);
+	device->capabilities = NULL;
+	device->capabilities_size = 0;
+}
+
+static int capability_cmp(const void* litem, const void* ritem) {
+
+	const devicedef_capability_t* lcapability = (const devicedef_capability_t*)litem;
+	const devicedef_capability_t* rcapability = (const devicedef_capability_t*)ritem;
+
+	return lcapability->capability < rcapability->capability ? -1 : lcapability->capability > rcapability->capability;
+}
+
+void devicedef_remap_capabilities(devicedef_t* device, const uint32_t* ids) {
+
+	// Their array is NULL, not even qsort may be given it
+	if(device->capabilities_size==0) {
+		return;
+	}
+
+	uint32_t index;
+	for(index=0; index<device->capabilities_size; index++) {
+		device->capabilities[index].capability = ids[device->capabilities[index].capability];
+	}
+
+	qsort(device->capabilities, device->capabilities_size, sizeof(devicedef_capability_t), &capability_cmp);
+}
+
+devicedef_t* devicedef_patch(devicedef_t* patching, devicedef_t* patcher) {
 
 	if(patcher->user_agent != NULL) {
-		free(patching->user_agent);
 		patching->user_agent = patcher->user_agent;
 	}
 
 	if(patcher->fall_back != NULL) {
-		free(patcher->fall_back);
 		patching->fall_back = patcher->fall_back;
 	}
 
 	patching->actual_device_root = patcher->actual_device_root;
 
-	hashmap_putall(patching->capabilities, patcher->capabilities);
-	hashmap_free(patcher->capabilities, NULL, NULL);
+	if(patcher->capabilities_size > 0) {
+		devicedef_capability_t* merged = capabilities_alloc(patching->capabilities_size + patcher->capabilities_size);
+
+		// Both are sorted, the patcher wins on the same capability
+		uint32_t size = 0;
+		uint32_t left = 0;
+		uint32_t right = 0;
+		while(left < patching->capabilities_size || right < patcher->capabilities_size) {
+			if(right==patcher->capabilities_size
+					|| (left < patching->capabilities_size && patching->capabilities[left].capability < patcher->capabilities[right].capability)) {
+				merged[size++] = patching->capabilities[left++];
+			}
+			else {
+				if(left < patching->capabilities_size && patching->capabilities[left].capability==patcher->capabilities[right].capability) {
+					left++;
+				}
+				merged[size++] = patcher->capabilities[right++];
+			}
+		}
+
+		if(size < patching->capabilities_size + patcher->capabilities_size) {
+			merged = realloc(merged, sizeof(devicedef_capability_t) * size);
+		}
+
+		devicedef_release_capabilities(patching);
+		patching->capabilities = merged;
+		patching->capabilities_size = size;
+	}
+	devicedef_release_capabilities(patcher);
 
 	return patching;
 }
@@ -21,29 +21,83 @@
 #ifndef DEVICEDEF_H_
 #define DEVICEDEF_H_
 
-#include "utils/hashmap.h"
+#include "utils/arena.h"
+
+#include <stdint.h>
+#include <stdbool.h>
 
 typedef struct _devicedef_t devicedef_t;
 
+/**
+ * A capability the device defines.
+ */
+typedef struct {
+	// The capability name id in the capabilities strpool_t
+	uint32_t capability;
+	const char* value;
+} devicedef_capability_t;
+
 struct _devicedef_t {
 	char* id;
 	char* user_agent;
 	char* fall_back;
 	bool actual_device_root;
-	hashmap_t* capabilities;
+	// Sorted by capability, each capability at most once
+	devicedef_capability_t* capabilities;
+	uint32_t capabilities_size;
+	// Index in the capstore_t
+	uint32_t index;
 };
 
-devicedef_t* devicedef_init(char* id, char* user_agent, char* fallback, bool actual_device_root, hashmap_t* capabilities);
+/**
+ * The device and its strings are allocated from the arena, they are
+ * released with it.
+ */
+devicedef_t* devicedef_init(arena_t* arena, char* id, char* user_agent, char* fallback, bool actual_device_root);
+
+/**
+ * Set the device capabilities. They are copied in an array as big as
+ * needed, sorted by capability. If a capability is given more than once,
+ * the last value is kept.
+ *
+ * @param device The device to set the capabilities of.
+ * @param capabilities The capabilities, in document order. They are sorted
+ *        in place.
+ * @param size The number of capabilities.
+ */
+void devicedef_set_capabilities(devicedef_t* device, devicedef_capability_t* capabilities, uint32_t size);
 
+/**
+ * Free what the device does not keep in its arena.
+ */
 void devicedef_free(devicedef_t* device);
 
+/**
+ * Free the device capabilities, once they are in the capstore_t they are
+ * not needed anymore.
+ */
+void devicedef_release_capabilities(devicedef_t* device);
+
 char* devicedef_id(const devicedef_t* device);
 
 char* devicedef_user_agent(const devicedef_t* device);
 
 char* devicedef_fallback(const devicedef_t* device);
 
-devicedef_t* devicedef_patch(devicedef_t* patching, const devicedef_t* patcher);
+/**
+ * Change the capability ids, when the names move to another pool. The
+ * capabilities are sorted again.
+ *
+ * @param device The device to change the capabilities of.
+ * @param ids The new id by old id.
+ */
+void devicedef_remap_capabilities(devicedef_t* device, const uint32_t* ids);
+
+/**
+ * Patch a device with another one having the same id. The capabilities
+ * are merged, the patcher ones win, and the patcher ones are released.
+ */
+devicedef_t* devicedef_patch(devicedef_t* patching, devicedef_t* patcher);
 
 int devicedef_cmp(const void* left, const void* right);
 
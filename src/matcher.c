@@ -25,7 +25,7 @@
 #include "utils/linkedlist.h"
 #include "utils/patricia.h"
 #include "utils/error.h"
-#include "utils/functors.h"
+#include "utils/hashmap-define.h"
 
 #include <stdlib.h>
 #include <stdio.h>
@@ -36,15 +36,40 @@
 
 extern int errno;
 
+/**
+ * The candidates taken from each trie at most, the nearest ones. They
+ * bound the Levenshtein distances computed by a match.
+ */
+#define MATCHER_MAX_CANDIDATES 64
+
 struct _matcher_t {
 	patricia_t* prefix;
 	patricia_t* suffix;
 };
 
+static inline uint32_t device_index_hash(uint32_t index) {
+	return index;
+}
+
+static inline bool device_index_equals(uint32_t lindex, uint32_t rindex) {
+	return lindex==rindex;
+}
+
+// The capstore indexes of the candidates
+HASHMAP_DEFINE(seen, uint32_t, bool, device_index_hash, device_index_equals)
+
+/*
+ * The candidates are kept in the order the tries give them: the hash tables
+ * order changes with the hash seed, the trie one does not. The order decides
+ * which candidate wins among the ones at the same distance.
+ */
 typedef struct {
-	const char* needle;
-	hashmap_t* map;
-} find_data_t;
+	devicedef_t** array;
+	uint32_t size;
+	uint32_t capacity;
+	// The devices already in array
+	seen_t* seen;
+} candidates_t;
 
 static uint32_t levenshtein_distance(const char* s, const char* t);
 
@@ -63,46 +88,103 @@ static void* devicedef_revuser_agent(const void* item) {
 		}
 
 		revuser_agent = strrev(reverse_ua, device->user_agent);
+		reverse_ua[strlen(device->user_agent)] = '\0';
 	}
 
 	return revuser_agent;
 }
 
-static bool find(void* item, const void* xtra) {
-	void** kv = (void**)item;
-	find_data_t* data = (find_data_t*)xtra;
+static uint32_t devicedef_index(const void* item) {
+	return ((const devicedef_t*)item)->index;
+}
+
+static void candidates_add(candidates_t* candidates, devicedef_t* device) {
 
-	const char* key = (char*)kv[0];
+	bool added;
+	seen_put(candidates->seen, device->index, &added);
+	if(added) {
 
-	hashmap_put(data->map, key, kv[1]);
+		if(candidates->size==candidates->capacity) {
+			candidates->capacity = candidates->capacity > 0 ? candidates->capacity * 2 : 64;
+			candidates->array = realloc(candidates->array, sizeof(devicedef_t*) * candidates->capacity);
+			if(!candidates->array) {
+				error(1, errno, "error allocating candidates array");
+			}
+		}
 
-	return strcmp(key, data->needle)==0;
+		candidates->array[candidates->size++] = device;
+	}
 }
 
-matcher_t* matcher_init(hashmap_t* devices) {
+matcher_t* matcher_init(devicedef_t* const* devices, uint32_t devices_size) {
 
 	matcher_t* matcher = malloc(sizeof(matcher_t));
 	if(!matcher) {
 		error(1, errno, "error allocating matcher");
 	}
 
-	matcher->prefix = patricia_init(NULL, NULL, NULL);
-	matcher->suffix = patricia_init(NULL, &coll_default_unduper, NULL);
+	const void** keys = malloc(sizeof(void*) * (devices_size + 1));
+	if(!keys) {
+		error(1, errno, "error allocating matcher keys");
+	}
+
+	// The tries are built at once from their keys, in any order
+	uint32_t index;
+	for(index=0; index<devices_size; index++) {
+		keys[index] = devicedef_user_agent(devices[index]);
+	}
+	matcher->prefix = patricia_init_bulk(keys, (const void* const*)devices, devices_size, NULL, NULL, NULL);
+
+	for(index=0; index<devices_size; index++) {
+		keys[index] = devicedef_revuser_agent(devices[index]);
+	}
+	matcher->suffix = patricia_init_bulk(keys, (const void* const*)devices, devices_size, NULL, &coll_default_unduper, NULL);
 
-	// add to prefix trie
-	functor_totrie_data_t totrie_data;
-	totrie_data.trie = matcher->prefix;
-	totrie_data.key_get = &devicedef_user_agent;
-	hashmap_foreach_value(devices, &functor_totrie, &totrie_data);
+	free(keys);
 
-	// add to suffix trie
-	totrie_data.trie = matcher->suffix;
-	totrie_data.key_get = &devicedef_revuser_agent;
-	hashmap_foreach_value(devices,  &functor_totrie, &totrie_data);
+	// The devices are referred by index, so the tries can be mapped back
+	patricia_freeze(matcher->prefix, &devicedef_index, (const void* const*)devices);
+	patricia_freeze(matcher->suffix, &devicedef_index, (const void* const*)devices);
 
 	return matcher;
 }
 
+static patricia_t* snapshot_trie(const snapshot_t* snapshot, snapshot_section_t section, devicedef_t* const* devices, uint32_t devices_size) {
+
+	size_t data_size;
+	const void* data = snapshot_section(snapshot, section, &data_size);
+
+	patricia_t* trie = patricia_init_mapped(data, data_size, (const void* const*)devices, devices_size);
+	if(trie==NULL) {
+		error(2, 0, "snapshot has a corrupted section %d", section);
+	}
+
+	return trie;
+}
+
+matcher_t* matcher_init_snapshot(const snapshot_t* snapshot, devicedef_t* const* devices, uint32_t devices_size) {
+
+	matcher_t* matcher = malloc(sizeof(matcher_t));
+	if(!matcher) {
+		error(1, errno, "error allocating matcher");
+	}
+
+	matcher->prefix = snapshot_trie(snapshot, SNAPSHOT_MATCHER_PREFIX, devices, devices_size);
+	matcher->suffix = snapshot_trie(snapshot, SNAPSHOT_MATCHER_SUFFIX, devices, devices_size);
+
+	return matcher;
+}
+
+void matcher_write(const matcher_t* matcher, snapshot_writer_t* writer) {
+
+	size_t data_size;
+	const void* data = patricia_data(matcher->prefix, &data_size);
+	snapshot_writer_section(writer, SNAPSHOT_MATCHER_PREFIX, data, data_size);
+
+	data = patricia_data(matcher->suffix, &data_size);
+	snapshot_writer_section(writer, SNAPSHOT_MATCHER_SUFFIX, data, data_size);
+}
+
 void matcher_free(matcher_t* matcher) {
 
 	patricia_free(matcher->prefix, NULL, NULL);
@@ -110,32 +192,32 @@ void matcher_free(matcher_t* matcher) {
 	free(matcher);
 }
 
-static void select_candidates(hashtable_t* candidates, matcher_t* matcher, const char* user_agent) {
+static void select_candidates(candidates_t* candidates, matcher_t* matcher, const char* user_agent) {
+
+	patricia_entry_t nearest[MATCHER_MAX_CANDIDATES];
+	uint32_t needle_length = strlen(user_agent);
 
-	find_data_t pfx_data;
-	pfx_data.needle = user_agent;
-	pfx_data.map = hashmap_init(&string_eq, &string_hash, NULL);
-	if(patricia_search_foreach(matcher->prefix, user_agent, &find, &pfx_data)) {
-		hashtable_add(candidates, hashmap_get(pfx_data.map, user_agent), NULL, NULL);
+	uint32_t size = patricia_search_nearest(matcher->prefix, user_agent, 0, UINT32_MAX, nearest, MATCHER_MAX_CANDIDATES);
+	if(size > 0 && nearest[0].shared > needle_length) {
+		// The exact match is the only candidate
+		candidates_add(candidates, nearest[0].value);
 	}
 	else {
-		functor_toset_data_t toset_data;
-		toset_data.set = candidates;
-		hashmap_foreach_value(pfx_data.map, &functor_toset, &toset_data);
+		uint32_t index;
+		for(index=0; index<size; index++) {
+			candidates_add(candidates, nearest[index].value);
+		}
 
 		char ruser_agent[8 * 1024];
 		memset(ruser_agent, '\0', 8 * 1024);
 		strrev(ruser_agent, user_agent);
 
-		find_data_t sfx_data;
-		sfx_data.needle = ruser_agent;
-		sfx_data.map = hashmap_init(&string_eq, &string_hash, NULL);
-		patricia_search_foreach(matcher->suffix, ruser_agent, &find, &sfx_data);
-		hashmap_foreach_value(sfx_data.map, &functor_toset, &toset_data);
-
-		hashmap_free(sfx_data.map, NULL, NULL);
+		// The reversed needle, if any, is a candidate too, not the only one
+		size = patricia_search_nearest(matcher->suffix, ruser_agent, 0, UINT32_MAX, nearest, MATCHER_MAX_CANDIDATES);
+		for(index=0; index<size; index++) {
+			candidates_add(candidates, nearest[index].value);
+		}
 	}
-	hashmap_free(pfx_data.map, NULL, NULL);
 }
 
 devicedef_t* matcher_match(matcher_t* matcher, const char* user_agent) {
@@ -143,35 +225,25 @@ devicedef_t* matcher_match(matcher_t* matcher, const char* user_agent) {
 
 	devicedef_t* matched = NULL;
 
-	hashtable_t* candidates = hashtable_init(&devicedef_eq, &devicedef_hash, NULL);
-	select_candidates(candidates, matcher, user_agent);
+	candidates_t candidates;
+	candidates.array = NULL;
+	candidates.size = 0;
+	candidates.capacity = 0;
+	candidates.seen = seen_init(64);
+	select_candidates(&candidates, matcher, user_agent);
+	seen_free(candidates.seen);
 
-	assert(!hashtable_empty(candidates));
+	assert(candidates.size>0);
 
-	functor_toarray_data_t toarray_data;
-	toarray_data.index = 0;
-	toarray_data.size = hashtable_size(candidates);
-	toarray_data.array = malloc(sizeof(devicedef_t*) * toarray_data.size);
-	if(!toarray_data.array) {
-		error(1, errno, "error allocating candidates array");
-	}
-	hashtable_foreach(candidates, &functor_toarray, &toarray_data);
-	hashtable_free(candidates, NULL, NULL);
-
-	assert(toarray_data.size>0);
-
-	if(toarray_data.size==1) {
-		matched = toarray_data.array[0];
+	if(candidates.size==1) {
+		matched = candidates.array[0];
 	}
 	else {
-		matched = match((devicedef_t**)toarray_data.array, toarray_data.size, user_agent, UINT32_MAX);
+		matched = match(candidates.array, candidates.size, user_agent, UINT32_MAX);
 	}
-	
-	//Modified by mimingan for memory leak on 2014-06-03
-	if( toarray_data.array )  {
-	    free( toarray_data.array );
-	}
-	
+
+	free(candidates.array);
+
 	assert(matched != NULL);
 	return matched;
 }
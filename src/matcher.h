@@ -22,11 +22,28 @@
 #define MATCHER_H_
 
 #include "devicedef.h"
+#include "snapshot.h"
 #include "utils/hashmap.h"
 
+#include <stdint.h>
+
 typedef struct _matcher_t matcher_t;
 
-matcher_t* matcher_init(hashmap_t* devices);
+/**
+ * Build the matcher of the given devices, each one at its index in the
+ * array. The candidates found for a User-Agent depend on the devices order,
+ * so the same order must be used to get the same matches. The tries are
+ * frozen once built.
+ */
+matcher_t* matcher_init(devicedef_t* const* devices, uint32_t devices_size);
+
+/**
+ * Map the tries written by matcher_write, the devices must be the ones they
+ * were built from, at the same indexes.
+ */
+matcher_t* matcher_init_snapshot(const snapshot_t* snapshot, devicedef_t* const* devices, uint32_t devices_size);
+
+void matcher_write(const matcher_t* matcher, snapshot_writer_t* writer);
 
 void matcher_free(matcher_t* matcher);
 
@@ -148,6 +148,7 @@ static bool normalize_language(normalizer_t* normalizer, char* dst, const char*
 		regmatch_t group = groups[1];
 		char *sn_idx = dst + group.rm_so;
 		memcpy(sn_idx, "xx-xx", 5);
+		return true;
 	}
 	else {
 		return false;
@@ -193,6 +194,9 @@ void normalizer_free(normalizer_t* normalizer) {
 
 	linkedlist_free(normalizer->handlers, &coll_nop_unduper, NULL);
 	regfree(normalizer->vdfnsn_regex);
+	regfree(normalizer->language_regex);
+	free(normalizer->vdfnsn_regex);
+	free(normalizer->language_regex);
 	free(normalizer);
 
 }
@@ -213,7 +217,8 @@ void normalizer_apply(normalizer_t* normalizer, char* dst, const char* src) {
 	strcpy(handler_xtra.src, src);
 
 	linkedlist_foreach(normalizer->handlers, &apply_handler, &handler_xtra);
-	strcpy(dst, handler_xtra.dst);
+	// The last normalized string is always in src, see apply_handler
+	strcpy(dst, handler_xtra.src);
 
 	free(handler_xtra.src);
 	free(handler_xtra.dst);
@@ -29,6 +29,10 @@ normalizer_t* normalizer_init();
 
 void normalizer_free(normalizer_t* normalizer);
 
+/**
+ * Normalize the src user agent in dst. Different threads can use the same
+ * normalizer, but the regex matching on it is serialized by the C library.
+ */
 void normalizer_apply(normalizer_t* normalizer, char* dst, const char* src);
 
 
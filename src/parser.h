@@ -23,12 +23,35 @@
 
 #include "utils/hashmap.h"
 #include "utils/hashtable.h"
+#include "utils/strpool.h"
+#include "utils/arena.h"
+#include "resource.h"
+
+#include <stdbool.h>
 
 typedef struct {
 	hashmap_t* devices;
-	hashtable_t* capabilities;
+	strpool_t* capabilities;
+	// Capability and group names to keep, NULL to keep all
+	hashtable_t* filter;
+	// It owns the devices and their strings
+	arena_t* arena;
+	// Do not try the WURFL scanner before libxml2
+	bool libxml2_only;
+	// The threads scanning a document at most
+	int threads;
 } parser_data_t;
 
-int parse_resource(const char* path, parser_data_t* resource_data);
+/**
+ * Initialize the parser globals, it must be called before parsing on
+ * different threads.
+ */
+void parser_init();
+
+/**
+ * Parse the resource into the resource_data devices. It does not close the
+ * resource.
+ */
+int parse_resource(resource_t* resource, parser_data_t* resource_data);
 
 #endif /* PARSER_H_ */
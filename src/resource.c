@@ -0,0 +1,454 @@
+/* Copyright (C) 2011 Fantayeneh Asres Gizaw, Filippo De Luca
+ *
+ * This file is part of libWURFL.
+ *
+ * libWURFL is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * any later version.
+ *
+ * libWURFL is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with libWURFL.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/* Written by Filippo De Luca <me@filippodeluca.com>.  */
+
+#include "resource.h"
+
+#include "utils/error.h"
+
+#include <config.h>
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#ifdef HAVE_ZLIB_H
+#include <zlib.h>
+#endif
+
+#define INPUT_SIZE (64 * 1024)
+#define OUTPUT_SIZE (64 * 1024)
+
+/**
+ * The size of the plain chunks taken from memory, the parser is fed a
+ * bit at a time so it does not hold the whole document.
+ */
+#define MEMORY_CHUNK_SIZE (256 * 1024)
+
+#define ZIP_LOCAL_HEADER_SIZE 30
+#define ZIP_LOCAL_HEADER_SIGNATURE 0x04034b50
+#define ZIP_DATA_DESCRIPTOR_FLAG 0x08
+#define ZIP_STORED 0
+#define ZIP_DEFLATED 8
+
+extern int errno;
+
+typedef enum {
+	RESOURCE_PLAIN,
+	RESOURCE_GZIP,
+	RESOURCE_ZIP_STORED,
+	RESOURCE_ZIP_DEFLATED
+} resource_format_t;
+
+struct _resource_t {
+	const char* name;
+	resource_format_t format;
+
+	// The stream, -1 for the memory resources
+	int fd;
+	bool close_fd;
+
+	// A memory resource reads input in place. A stream resource reads it
+	// in input_buffer. The unread bytes go from input[input_pos] to
+	// input[input_size].
+	const unsigned char* input;
+	size_t input_pos;
+	size_t input_size;
+	unsigned char* input_buffer;
+
+	// The mapped file, if any
+	void* mapped;
+	size_t mapped_size;
+
+	// The bytes left of a stored zip entry
+	uint64_t stored_left;
+	bool finished;
+
+#ifdef HAVE_LIBZ
+	z_stream stream;
+	bool inflating;
+	char* output;
+#endif
+};
+
+static bool input_fill(resource_t* resource) {
+
+	if(resource->input_pos < resource->input_size) {
+		return true;
+	}
+	else if(resource->fd < 0) {
+		return false;
+	}
+
+	ssize_t read_size;
+	do {
+		read_size = read(resource->fd, resource->input_buffer, INPUT_SIZE);
+	} while(read_size < 0 && errno==EINTR);
+
+	if(read_size < 0) {
+		error(2, errno, "error reading %s", resource->name);
+	}
+	resource->input_pos = 0;
+	resource->input_size = read_size;
+
+	return resource->input_size > 0;
+}
+
+/**
+ * @return the next input bytes, up to size, without copying them.
+ */
+static const unsigned char* input_next(resource_t* resource, size_t size, size_t* taken) {
+
+	if(!input_fill(resource)) {
+		*taken = 0;
+		return NULL;
+	}
+
+	size_t available = resource->input_size - resource->input_pos;
+	*taken = available < size ? available : size;
+
+	const unsigned char* next = resource->input + resource->input_pos;
+	resource->input_pos += *taken;
+
+	return next;
+}
+
+static size_t input_take(resource_t* resource, void* dst, size_t size) {
+
+	size_t taken = 0;
+
+	while(taken < size) {
+		size_t chunk;
+		const unsigned char* next = input_next(resource, size - taken, &chunk);
+		if(next==NULL) {
+			break;
+		}
+
+		if(dst!=NULL) {
+			memcpy((char*)dst + taken, next, chunk);
+		}
+		taken += chunk;
+	}
+
+	return taken;
+}
+
+static uint32_t read_le(const unsigned char* bytes, size_t size) {
+
+	uint32_t value = 0;
+	while(size-- > 0) {
+		value = (value << 8) | bytes[size];
+	}
+
+	return value;
+}
+
+#ifdef HAVE_LIBZ
+
+static void inflate_start(resource_t* resource, int window_bits) {
+
+	memset(&resource->stream, 0, sizeof(z_stream));
+	if(inflateInit2(&resource->stream, window_bits)!=Z_OK) {
+		error(2, 0, "error initializing zlib for %s", resource->name);
+	}
+	resource->inflating = true;
+
+	resource->output = malloc(OUTPUT_SIZE);
+	if(!resource->output) {
+		error(1, errno, "error allocating inflate buffer");
+	}
+}
+
+static const char* inflate_next(resource_t* resource, size_t* size) {
+
+	z_stream* stream = &resource->stream;
+
+	stream->next_out = (Bytef*)resource->output;
+	stream->avail_out = OUTPUT_SIZE;
+
+	while(stream->avail_out==OUTPUT_SIZE && !resource->finished) {
+
+		if(!input_fill(resource)) {
+			error(2, 0, "unexpected end of compressed data in %s", resource->name);
+		}
+		stream->next_in = (Bytef*)resource->input + resource->input_pos;
+		stream->avail_in = resource->input_size - resource->input_pos;
+
+		int status = inflate(stream, Z_NO_FLUSH);
+		resource->input_pos = resource->input_size - stream->avail_in;
+
+		if(status==Z_STREAM_END) {
+			// A gzip file can be made of several members
+			if(resource->format==RESOURCE_GZIP && input_fill(resource)) {
+				inflateReset(stream);
+			}
+			else {
+				resource->finished = true;
+			}
+		}
+		else if(status!=Z_OK && status!=Z_BUF_ERROR) {
+			error(2, 0, "error inflating %s: %s", resource->name, stream->msg!=NULL ? stream->msg : "corrupted data");
+		}
+	}
+
+	*size = OUTPUT_SIZE - stream->avail_out;
+
+	return resource->output;
+}
+
+#endif
+
+/**
+ * Skip the zip entries up to the first XML one, and stop at its data.
+ */
+static void open_zip(resource_t* resource) {
+
+	while(true) {
+		unsigned char header[ZIP_LOCAL_HEADER_SIZE];
+		if(input_take(resource, header, ZIP_LOCAL_HEADER_SIZE)!=ZIP_LOCAL_HEADER_SIZE
+				|| read_le(header, 4)!=ZIP_LOCAL_HEADER_SIGNATURE) {
+			error(2, 0, "no XML entry in zip file %s", resource->name);
+		}
+
+		uint32_t flags = read_le(header + 6, 2);
+		uint32_t method = read_le(header + 8, 2);
+		uint32_t compressed_size = read_le(header + 18, 4);
+		uint32_t name_size = read_le(header + 26, 2);
+		uint32_t extra_size = read_le(header + 28, 2);
+
+		char* name = malloc(name_size + 1);
+		if(!name) {
+			error(1, errno, "error allocating zip entry name");
+		}
+		if(input_take(resource, name, name_size)!=name_size) {
+			error(2, 0, "truncated zip file %s", resource->name);
+		}
+		name[name_size] = '\0';
+		input_take(resource, NULL, extra_size);
+
+		bool xml = name_size >= 4 && strcmp(name + name_size - 4, ".xml")==0;
+		free(name);
+
+		if(xml && method==ZIP_DEFLATED) {
+#ifdef HAVE_LIBZ
+			resource->format = RESOURCE_ZIP_DEFLATED;
+			inflate_start(resource, -MAX_WBITS);
+			return;
+#else
+			error(2, 0, "zlib is needed to read %s", resource->name);
+#endif
+		}
+		else if(xml && method==ZIP_STORED && !(flags & ZIP_DATA_DESCRIPTOR_FLAG)) {
+			resource->format = RESOURCE_ZIP_STORED;
+			resource->stored_left = compressed_size;
+			return;
+		}
+		else if(xml) {
+			error(2, 0, "unsupported zip compression method %u in %s", method, resource->name);
+		}
+		else if(flags & ZIP_DATA_DESCRIPTOR_FLAG) {
+			error(2, 0, "can not skip streamed zip entry in %s", resource->name);
+		}
+
+		input_take(resource, NULL, compressed_size);
+	}
+}
+
+static resource_t* resource_init(const char* name) {
+
+	resource_t* resource = malloc(sizeof(resource_t));
+	if(!resource) {
+		error(1, errno, "error allocating resource");
+	}
+	memset(resource, 0, sizeof(resource_t));
+
+	resource->name = name;
+	resource->fd = -1;
+
+	return resource;
+}
+
+/**
+ * Detect the resource format from its first bytes.
+ */
+static resource_t* resource_start(resource_t* resource) {
+
+	input_fill(resource);
+
+	const unsigned char* magic = resource->input + resource->input_pos;
+	size_t magic_size = resource->input_size - resource->input_pos;
+
+	if(magic_size >= 2 && magic[0]==0x1f && magic[1]==0x8b) {
+#ifdef HAVE_LIBZ
+		resource->format = RESOURCE_GZIP;
+		inflate_start(resource, MAX_WBITS + 16);
+#else
+		error(2, 0, "zlib is needed to read %s", resource->name);
+#endif
+	}
+	else if(magic_size >= 4 && read_le(magic, 4)==ZIP_LOCAL_HEADER_SIGNATURE) {
+		open_zip(resource);
+	}
+	else {
+		resource->format = RESOURCE_PLAIN;
+	}
+
+	return resource;
+}
+
+resource_t* resource_open(const char* path) {
+
+	int fd = open(path, O_RDONLY);
+	if(fd < 0) {
+		error(2, errno, "error opening %s", path);
+	}
+
+	resource_t* resource = resource_open_fd(fd, path);
+	if(resource->fd < 0) {
+		// It is mapped
+		close(fd);
+	}
+	else {
+		resource->close_fd = true;
+	}
+
+	return resource;
+}
+
+resource_t* resource_open_fd(int fd, const char* name) {
+
+	resource_t* resource = resource_init(name);
+
+	struct stat st;
+	off_t offset = lseek(fd, 0, SEEK_CUR);
+
+	if(fstat(fd, &st)==0 && S_ISREG(st.st_mode) && offset>=0 && offset < st.st_size) {
+		// A regular file is read in place
+		void* mapped = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+		if(mapped!=MAP_FAILED) {
+			madvise(mapped, st.st_size, MADV_SEQUENTIAL);
+
+			resource->mapped = mapped;
+			resource->mapped_size = st.st_size;
+			resource->input = (const unsigned char*)mapped;
+			resource->input_pos = offset;
+			resource->input_size = st.st_size;
+		}
+	}
+
+	if(resource->mapped==NULL) {
+		resource->fd = fd;
+		resource->input_buffer = malloc(INPUT_SIZE);
+		if(!resource->input_buffer) {
+			error(1, errno, "error allocating resource buffer");
+		}
+		resource->input = resource->input_buffer;
+	}
+
+	return resource_start(resource);
+}
+
+resource_t* resource_open_mem(const void* buffer, size_t size, const char* name) {
+
+	resource_t* resource = resource_init(name);
+
+	resource->input = (const unsigned char*)buffer;
+	resource->input_size = size;
+
+	return resource_start(resource);
+}
+
+const char* resource_next(resource_t* resource, size_t* size) {
+
+	const char* next = NULL;
+	*size = 0;
+
+	switch(resource->format) {
+	case RESOURCE_PLAIN:
+		next = (const char*)input_next(resource, resource->fd < 0 ? MEMORY_CHUNK_SIZE : INPUT_SIZE, size);
+		break;
+	case RESOURCE_ZIP_STORED:
+		next = (const char*)input_next(resource, resource->stored_left < MEMORY_CHUNK_SIZE ? resource->stored_left : MEMORY_CHUNK_SIZE, size);
+		resource->stored_left -= *size;
+		break;
+#ifdef HAVE_LIBZ
+	case RESOURCE_GZIP:
+	case RESOURCE_ZIP_DEFLATED:
+		next = inflate_next(resource, size);
+		break;
+#endif
+	default:
+		break;
+	}
+
+	return next;
+}
+
+const char* resource_contents(const resource_t* resource, size_t* size) {
+
+	size_t available = resource->input_size - resource->input_pos;
+
+	// A stream reads a buffer at a time
+	if(resource->fd >= 0) {
+		return NULL;
+	}
+	else if(resource->format==RESOURCE_PLAIN) {
+		*size = available;
+	}
+	else if(resource->format==RESOURCE_ZIP_STORED && resource->stored_left <= available) {
+		*size = resource->stored_left;
+	}
+	else {
+		return NULL;
+	}
+
+	return (const char*)resource->input + resource->input_pos;
+}
+
+const char* resource_name(const resource_t* resource) {
+	return resource->name;
+}
+
+void resource_close(resource_t* resource) {
+
+#ifdef HAVE_LIBZ
+	if(resource->inflating) {
+		inflateEnd(&resource->stream);
+		free(resource->output);
+	}
+#endif
+
+	if(resource->mapped!=NULL) {
+		munmap(resource->mapped, resource->mapped_size);
+	}
+
+	if(resource->close_fd) {
+		close(resource->fd);
+	}
+
+	free(resource->input_buffer);
+	free(resource);
+}
@@ -0,0 +1,96 @@
+/* Copyright (C) 2011 Fantayeneh Asres Gizaw, Filippo De Luca
+ *
+ * This file is part of libWURFL.
+ *
+ * libWURFL is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * any later version.
+ *
+ * libWURFL is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with libWURFL.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/* Written by Filippo De Luca <me@filippodeluca.com>.  */
+
+#ifndef RESOURCE_H_
+#define RESOURCE_H_
+
+#include <stdlib.h>
+#include <sys/types.h>
+
+/**
+ * The resource_t type.
+ *
+ * It is a stream of the wurfl XML, read from a plain, gzip or zip file, a
+ * file descriptor or a memory buffer. The compressed data are inflated while
+ * they are read, they are never written to disk. The format is detected from
+ * the content.
+ *
+ * The regular files are mapped in memory, so the plain XML is parsed where
+ * it is, without copies.
+ */
+typedef struct _resource_t resource_t;
+
+/**
+ * Open the resource at the given path.
+ *
+ * @param path The plain, gzip or zip file path.
+ * @return the opened resource.
+ */
+resource_t* resource_open(const char* path);
+
+/**
+ * Open a resource from a file descriptor, from its current position. The
+ * file descriptor is not closed by resource_close().
+ *
+ * @param fd The file descriptor of a plain, gzip or zip file or stream.
+ * @param name The name used in the error messages.
+ * @return the opened resource.
+ */
+resource_t* resource_open_fd(int fd, const char* name);
+
+/**
+ * Open a resource from a memory buffer. The buffer is not copied, it must
+ * outlive the resource.
+ *
+ * @param buffer The plain, gzip or zip content.
+ * @param size The buffer size.
+ * @param name The name used in the error messages.
+ * @return the opened resource.
+ */
+resource_t* resource_open_mem(const void* buffer, size_t size, const char* name);
+
+/**
+ * Read the next XML chunk. It is valid until the next call.
+ *
+ * @param resource The resource to read from.
+ * @param size It is set to the chunk size, 0 at the end of the resource.
+ * @return the chunk.
+ */
+const char* resource_next(resource_t* resource, size_t* size);
+
+/**
+ * Get the whole XML at once, if it is already in memory: the plain or
+ * stored files mapped or in a memory buffer. The resource is not consumed,
+ * it can still be read by resource_next().
+ *
+ * @param resource The resource not read yet.
+ * @param size It is set to the XML size.
+ * @return the XML or NULL if it is not in memory.
+ */
+const char* resource_contents(const resource_t* resource, size_t* size);
+
+/**
+ * @return the resource name, for the error messages.
+ */
+const char* resource_name(const resource_t* resource);
+
+void resource_close(resource_t* resource);
+
+#endif /* RESOURCE_H_ */
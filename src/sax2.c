@@ -21,9 +21,12 @@
 #include "parser.h"
 
 #include "devicedef.h"
+#include "scanner.h"
 #include "utils/utils.h"
 #include "utils/hashmap.h"
 #include "utils/hashtable.h"
+#include "utils/strpool.h"
+#include "utils/arena.h"
 #include "utils/error.h"
 
 #include <libxml/encoding.h>
@@ -35,6 +38,12 @@
 #include <libxml/xmlstring.h>
 #include <iconv.h>
 
+#include <config.h>
+
+#ifdef HAVE_LIBPTHREAD
+#include <pthread.h>
+#endif
+
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -58,140 +67,343 @@
 #define ATTR_FALL_BACK BAD_CAST("fall_back")
 #define ATTR_ACTUAL_DEVICE_ROOT BAD_CAST("actual_device_root")
 
+/**
+ * Longer capability or group names are never in the filter.
+ */
+#define FILTER_NAME_SIZE 256
+
+/**
+ * Longer capability names are decoded in a heap buffer.
+ */
+#define NAME_BUFFER_SIZE 1024
+
+/**
+ * The initial room for the capabilities of a device, it grows as needed.
+ */
+#define CAPABILITIES_INIT_CAPACITY 512
+
+#define PARSED_INIT_CAPACITY 1024
+
+/**
+ * The smallest document part worth a thread.
+ */
+#define PART_MIN_SIZE (512 * 1024)
+
+
 extern int errno;
 
 typedef struct {
 	hashmap_t* devices;
-	hashtable_t* capabilities;
+	strpool_t* capabilities;
+	hashtable_t* filter;
+	arena_t* arena;
 	char* version;
 
+	// UTF-8 to ASCII, open for the whole parse
+	iconv_t converter;
+
+	// The escaped attribute values of the current element, decoded
+	char* unescaped;
+	size_t unescaped_capacity;
+
 	devicedef_t* current_devicedef;
+	bool current_group_selected;
+
+	// The current device capabilities, copied in the device when it ends
+	devicedef_capability_t* current_capabilities;
+	uint32_t current_capabilities_size;
+	uint32_t current_capabilities_capacity;
+
+	// The parsed devices, in document order
+	devicedef_t** parsed;
+	uint32_t parsed_size;
+	uint32_t parsed_capacity;
 } parse_context_t;
 
-static void decode_string(char* dst, const xmlChar* src) {
+static void context_init(parse_context_t* context, hashtable_t* filter, strpool_t* capabilities, arena_t* arena) {
 
-	char* output = dst;
-	char* input = (char*)src;
-	size_t inputlen = strlen(input);
+	memset(context, 0, sizeof(parse_context_t));
+
+	context->devices = NULL;
+	context->capabilities = capabilities;
+	context->filter = filter;
+	context->arena = arena;
+	context->current_devicedef = NULL;
+	context->current_group_selected = false;
+
+	context->current_capabilities_capacity = CAPABILITIES_INIT_CAPACITY;
+	context->current_capabilities = malloc(sizeof(devicedef_capability_t) * context->current_capabilities_capacity);
+	if(!context->current_capabilities) {
+		error(1, errno, "error allocating device capabilities");
+	}
+	context->current_capabilities_size = 0;
 
-	size_t inputleft = inputlen;
-	size_t outputleft = xmlStrlen(src);
+	context->parsed_capacity = PARSED_INIT_CAPACITY;
+	context->parsed = malloc(sizeof(devicedef_t*) * context->parsed_capacity);
+	if(!context->parsed) {
+		error(1, errno, "error allocating parsed devices");
+	}
+	context->parsed_size = 0;
 
-	iconv_t* cd = iconv_open("ASCII", "UTF-8");
-	if(cd < 0) { // returns -1 on error
+	context->converter = iconv_open("ASCII", "UTF-8");
+	if(context->converter==(iconv_t)-1) {
 		// It is very improbable
 		error(2, errno, "iconv does not support UTF-8 or ASCII");
 	}
-	size_t converted = iconv(cd, &input, &inputleft, &output, &outputleft);
-	if(converted < 0) {
-		error(2, errno, "error converting string");
-	}
+}
 
-	iconv_close(cd);
+static void context_free(parse_context_t* context) {
 
+	iconv_close(context->converter);
+	free(context->unescaped);
+	free(context->current_capabilities);
+	free(context->parsed);
 }
 
-static char* create_string(const xmlChar* string, parse_context_t* context) {
+/**
+ * @return room for the decoded attribute values of an element, reused by
+ * the next one.
+ */
+static char* unescaped_room(parse_context_t* context, size_t size) {
 
-	char tmp[8 * 1024];
-	memset(tmp, '\0', 8 * 1024);
+	if(size > context->unescaped_capacity) {
+		context->unescaped = realloc(context->unescaped, sizeof(char) * size);
+		if(!context->unescaped) {
+			error(1, errno, "error allocating attribute values");
+		}
+		context->unescaped_capacity = size;
+	}
 
-	decode_string(tmp, string);
+	return context->unescaped;
+}
 
-	// TODO intern the string?
-	char* output = malloc(sizeof(char) * (strlen(tmp) + 1));
-	if(!output) {
-		error(1, errno, "error allocating string");
+/**
+ * Decode the UTF-8 src in dst, which must have room for len + 1 chars. The
+ * ASCII strings, almost all of them, are just copied. The conversion of
+ * the others stops at the first char that is not ASCII.
+ */
+static void decode_string(parse_context_t* context, char* dst, const xmlChar* src, size_t len) {
+
+	if(string_is_ascii((const char*)src, len)) {
+		memcpy(dst, src, len);
+		dst[len] = '\0';
 	}
-	strcpy(output, tmp);
+	else {
+		char* input = (char*)src;
+		char* output = dst;
+		size_t inputleft = len;
+		size_t outputleft = len;
 
-	return output;
+		// Reset the converter state left by a previous failed conversion
+		iconv(context->converter, NULL, NULL, NULL, NULL);
+		iconv(context->converter, &input, &inputleft, &output, &outputleft);
+
+		*output = '\0';
+	}
 }
 
-static char* create_capability_name(const xmlChar* string, parse_context_t* context) {
+/**
+ * An attribute value, pointing in the libxml2 buffer or in the scanned
+ * document. It is not NUL terminated and it is valid only in the callback
+ * it comes from.
+ */
+typedef struct {
+	const xmlChar* value;
+	size_t len;
+} attribute_t;
 
-	char tmp[8 * 1024];
-	memset(tmp, '\0', 8 * 1024);
+/**
+ * The attributes read from an element, the values array has an entry for
+ * each name.
+ */
+typedef struct {
+	const xmlChar* const* names;
+	int size;
+} element_attributes_t;
 
-	decode_string(tmp, string);
+static void init_attributes(const element_attributes_t* names, attribute_t* values) {
 
-	char* name = hashtable_get(context->capabilities, tmp);
-	if(!name) {
-		name = malloc(sizeof(char) * (strlen(tmp) + 1));
-		if(!name) {
-			error(1, errno, "error allocating capability name");
-		}
-
-		strcpy(name, tmp);
-		hashtable_add(context->capabilities, name, NULL, NULL);
+	int index;
+	for(index=0; index<names->size; index++) {
+		values[index].value = NULL;
+		values[index].len = 0;
 	}
+}
 
-	return name;
+/**
+ * Keep the attribute value if the attribute is one of the names. Nothing
+ * is copied.
+ */
+static void set_attribute(const element_attributes_t* names, attribute_t* values, const xmlChar* name, size_t name_len, const xmlChar* value, size_t value_len) {
 
+	int index;
+	for(index=0; index<names->size; index++) {
+		const xmlChar* candidate = names->names[index];
+		if(values[index].value==NULL && xmlStrncmp(candidate, name, name_len)==0 && candidate[name_len]=='\0') {
+			values[index].value = value;
+			values[index].len = value_len;
+			break;
+		}
+	}
 }
 
+/**
+ * Collect the libxml2 attributes with the given names in a single pass.
+ * Without the entities replacement libxml2 leaves the '&' of the values
+ * as "&#38;", they are decoded like the scanned ones.
+ */
+static void get_attributes(parse_context_t* context, int nb_attributes, const xmlChar** attributes, const element_attributes_t* names, attribute_t* values) {
 
-static xmlChar* get_attribute(parse_context_t* context, int nb_attributes,	const xmlChar** attributes, const xmlChar* name) {
-
-	xmlChar *value=NULL;
+	init_attributes(names, values);
 
+	size_t values_size = 0;
 	int index;
-	for(index=0; index<nb_attributes && value==NULL; index++) {
+	for(index=0; index<nb_attributes; index++) {
+		values_size += attributes[index * 5 + 4] - attributes[index * 5 + 3];
+	}
+	char* unescaped = unescaped_room(context, values_size);
+
+	for(index=0; index<nb_attributes; index++) {
 		int att_index = index * 5;
 
 		const xmlChar *localname = attributes[att_index];
-		if(xmlStrEqual(name, localname)) {
+		//const xmlChar *prefix = attributes[att_index+1];
+		//const xmlChar *nsURI = attributes[att_index+2];
+		const xmlChar *valueBegin = attributes[att_index+3];
+		const xmlChar *valueEnd = attributes[att_index+4];
+
+		size_t value_len = valueEnd - valueBegin;
+		if(memchr(valueBegin, '&', value_len)!=NULL) {
+			value_len = scanner_decode(unescaped, (const char*)valueBegin, value_len);
+			valueBegin = BAD_CAST(unescaped);
+			unescaped += value_len;
+		}
 
-			//const xmlChar *prefix = attributes[att_index+1];
-			//const xmlChar *nsURI = attributes[att_index+2];
-			const xmlChar *valueBegin = attributes[att_index+3];
-			const xmlChar *valueEnd = attributes[att_index+4];
+		set_attribute(names, values, localname, xmlStrlen(localname), valueBegin, value_len);
+	}
+}
+
+static bool attribute_equals(const attribute_t* attribute, const char* string) {
+
+	size_t len = strlen(string);
+
+	return attribute->value!=NULL && attribute->len==len && memcmp(attribute->value, string, len)==0;
+}
+
+/**
+ * Decode the attribute value straight in the arena, it is the only copy.
+ */
+static char* create_string(parse_context_t* context, const attribute_t* attribute) {
+
+	// TODO intern the string?
+	char* output = arena_alloc(context->arena, sizeof(char) * (attribute->len + 1));
+	if(attribute->value!=NULL) {
+		decode_string(context, output, attribute->value, attribute->len);
+	}
+	else {
+		output[0] = '\0';
+	}
 
-			int value_size = valueEnd - valueBegin;
-			value = xmlStrsub(valueBegin, 0, value_size);
+	return output;
+}
+
+static uint32_t create_capability_name(parse_context_t* context, const attribute_t* attribute) {
+
+	size_t len = attribute->len;
+
+	char buffer[NAME_BUFFER_SIZE];
+	char* name = buffer;
+	if(len >= NAME_BUFFER_SIZE) {
+		name = malloc(sizeof(char) * (len + 1));
+		if(!name) {
+			error(1, errno, "error allocating capability name");
 		}
+	}
+	decode_string(context, name, attribute->value, len);
 
+	uint32_t id = strpool_add(context->capabilities, name);
+
+	if(name!=buffer) {
+		free(name);
 	}
 
-	return value;
+	return id;
 }
 
-static devicedef_t* create_devicedef(parse_context_t* context, int nb_attributes, const xmlChar** attributes) {
+/**
+ * Check if the attribute value is in the filter, without allocating.
+ */
+static bool attribute_selected(parse_context_t* context, const attribute_t* attribute) {
+
+	bool selected = false;
 
-	const xmlChar* id = get_attribute(context, nb_attributes, attributes, ATTR_ID);
-	const xmlChar* user_agent = get_attribute(context, nb_attributes, attributes, ATTR_USER_AGENT);
-	const xmlChar* fallback = get_attribute(context, nb_attributes, attributes, ATTR_FALL_BACK);
-	const xmlChar* actual_device_root = get_attribute(context, nb_attributes, attributes, ATTR_ACTUAL_DEVICE_ROOT);
+	if(attribute->value!=NULL && attribute->len < FILTER_NAME_SIZE) {
+		char value[FILTER_NAME_SIZE];
+		memcpy(value, attribute->value, attribute->len);
+		value[attribute->len] = '\0';
 
-	devicedef_t* devicedef = malloc(sizeof(devicedef_t));
-	if(devicedef==NULL) {
-		error(1, errno, "error allocating device");
+		selected = hashtable_contains(context->filter, value);
 	}
-	hashmap_options_t caps_opts = {400, .75f};
-	devicedef->capabilities = hashmap_init(&string_eq, &string_hash, &caps_opts);
 
+	return selected;
+}
+
+static const xmlChar* const DEVICE_ATTRIBUTES[] = {ATTR_ID, ATTR_USER_AGENT, ATTR_FALL_BACK, ATTR_ACTUAL_DEVICE_ROOT};
+
+enum {DEVICE_ID, DEVICE_USER_AGENT, DEVICE_FALL_BACK, DEVICE_ACTUAL_DEVICE_ROOT, DEVICE_ATTRIBUTES_SIZE};
+
+static const xmlChar* const CAPABILITY_ATTRIBUTES[] = {ATTR_NAME, ATTR_VALUE};
+
+enum {CAPABILITY_NAME, CAPABILITY_VALUE, CAPABILITY_ATTRIBUTES_SIZE};
 
-	if(!id || xmlStrlen(id)==0) {
+static const xmlChar* const GROUP_ATTRIBUTES[] = {ATTR_ID};
+
+enum {GROUP_ID, GROUP_ATTRIBUTES_SIZE};
+
+/**
+ * The attributes read by element, no element reads more than
+ * MAX_ATTRIBUTES_SIZE.
+ */
+static const element_attributes_t ELEMENT_ATTRIBUTES[] = {
+	[SCANNER_ELEMENT_OTHER] = {NULL, 0},
+	[SCANNER_ELEMENT_DEVICE] = {DEVICE_ATTRIBUTES, DEVICE_ATTRIBUTES_SIZE},
+	[SCANNER_ELEMENT_GROUP] = {GROUP_ATTRIBUTES, GROUP_ATTRIBUTES_SIZE},
+	[SCANNER_ELEMENT_CAPABILITY] = {CAPABILITY_ATTRIBUTES, CAPABILITY_ATTRIBUTES_SIZE}
+};
+
+#define MAX_ATTRIBUTES_SIZE DEVICE_ATTRIBUTES_SIZE
+
+static devicedef_t* create_devicedef(parse_context_t* context, const attribute_t* values) {
+
+	const attribute_t* id = &values[DEVICE_ID];
+	const attribute_t* user_agent = &values[DEVICE_USER_AGENT];
+	const attribute_t* fallback = &values[DEVICE_FALL_BACK];
+
+	devicedef_t* devicedef = arena_alloc(context->arena, sizeof(devicedef_t));
+	devicedef->capabilities = NULL;
+	devicedef->capabilities_size = 0;
+
+	if(id->len==0) {
 		error(2,0,"The device id must be != null");
 	}
 	else {
-		devicedef->id = create_string(id, context);
+		devicedef->id = create_string(context, id);
 	}
 
-	if(!user_agent || xmlStrlen(user_agent)==0) {
+	if(user_agent->len==0) {
 		devicedef->user_agent = NULL;
 	}
 	else {
-		devicedef->user_agent = create_string(user_agent, context);
+		devicedef->user_agent = create_string(context, user_agent);
 	}
 
-	if(xmlStrEqual(fallback, BAD_CAST("root")) || xmlStrlen(fallback)<=0) {
+	if(attribute_equals(fallback, "root") || fallback->len==0) {
 		devicedef->fall_back = NULL;
 	}
 	else {
-		devicedef->fall_back = create_string(fallback, context);
+		devicedef->fall_back = create_string(context, fallback);
 	}
-	devicedef->actual_device_root = xmlStrEqual(actual_device_root, BAD_CAST("true"));
+	devicedef->actual_device_root = attribute_equals(&values[DEVICE_ACTUAL_DEVICE_ROOT], "true");
 
 	return devicedef;
 
@@ -200,17 +412,24 @@ static devicedef_t* create_devicedef(parse_context_t* context, int nb_attributes
 
 // Handlers ***************************************************************
 
-static void start_capability(parse_context_t* context, int nb_attributes, const xmlChar** attributes) {
-
-	const xmlChar* xml_name = get_attribute(context, nb_attributes, attributes, ATTR_NAME);
+static void start_capability(parse_context_t* context, const attribute_t* values) {
 
-	if(xml_name) {
-		const xmlChar* xml_value = get_attribute(context, nb_attributes, attributes, ATTR_VALUE);
+	if(context->filter!=NULL && !context->current_group_selected && !attribute_selected(context, &values[CAPABILITY_NAME])) {
+		return;
+	}
 
-		const char* name = create_capability_name(xml_name, context);
-		const char* value = create_string(xml_value, context);
+	if(values[CAPABILITY_NAME].value) {
+		if(context->current_capabilities_size==context->current_capabilities_capacity) {
+			context->current_capabilities_capacity *= 2;
+			context->current_capabilities = realloc(context->current_capabilities, sizeof(devicedef_capability_t) * context->current_capabilities_capacity);
+			if(!context->current_capabilities) {
+				error(1, errno, "error growing device capabilities");
+			}
+		}
 
-		hashmap_put(context->current_devicedef->capabilities, name, value);
+		devicedef_capability_t* capability = context->current_capabilities + context->current_capabilities_size++;
+		capability->capability = create_capability_name(context, &values[CAPABILITY_NAME]);
+		capability->value = create_string(context, &values[CAPABILITY_VALUE]);
 	}
 	else {
 		error(0,0,"ignore null capability name in device %s", context->current_devicedef->id);
@@ -221,20 +440,306 @@ static void end_capability(parse_context_t* context) {
 
 }
 
-static void start_device(parse_context_t* context, int nb_attributes, const xmlChar** attributes) {
+static void start_group(parse_context_t* context, const attribute_t* values) {
 
-	context->current_devicedef = create_devicedef(context, nb_attributes, attributes);
+	context->current_group_selected = context->filter!=NULL && attribute_selected(context, &values[GROUP_ID]);
+}
+
+static void end_group(parse_context_t* context) {
+
+	context->current_group_selected = false;
+}
+
+static void start_device(parse_context_t* context, const attribute_t* values) {
+
+	context->current_devicedef = create_devicedef(context, values);
+	context->current_capabilities_size = 0;
+}
+
+static void add_parsed(parse_context_t* context, devicedef_t* devicedef) {
+
+	if(context->parsed_size==context->parsed_capacity) {
+		context->parsed_capacity *= 2;
+		context->parsed = realloc(context->parsed, sizeof(devicedef_t*) * context->parsed_capacity);
+		if(!context->parsed) {
+			error(1, errno, "error growing parsed devices");
+		}
+	}
+	context->parsed[context->parsed_size++] = devicedef;
 }
 
 static void end_device(parse_context_t* context) {
 
-	hashmap_put(context->devices, context->current_devicedef->id, context->current_devicedef);
+	devicedef_set_capabilities(context->current_devicedef, context->current_capabilities, context->current_capabilities_size);
+
+	// The devices are added at the end, the scanner can give up
+	add_parsed(context, context->current_devicedef);
 
 	// reset context
 	context->current_devicedef = NULL;
 
 }
 
+static void start_element(parse_context_t* context, scanner_element_t element, const attribute_t* values) {
+
+	switch(element) {
+	case SCANNER_ELEMENT_DEVICE:
+		start_device(context, values);
+		break;
+	case SCANNER_ELEMENT_CAPABILITY:
+		start_capability(context, values);
+		break;
+	case SCANNER_ELEMENT_GROUP:
+		start_group(context, values);
+		break;
+	default:
+		// ignore other
+		break;
+	}
+}
+
+static void end_element(parse_context_t* context, scanner_element_t element) {
+
+	switch(element) {
+	case SCANNER_ELEMENT_DEVICE:
+		end_device(context);
+		break;
+	case SCANNER_ELEMENT_CAPABILITY:
+		end_capability(context);
+		break;
+	case SCANNER_ELEMENT_GROUP:
+		end_group(context);
+		break;
+	default:
+		// ignore other
+		break;
+	}
+}
+
+// Scanner implementation *************************************************
+
+static void scanner_start(void* xtra, scanner_element_t element, const scanner_attribute_t* attributes, int attributes_size) {
+
+	parse_context_t* context = (parse_context_t*) xtra;
+
+	if(element!=SCANNER_ELEMENT_OTHER) {
+		const element_attributes_t* names = &ELEMENT_ATTRIBUTES[element];
+		attribute_t values[MAX_ATTRIBUTES_SIZE];
+
+		init_attributes(names, values);
+
+		// The escaped values are decoded before they are read, they are
+		// never longer
+		size_t escaped_size = 0;
+		int index;
+		for(index=0; index<attributes_size; index++) {
+			if(attributes[index].escaped) {
+				escaped_size += attributes[index].value_size;
+			}
+		}
+		char* unescaped = unescaped_room(context, escaped_size);
+		for(index=0; index<attributes_size; index++) {
+			const scanner_attribute_t* attribute = attributes + index;
+			const char* value = attribute->value;
+			size_t value_size = attribute->value_size;
+			if(attribute->escaped) {
+				value_size = scanner_decode(unescaped, value, value_size);
+				value = unescaped;
+				unescaped += value_size;
+			}
+			set_attribute(names, values, BAD_CAST(attribute->name), attribute->name_size, BAD_CAST(value), value_size);
+		}
+
+		start_element(context, element, values);
+	}
+}
+
+static void scanner_end(void* xtra, scanner_element_t element) {
+
+	end_element((parse_context_t*) xtra, element);
+}
+
+/**
+ * Drop the devices parsed so far, the scanner gave up.
+ */
+static void drop_parsed(parse_context_t* context) {
+
+	uint32_t index;
+	for(index=0; index<context->parsed_size; index++) {
+		devicedef_release_capabilities(context->parsed[index]);
+	}
+	context->parsed_size = 0;
+	context->current_devicedef = NULL;
+	context->current_group_selected = false;
+}
+
+/**
+ * Scan the whole document, it is in memory. If the scanner gives up, the
+ * devices parsed so far are dropped.
+ */
+static bool scan_document(parse_context_t* context, const char* document, size_t size) {
+
+	bool scanned = scanner_parse(document, size, &scanner_start, &scanner_end, context);
+
+	if(!scanned) {
+		drop_parsed(context);
+	}
+
+	return scanned;
+}
+
+#ifdef HAVE_LIBPTHREAD
+
+typedef struct {
+	const char* document;
+	scanner_part_t* part;
+	parse_context_t* context;
+	bool scanned;
+} part_data_t;
+
+static void* scan_part(void* xtra) {
+
+	part_data_t* data = (part_data_t*)xtra;
+
+	data->scanned = scanner_parse_part(data->document, data->part, &scanner_start, &scanner_end, data->context);
+
+	return NULL;
+}
+
+/**
+ * Move the devices of a part to the context. The part capability names are
+ * added to the context pool, in document order.
+ */
+static void merge_part(parse_context_t* context, parse_context_t* part_context) {
+
+	uint32_t names_size = strpool_size(part_context->capabilities);
+	uint32_t* ids = malloc(sizeof(uint32_t) * (names_size + 1));
+	if(!ids) {
+		error(1, errno, "error allocating capability ids");
+	}
+
+	uint32_t id;
+	for(id=0; id<names_size; id++) {
+		ids[id] = strpool_add_hashed(context->capabilities, strpool_get(part_context->capabilities, id), strpool_hash(part_context->capabilities, id));
+	}
+
+	uint32_t index;
+	for(index=0; index<part_context->parsed_size; index++) {
+		devicedef_remap_capabilities(part_context->parsed[index], ids);
+		add_parsed(context, part_context->parsed[index]);
+	}
+	part_context->parsed_size = 0;
+
+	free(ids);
+}
+
+/**
+ * Scan the parts of the document on different threads, the first one on
+ * this thread. Every part has its own context, with its arena and names
+ * pool, they are merged in the given context at the end. If the scanner
+ * gives up on any part, nothing is parsed.
+ *
+ * @param scanned It is set to false if the scanner gave up.
+ * @return false if the document is too small to be split, it is not
+ * scanned then.
+ */
+static bool scan_document_parallel(parse_context_t* context, const char* document, size_t size, int threads, bool* scanned) {
+
+	size_t parts_size = size / PART_MIN_SIZE;
+	if(parts_size > (size_t)threads) {
+		parts_size = threads;
+	}
+	if(parts_size < 2) {
+		return false;
+	}
+
+	scanner_part_t* parts = malloc(sizeof(scanner_part_t) * parts_size);
+	part_data_t* data = malloc(sizeof(part_data_t) * parts_size);
+	parse_context_t* contexts = malloc(sizeof(parse_context_t) * parts_size);
+	pthread_t* workers = malloc(sizeof(pthread_t) * parts_size);
+	if(!parts || !data || !contexts || !workers) {
+		error(1, errno, "error allocating document parts");
+	}
+
+	parts_size = scanner_split(document, size, parts, parts_size);
+
+	size_t index;
+	for(index=0; index<parts_size; index++) {
+		data[index].document = document;
+		data[index].part = parts + index;
+		data[index].scanned = false;
+
+		if(index==0) {
+			data[index].context = context;
+		}
+		else {
+			context_init(contexts + index, context->filter, strpool_init(), arena_init());
+			data[index].context = contexts + index;
+		}
+	}
+
+	size_t started;
+	for(started=1; started<parts_size; started++) {
+		if(pthread_create(workers + started, NULL, &scan_part, data + started)!=0) {
+			break;
+		}
+	}
+	// The parts without a thread are scanned here
+	scan_part(data);
+	for(index=started; index<parts_size; index++) {
+		scan_part(data + index);
+	}
+
+	*scanned = true;
+	for(index=0; index<parts_size; index++) {
+		if(index > 0 && index < started) {
+			pthread_join(workers[index], NULL);
+		}
+		*scanned = *scanned && data[index].scanned;
+	}
+	*scanned = *scanned && scanner_join(parts, parts_size);
+
+	for(index=1; index<parts_size; index++) {
+		parse_context_t* part_context = contexts + index;
+		if(*scanned) {
+			merge_part(context, part_context);
+			arena_merge(context->arena, part_context->arena);
+		}
+		else {
+			drop_parsed(part_context);
+			arena_free(part_context->arena);
+		}
+
+		strpool_free(part_context->capabilities);
+		context_free(part_context);
+	}
+	if(!*scanned) {
+		drop_parsed(context);
+	}
+
+	free(parts);
+	free(data);
+	free(contexts);
+	free(workers);
+
+	return true;
+}
+
+#endif
+
+static scanner_element_t element_of(const xmlChar* localname) {
+
+	if (xmlStrEqual(localname, ELEM_DEVICE)) {
+		return SCANNER_ELEMENT_DEVICE;
+	} else if (xmlStrEqual(localname, ELEM_CAPABILITY)) {
+		return SCANNER_ELEMENT_CAPABILITY;
+	} else if (xmlStrEqual(localname, ELEM_GROUP)) {
+		return SCANNER_ELEMENT_GROUP;
+	} else {
+		return SCANNER_ELEMENT_OTHER;
+	}
+}
+
 // Sax implementation *****************************************************
 
 static void start_document(void *ctx) {
@@ -257,12 +762,12 @@ static void startElementNs (void *ctx,
 
 	parse_context_t* context = (parse_context_t*) ctx;
 
-	if (xmlStrEqual(localname,ELEM_DEVICE)) {
-		start_device(context, nb_attributes, attributes);
-	} else if (xmlStrEqual(localname, ELEM_CAPABILITY)) {
-		start_capability(context, nb_attributes, attributes);
-	} else {
-		// ignore other
+	scanner_element_t element = element_of(localname);
+	if(element!=SCANNER_ELEMENT_OTHER) {
+		attribute_t values[MAX_ATTRIBUTES_SIZE];
+		get_attributes(context, nb_attributes, attributes, &ELEMENT_ATTRIBUTES[element], values);
+
+		start_element(context, element, values);
 	}
 }
 
@@ -271,16 +776,7 @@ void endElementNs(void *ctx,
 					const xmlChar *prefix,
 					const xmlChar *URI) {
 
-	parse_context_t* context = (parse_context_t*) ctx;
-
-	if (xmlStrEqual(localname, ELEM_DEVICE)) {
-		end_device(context);
-	} else if (xmlStrEqual(localname, ELEM_CAPABILITY)) {
-		end_capability(context);
-	} else {
-		// ignore other
-	}
-
+	end_element((parse_context_t*) ctx, element_of(localname));
 }
 
 static void chars(void *ctx, const xmlChar *ch, int len) {
@@ -304,9 +800,9 @@ static void sax_nop(void *ctx) {
 }
 
 /**
- * Parse function
+ * Parse the resource with libxml2, it is inflated and parsed chunk by chunk.
  */
-int parse_resource(const char* path, parser_data_t* resource_data) {
+static void parse_xml(parse_context_t* context, resource_t* resource) {
 
 	xmlSAXHandler saxHandler;
 	memset(&saxHandler, 0, sizeof(saxHandler));
@@ -328,23 +824,67 @@ int parse_resource(const char* path, parser_data_t* resource_data) {
 	saxHandler.fatalError = &sax_fatal;
 	saxHandler.warning = &sax_warn;
 
+	const char* name = resource_name(resource);
+
+	size_t chunk_size;
+	const char* chunk = resource_next(resource, &chunk_size);
+	xmlParserCtxtPtr parser = xmlCreatePushParserCtxt(&saxHandler, context, chunk, chunk_size, name);
+	if(!parser) {
+		error(2, 0, "error creating parser for file: %s", name);
+	}
+
+	int sax_error = 0;
+	do {
+		chunk = resource_next(resource, &chunk_size);
+		sax_error = xmlParseChunk(parser, chunk, chunk_size, chunk_size==0);
+	} while(sax_error==0 && chunk_size > 0);
+	if(sax_error || !parser->wellFormed) {
+		error(2, 0, "SAX error parsing file: %s", name);
+	}
+
+	xmlFreeParserCtxt(parser);
+}
+
+void parser_init() {
+
+	xmlInitParser();
+}
+
+/**
+ * Parse function
+ */
+int parse_resource(resource_t* resource, parser_data_t* resource_data) {
+
 	// Creating context
 	parse_context_t context;
-	memset(&context, 0, sizeof(context));
-
+	context_init(&context, resource_data->filter, resource_data->capabilities, resource_data->arena);
 	context.devices = resource_data->devices;
-	context.capabilities = resource_data->capabilities;
-	context.current_devicedef = NULL;
 
-	int sax_error = xmlSAXUserParseFile(&saxHandler, &context, path);
-	if(sax_error) {
-		error(2, 0, "SAX error parsing file: %s", path);
+	// The plain documents in memory are scanned, libxml2 parses the others
+	// and what the scanner does not understand
+	size_t document_size;
+	const char* document = resource_data->libxml2_only ? NULL : resource_contents(resource, &document_size);
+	bool scanned = false;
+	bool split = false;
+#ifdef HAVE_LIBPTHREAD
+	if(document!=NULL && resource_data->threads > 1) {
+		split = scan_document_parallel(&context, document, document_size, resource_data->threads, &scanned);
+	}
+#endif
+	// The scanner giving up on a part gives up on the whole document too
+	if(document!=NULL && !split) {
+		scanned = scan_document(&context, document, document_size);
+	}
+	if(!scanned) {
+		parse_xml(&context, resource);
 	}
 
-	error(0,0, "parsed %d devices", hashmap_size(context.devices));
-
+	uint32_t index;
+	for(index=0; index<context.parsed_size; index++) {
+		hashmap_put(context.devices, context.parsed[index]->id, context.parsed[index]);
+	}
 
-	xmlCleanupParser();
+	context_free(&context);
 
 	return 0;
 }
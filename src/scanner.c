@@ -0,0 +1,723 @@
+/* Copyright (C) 2011 Fantayeneh Asres Gizaw, Filippo De Luca
+ *
+ * This file is part of libWURFL.
+ *
+ * libWURFL is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * any later version.
+ *
+ * libWURFL is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with libWURFL.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/* Written by Filippo De Luca <me@filippodeluca.com>.  */
+
+#include "scanner.h"
+
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <strings.h>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+#define MAX_DEPTH SCANNER_MAX_DEPTH
+
+/**
+ * The WURFL elements have at most 4 attributes.
+ */
+#define MAX_ATTRIBUTES 16
+
+#define ELEMENT(name, element) {name, sizeof(name) - 1, element}
+
+typedef struct {
+	const char* name;
+	size_t size;
+	scanner_element_t element;
+} element_name_t;
+
+/**
+ * The WURFL schema elements, the most frequent first.
+ */
+static const element_name_t ELEMENTS[] = {
+	ELEMENT("capability", SCANNER_ELEMENT_CAPABILITY),
+	ELEMENT("group", SCANNER_ELEMENT_GROUP),
+	ELEMENT("device", SCANNER_ELEMENT_DEVICE),
+	ELEMENT("devices", SCANNER_ELEMENT_OTHER),
+	ELEMENT("wurfl", SCANNER_ELEMENT_OTHER),
+	ELEMENT("wurfl_patch", SCANNER_ELEMENT_OTHER),
+	ELEMENT("version", SCANNER_ELEMENT_OTHER),
+	ELEMENT("ver", SCANNER_ELEMENT_OTHER),
+	ELEMENT("last_updated", SCANNER_ELEMENT_OTHER),
+	ELEMENT("official_url", SCANNER_ELEMENT_OTHER),
+	ELEMENT("statement", SCANNER_ELEMENT_OTHER),
+	ELEMENT("maintainers", SCANNER_ELEMENT_OTHER),
+	ELEMENT("maintainer", SCANNER_ELEMENT_OTHER),
+	ELEMENT("authors", SCANNER_ELEMENT_OTHER),
+	ELEMENT("author", SCANNER_ELEMENT_OTHER),
+	ELEMENT("contributors", SCANNER_ELEMENT_OTHER),
+	ELEMENT("contributor", SCANNER_ELEMENT_OTHER)
+};
+
+#define ELEMENTS_SIZE (sizeof(ELEMENTS) / sizeof(element_name_t))
+
+static inline bool is_space(char c) {
+	return c==' ' || c=='\n' || c=='\t' || c=='\r';
+}
+
+static inline bool is_name_start(char c) {
+	return (c>='a' && c<='z') || (c>='A' && c<='Z') || c=='_';
+}
+
+/**
+ * The ':' is not a name char, the prefixed names are not scanned.
+ */
+static inline bool is_name_char(char c) {
+	return is_name_start(c) || (c>='0' && c<='9') || c=='-' || c=='.';
+}
+
+static const char* skip_spaces(const char* p, const char* end) {
+
+	while(p < end && is_space(*p)) {
+		p++;
+	}
+
+	return p;
+}
+
+static const element_name_t* find_element(const char* name, size_t size) {
+
+	size_t index;
+	for(index=0; index<ELEMENTS_SIZE; index++) {
+		if(ELEMENTS[index].size==size && memcmp(ELEMENTS[index].name, name, size)==0) {
+			return ELEMENTS + index;
+		}
+	}
+
+	return NULL;
+}
+
+/**
+ * @return the first '<' or '&' from p, end if there is none.
+ */
+static const char* find_markup(const char* p, const char* end) {
+
+#ifdef __SSE2__
+	const __m128i lt = _mm_set1_epi8('<');
+	const __m128i amp = _mm_set1_epi8('&');
+
+	while(end - p >= 16) {
+		__m128i block = _mm_loadu_si128((const __m128i*)p);
+		int mask = _mm_movemask_epi8(_mm_or_si128(_mm_cmpeq_epi8(block, lt), _mm_cmpeq_epi8(block, amp)));
+		if(mask!=0) {
+			return p + __builtin_ctz(mask);
+		}
+		p += 16;
+	}
+#endif
+
+	while(p < end && *p!='<' && *p!='&') {
+		p++;
+	}
+
+	return p;
+}
+
+/**
+ * @return the first quote, '<', '&', control or not ASCII char from p, end
+ *         if there is none.
+ */
+static const char* find_value_stop(const char* p, const char* end, char quote) {
+
+#ifdef __SSE2__
+	const __m128i quotes = _mm_set1_epi8(quote);
+	const __m128i lt = _mm_set1_epi8('<');
+	const __m128i amp = _mm_set1_epi8('&');
+	const __m128i controls = _mm_set1_epi8(0x1f);
+
+	while(end - p >= 16) {
+		__m128i block = _mm_loadu_si128((const __m128i*)p);
+		__m128i stops = _mm_or_si128(_mm_cmpeq_epi8(block, quotes), _mm_or_si128(_mm_cmpeq_epi8(block, lt), _mm_cmpeq_epi8(block, amp)));
+		stops = _mm_or_si128(stops, _mm_cmpeq_epi8(_mm_max_epu8(block, controls), controls));
+		// The high bit of the not ASCII chars is taken as it is
+		int mask = _mm_movemask_epi8(_mm_or_si128(stops, block));
+		if(mask!=0) {
+			return p + __builtin_ctz(mask);
+		}
+		p += 16;
+	}
+#endif
+
+	while(p < end) {
+		unsigned char c = *p;
+		if(c==(unsigned char)quote || c=='<' || c=='&' || c < 0x20 || c >= 0x80) {
+			break;
+		}
+		p++;
+	}
+
+	return p;
+}
+
+/**
+ * Check the UTF-8 sequence starting at p.
+ *
+ * @return the end of the sequence, NULL if it is not valid.
+ */
+static const char* skip_utf8(const char* p, const char* end) {
+
+	unsigned char lead = *p;
+
+	size_t size;
+	if(lead>=0xc2 && lead<=0xdf) {
+		size = 2;
+	}
+	else if((lead & 0xf0)==0xe0) {
+		size = 3;
+	}
+	else if(lead>=0xf0 && lead<=0xf4) {
+		size = 4;
+	}
+	else {
+		return NULL;
+	}
+
+	if((size_t)(end - p) < size) {
+		return NULL;
+	}
+
+	uint32_t code = lead & (0x7f >> size);
+	size_t index;
+	for(index=1; index<size; index++) {
+		unsigned char next = p[index];
+		if((next & 0xc0)!=0x80) {
+			return NULL;
+		}
+		code = (code << 6) | (next & 0x3f);
+	}
+
+	// Overlong forms and surrogates
+	if((size==3 && (code < 0x800 || (code>=0xd800 && code<=0xdfff))) || (size==4 && (code < 0x10000 || code > 0x10ffff))) {
+		return NULL;
+	}
+
+	return p + size;
+}
+
+#define ENTITY(name, code) {name, sizeof(name) - 1, code}
+
+typedef struct {
+	const char* name;
+	size_t size;
+	char code;
+} entity_name_t;
+
+/**
+ * The predefined entities, the only ones without a DTD.
+ */
+static const entity_name_t ENTITIES[] = {
+	ENTITY("amp", '&'),
+	ENTITY("lt", '<'),
+	ENTITY("gt", '>'),
+	ENTITY("quot", '"'),
+	ENTITY("apos", '\'')
+};
+
+#define ENTITIES_SIZE (sizeof(ENTITIES) / sizeof(entity_name_t))
+
+/**
+ * @return true if the code is a char of an XML document.
+ */
+static inline bool is_xml_char(uint32_t code) {
+	return code==0x9 || code==0xa || code==0xd || (code>=0x20 && code<=0xd7ff) || (code>=0xe000 && code<=0xfffd) || (code>=0x10000 && code<=0x10ffff);
+}
+
+/**
+ * Scan a predefined entity or a character reference, p is at its '&'.
+ *
+ * @param code Set to the char referred.
+ * @return the end of the reference, NULL if it is another one or it is not
+ *         well formed.
+ */
+static const char* scan_reference(const char* p, const char* end, uint32_t* code) {
+
+	const char* semicolon = memchr(p, ';', end - p < 12 ? end - p : 12);
+	if(semicolon==NULL) {
+		return NULL;
+	}
+	p++;
+
+	if(*p!='#') {
+		size_t index;
+		for(index=0; index<ENTITIES_SIZE; index++) {
+			if(ENTITIES[index].size==(size_t)(semicolon - p) && memcmp(ENTITIES[index].name, p, ENTITIES[index].size)==0) {
+				*code = ENTITIES[index].code;
+				return semicolon + 1;
+			}
+		}
+		return NULL;
+	}
+
+	bool hex = p[1]=='x';
+	p += hex ? 2 : 1;
+	if(p==semicolon) {
+		return NULL;
+	}
+
+	// The reference is 12 chars at most, the code cannot overflow
+	*code = 0;
+	for(; p < semicolon; p++) {
+		char c = *p;
+		if(c>='0' && c<='9') {
+			*code = *code * (hex ? 16 : 10) + (c - '0');
+		}
+		else if(hex && ((c>='a' && c<='f') || (c>='A' && c<='F'))) {
+			*code = *code * 16 + ((c | 0x20) - 'a' + 10);
+		}
+		else {
+			return NULL;
+		}
+	}
+
+	return is_xml_char(*code) ? semicolon + 1 : NULL;
+}
+
+/**
+ * Write the code in UTF-8.
+ *
+ * @return the end of the written chars.
+ */
+static char* put_utf8(char* dst, uint32_t code) {
+
+	if(code < 0x80) {
+		*dst++ = code;
+	}
+	else if(code < 0x800) {
+		*dst++ = 0xc0 | (code >> 6);
+		*dst++ = 0x80 | (code & 0x3f);
+	}
+	else if(code < 0x10000) {
+		*dst++ = 0xe0 | (code >> 12);
+		*dst++ = 0x80 | ((code >> 6) & 0x3f);
+		*dst++ = 0x80 | (code & 0x3f);
+	}
+	else {
+		*dst++ = 0xf0 | (code >> 18);
+		*dst++ = 0x80 | ((code >> 12) & 0x3f);
+		*dst++ = 0x80 | ((code >> 6) & 0x3f);
+		*dst++ = 0x80 | (code & 0x3f);
+	}
+
+	return dst;
+}
+
+/**
+ * Scan the attributes up to the end of the tag.
+ *
+ * @return the '>', '/' or '?' ending the tag, NULL on anything unexpected.
+ */
+static const char* scan_attributes(const char* p, const char* end, scanner_attribute_t* attributes, int* attributes_size) {
+
+	int size = 0;
+
+	while(true) {
+		const char* spaces = p;
+		p = skip_spaces(p, end);
+		if(p==end) {
+			return NULL;
+		}
+		else if(*p=='>' || *p=='/' || *p=='?') {
+			*attributes_size = size;
+			return p;
+		}
+		else if(p==spaces || !is_name_start(*p) || size==MAX_ATTRIBUTES) {
+			return NULL;
+		}
+
+		const char* name = p;
+		while(p < end && is_name_char(*p)) {
+			p++;
+		}
+		size_t name_size = p - name;
+
+		p = skip_spaces(p, end);
+		if(p==end || *p!='=') {
+			return NULL;
+		}
+		p = skip_spaces(p + 1, end);
+		if(p==end || (*p!='"' && *p!='\'')) {
+			return NULL;
+		}
+
+		char quote = *p++;
+		const char* value = p;
+		bool escaped = false;
+		while(true) {
+			p = find_value_stop(p, end, quote);
+			if(p < end && (unsigned char)*p >= 0x80) {
+				p = skip_utf8(p, end);
+			}
+			else if(p < end && *p=='&') {
+				uint32_t code;
+				p = scan_reference(p, end, &code);
+				escaped = true;
+			}
+			else {
+				break;
+			}
+			if(p==NULL) {
+				return NULL;
+			}
+		}
+		// The white space normalization is left to libxml2
+		if(p==end || *p!=quote) {
+			return NULL;
+		}
+
+		int index;
+		for(index=0; index<size; index++) {
+			if(attributes[index].name_size==name_size && memcmp(attributes[index].name, name, name_size)==0) {
+				return NULL;
+			}
+		}
+
+		attributes[size].name = name;
+		attributes[size].name_size = name_size;
+		attributes[size].value = value;
+		attributes[size].value_size = p - value;
+		attributes[size].escaped = escaped;
+		size++;
+
+		p++;
+	}
+}
+
+/**
+ * Scan the XML declaration, only the UTF-8 and ASCII encodings are taken.
+ *
+ * @return the end of the declaration, NULL on anything unexpected.
+ */
+static const char* scan_declaration(const char* p, const char* end) {
+
+	scanner_attribute_t attributes[MAX_ATTRIBUTES];
+	int attributes_size;
+
+	p = scan_attributes(p, end, attributes, &attributes_size);
+	if(p==NULL || *p!='?' || end - p < 2 || p[1]!='>') {
+		return NULL;
+	}
+
+	int index;
+	for(index=0; index<attributes_size; index++) {
+		const scanner_attribute_t* attribute = attributes + index;
+		if(attribute->name_size==8 && memcmp(attribute->name, "encoding", 8)==0) {
+			bool utf8 = attribute->value_size==5 && strncasecmp(attribute->value, "UTF-8", 5)==0;
+			bool ascii = attribute->value_size==8 && strncasecmp(attribute->value, "US-ASCII", 8)==0;
+			if(!utf8 && !ascii) {
+				return NULL;
+			}
+		}
+	}
+
+	return p + 2;
+}
+
+/**
+ * Skip a comment, p is after "<!--".
+ *
+ * @return the end of the comment, NULL if it is not well formed.
+ */
+static const char* skip_comment(const char* p, const char* end) {
+
+	while(p < end) {
+		p = memchr(p, '-', end - p);
+		if(p==NULL || end - p < 3) {
+			return NULL;
+		}
+		else if(p[1]=='-') {
+			// "--" can only end the comment
+			return p[2]=='>' ? p + 3 : NULL;
+		}
+		p++;
+	}
+
+	return NULL;
+}
+
+size_t scanner_decode(char* dst, const char* value, size_t value_size) {
+
+	const char* p = value;
+	const char* end = value + value_size;
+	char* output = dst;
+
+	while(p < end) {
+		const char* reference = memchr(p, '&', end - p);
+		if(reference==NULL) {
+			reference = end;
+		}
+		memcpy(output, p, reference - p);
+		output += reference - p;
+		if(reference==end) {
+			break;
+		}
+
+		uint32_t code;
+		p = scan_reference(reference, end, &code);
+		if(p!=NULL) {
+			output = put_utf8(output, code);
+		}
+		else {
+			*output++ = '&';
+			p = reference + 1;
+		}
+	}
+
+	return output - dst;
+}
+
+bool scanner_parse(const char* document, size_t size, scanner_start_f* start, scanner_end_f* end, void* xtra) {
+
+	scanner_part_t part;
+	part.start = document;
+	part.end = document + size;
+
+	return scanner_parse_part(document, &part, start, end, xtra) && scanner_join(&part, 1);
+}
+
+/**
+ * @return the start of the first device element from p, NULL if there is
+ *         none.
+ */
+static const char* find_device(const char* p, const char* end) {
+
+	while(p < end) {
+		p = memchr(p, '<', end - p);
+		if(p==NULL || end - p < 8) {
+			return NULL;
+		}
+		else if(memcmp(p + 1, "device", 6)==0 && (is_space(p[7]) || p[7]=='>' || p[7]=='/')) {
+			return p;
+		}
+		p++;
+	}
+
+	return NULL;
+}
+
+size_t scanner_split(const char* document, size_t size, scanner_part_t* parts, size_t parts_size) {
+
+	const char* end = document + size;
+
+	size_t split = 0;
+	parts[split].start = document;
+
+	size_t index;
+	for(index=1; index<parts_size; index++) {
+		const char* target = document + size / parts_size * index;
+		if(target <= parts[split].start) {
+			continue;
+		}
+
+		const char* device = find_device(target, end);
+		if(device==NULL) {
+			break;
+		}
+		parts[split].end = device;
+		parts[++split].start = device;
+	}
+	parts[split].end = end;
+
+	return split + 1;
+}
+
+bool scanner_parse_part(const char* document, scanner_part_t* part, scanner_start_f* start, scanner_end_f* end_element, void* xtra) {
+
+	const char* p = part->start;
+	const char* end = part->end;
+
+	part->closed_size = 0;
+	part->open_size = 0;
+	part->root = false;
+
+	// The other parts start in the root, at a device
+	bool first = p==document;
+	// A part closing the elements opened before it may be out of the root
+	bool outer_closed = false;
+
+	if(first) {
+		if(end - p >= 3 && memcmp(p, "\xef\xbb\xbf", 3)==0) {
+			p += 3;
+		}
+		if(end - p >= 6 && memcmp(p, "<?xml", 5)==0 && is_space(p[5])) {
+			p = scan_declaration(p + 5, end);
+			if(p==NULL) {
+				return false;
+			}
+		}
+	}
+
+	scanner_attribute_t attributes[MAX_ATTRIBUTES];
+	int attributes_size;
+
+	while(true) {
+		const char* markup = find_markup(p, end);
+
+		// The text is ignored, but out of the root only spaces are allowed
+		if(part->open_size==0 && (first || outer_closed) && skip_spaces(p, markup)!=markup) {
+			return false;
+		}
+		if(markup==end) {
+			break;
+		}
+		else if(*markup=='&') {
+			// The text is ignored, its references are only checked
+			uint32_t code;
+			p = scan_reference(markup, end, &code);
+			if(p==NULL || (part->open_size==0 && (first || outer_closed))) {
+				return false;
+			}
+			continue;
+		}
+		else if(end - markup < 2) {
+			return false;
+		}
+
+		p = markup + 1;
+		if(*p=='/') {
+			const char* name = ++p;
+			while(p < end && is_name_char(*p)) {
+				p++;
+			}
+			size_t name_size = p - name;
+
+			p = skip_spaces(p, end);
+			if(p==end || *p!='>') {
+				return false;
+			}
+			p++;
+
+			const element_name_t* element;
+			if(part->open_size > 0) {
+				element = ELEMENTS + part->open[--part->open_size];
+				if(element->size!=name_size || memcmp(name, element->name, name_size)!=0) {
+					return false;
+				}
+			}
+			else {
+				// Only the schema header elements can span the parts
+				element = find_element(name, name_size);
+				if(first || element==NULL || element->element!=SCANNER_ELEMENT_OTHER || part->closed_size==MAX_DEPTH) {
+					return false;
+				}
+				part->closed[part->closed_size++] = element - ELEMENTS;
+				outer_closed = true;
+			}
+
+			end_element(xtra, element->element);
+		}
+		else if(*p=='!') {
+			if(end - p < 3 || p[1]!='-' || p[2]!='-') {
+				return false;
+			}
+			p = skip_comment(p + 3, end);
+			if(p==NULL) {
+				return false;
+			}
+		}
+		else {
+			const char* name = p;
+			while(p < end && is_name_char(*p)) {
+				p++;
+			}
+			const element_name_t* element = find_element(name, p - name);
+			if(element==NULL) {
+				return false;
+			}
+
+			if(part->open_size==0) {
+				// A single root, and the other parts hold devices
+				if((first && part->root) || (!first && (outer_closed || element->element!=SCANNER_ELEMENT_DEVICE))) {
+					return false;
+				}
+				part->root = first;
+			}
+
+			p = scan_attributes(p, end, attributes, &attributes_size);
+			if(p==NULL || *p=='?') {
+				return false;
+			}
+
+			bool empty = *p=='/';
+			if(empty && (end - p < 2 || p[1]!='>')) {
+				return false;
+			}
+			p += empty ? 2 : 1;
+
+			if(!empty && part->open_size==MAX_DEPTH) {
+				return false;
+			}
+
+			start(xtra, element->element, attributes, attributes_size);
+			if(empty) {
+				end_element(xtra, element->element);
+			}
+			else {
+				part->open[part->open_size++] = element - ELEMENTS;
+			}
+		}
+	}
+
+	return true;
+}
+
+bool scanner_join(const scanner_part_t* parts, size_t parts_size) {
+
+	unsigned char open[MAX_DEPTH];
+	int open_size = 0;
+
+	size_t index;
+	for(index=0; index<parts_size; index++) {
+		const scanner_part_t* part = parts + index;
+
+		if(index==0 && !part->root) {
+			return false;
+		}
+		else if(index > 0) {
+			// The part starts in the root, out of any device
+			int depth;
+			if(open_size==0) {
+				return false;
+			}
+			for(depth=0; depth<open_size; depth++) {
+				if(ELEMENTS[open[depth]].element!=SCANNER_ELEMENT_OTHER) {
+					return false;
+				}
+			}
+		}
+
+		int closed;
+		for(closed=0; closed<part->closed_size; closed++) {
+			if(open_size==0 || open[open_size - 1]!=part->closed[closed]) {
+				return false;
+			}
+			open_size--;
+		}
+
+		if(open_size + part->open_size > MAX_DEPTH) {
+			return false;
+		}
+		memcpy(open + open_size, part->open, part->open_size);
+		open_size += part->open_size;
+	}
+
+	return open_size==0;
+}
@@ -0,0 +1,153 @@
+/* Copyright (C) 2011 Fantayeneh Asres Gizaw, Filippo De Luca
+ *
+ * This file is part of libWURFL.
+ *
+ * libWURFL is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * any later version.
+ *
+ * libWURFL is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with libWURFL.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/* Written by Filippo De Luca <me@filippodeluca.com>.  */
+
+#ifndef SCANNER_H_
+#define SCANNER_H_
+
+#include <stdlib.h>
+#include <stdbool.h>
+
+/*
+ * The WURFL XML scanner.
+ *
+ * It parses only the plain WURFL schema: the wurfl and wurfl_patch
+ * documents, with their device, group and capability elements and the
+ * version header, with the predefined entities and the character
+ * references. Anything else, like DTDs, CDATA, other entities, white space
+ * to normalize in the attributes, namespaces, unknown elements, other
+ * encodings or malformed markup, makes it give up, so the document can be
+ * parsed by libxml2. The '<', '&' and quotes are looked for 16 bytes at a
+ * time.
+ *
+ * A document can also be split at its devices and the parts scanned at the
+ * same time, each one with its own callbacks data.
+ */
+
+/**
+ * The deepest elements nesting scanned, the WURFL documents are 5 levels
+ * deep.
+ */
+#define SCANNER_MAX_DEPTH 16
+
+typedef enum {
+	SCANNER_ELEMENT_OTHER = 0,
+	SCANNER_ELEMENT_DEVICE,
+	SCANNER_ELEMENT_GROUP,
+	SCANNER_ELEMENT_CAPABILITY
+} scanner_element_t;
+
+/**
+ * An attribute of a start tag. The name and the value point in the
+ * document, they are not NUL terminated. The value is valid UTF-8.
+ */
+typedef struct {
+	const char* name;
+	size_t name_size;
+	const char* value;
+	size_t value_size;
+	// The value has references, see scanner_decode()
+	bool escaped;
+} scanner_attribute_t;
+
+typedef void (scanner_start_f)(void* xtra, scanner_element_t element, const scanner_attribute_t* attributes, int attributes_size);
+
+typedef void (scanner_end_f)(void* xtra, scanner_element_t element);
+
+/**
+ * A part of a document, see scanner_split().
+ */
+typedef struct {
+	const char* start;
+	const char* end;
+
+	// Set by scanner_parse_part(). The elements the part closes but does
+	// not open, innermost first, and the ones it leaves open, outermost
+	// first. They are indexes in the scanner elements.
+	unsigned char closed[SCANNER_MAX_DEPTH];
+	int closed_size;
+	unsigned char open[SCANNER_MAX_DEPTH];
+	int open_size;
+	// The part opens the root element
+	bool root;
+} scanner_part_t;
+
+/**
+ * Decode the predefined entities and the character references of an
+ * escaped attribute value, any other '&' is kept. The decoded value is
+ * never longer.
+ *
+ * @param dst Where the value is decoded, with room for value_size chars.
+ *        It is not NUL terminated.
+ * @param value The attribute value.
+ * @param value_size The attribute value size.
+ * @return the decoded value size.
+ */
+size_t scanner_decode(char* dst, const char* value, size_t value_size);
+
+/**
+ * Scan a whole document. The callbacks are called in document order, an
+ * empty element gets both. If the scanner gives up, the callbacks may have
+ * been called for a part of the document.
+ *
+ * @param document The document.
+ * @param size The document size.
+ * @param start The function called for every start tag.
+ * @param end The function called for every end tag.
+ * @param xtra The data passed to the callbacks.
+ * @return true if the document was scanned, false if the scanner gave up.
+ */
+bool scanner_parse(const char* document, size_t size, scanner_start_f* start, scanner_end_f* end, void* xtra);
+
+/**
+ * Split a document in parts starting at device elements, of about the same
+ * size. A document too small or without devices makes less parts.
+ *
+ * @param document The document.
+ * @param size The document size.
+ * @param parts The parts to set the start and end of.
+ * @param parts_size The parts wanted.
+ * @return the number of parts made.
+ */
+size_t scanner_split(const char* document, size_t size, scanner_part_t* parts, size_t parts_size);
+
+/**
+ * Scan a part of a document, the parts can be scanned at the same time.
+ * Only the device elements can be at the top of the parts but the first,
+ * what is not there makes the scanner give up.
+ *
+ * @param document The whole document.
+ * @param part The part to scan.
+ * @param start The function called for every start tag.
+ * @param end The function called for every end tag.
+ * @param xtra The data passed to the callbacks.
+ * @return true if the part was scanned, false if the scanner gave up.
+ */
+bool scanner_parse_part(const char* document, scanner_part_t* part, scanner_start_f* start, scanner_end_f* end, void* xtra);
+
+/**
+ * Check that the scanned parts make a well formed document.
+ *
+ * @param parts The parts, in document order.
+ * @param parts_size The number of parts.
+ * @return true if the document is well formed.
+ */
+bool scanner_join(const scanner_part_t* parts, size_t parts_size);
+
+#endif /* SCANNER_H_ */
@@ -0,0 +1,465 @@
+/* Copyright (C) 2011 Fantayeneh Asres Gizaw, Filippo De Luca
+ *
+ * This file is part of libWURFL.
+ *
+ * libWURFL is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * any later version.
+ *
+ * libWURFL is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with libWURFL.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/* Written by Filippo De Luca <me@filippodeluca.com>.  */
+
+#include "snapshot.h"
+
+#include "utils/error.h"
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#define SNAPSHOT_MAGIC "WURFLSNP"
+#define SNAPSHOT_ENDIAN 0x01020304
+
+#define SECTION_ALIGN 64
+
+/**
+ * The snapshot is written next to its path, mkstemp replaces the Xs.
+ */
+#define SNAPSHOT_TEMP_SUFFIX ".tmp.XXXXXX"
+
+#define CHECKSUM_SEED UINT64_C(0x9e3779b97f4a7c15)
+#define CHECKSUM_PRIME UINT64_C(0xff51afd7ed558ccd)
+
+extern int errno;
+
+typedef struct {
+	char magic[8];
+	uint32_t version;
+	uint32_t endian;
+	uint64_t size;
+	// Of the sections and the section table, checked by snapshot_verify
+	uint64_t checksum;
+	uint64_t sections_offset;
+	uint32_t sections_size;
+	uint32_t reserved;
+	// Of the section table alone, checked on open
+	uint64_t sections_checksum;
+	uint8_t padding[8];
+} snapshot_header_t;
+
+typedef struct {
+	uint32_t section;
+	uint32_t reserved;
+	uint64_t offset;
+	uint64_t size;
+} snapshot_entry_t;
+
+struct _snapshot_writer_t {
+	const char* path;
+	// The file written, renamed to path on close
+	char* temp_path;
+	FILE* file;
+	uint64_t offset;
+	uint64_t checksum;
+
+	snapshot_entry_t* entries;
+	uint32_t entries_size;
+	uint32_t entries_capacity;
+};
+
+struct _snapshot_t {
+	const char* path;
+	const uint8_t* data;
+	size_t size;
+
+	const snapshot_header_t* header;
+	const snapshot_entry_t* entries;
+};
+
+static inline uint64_t checksum_mix(uint64_t hash, uint64_t word) {
+
+	hash ^= word;
+	hash *= CHECKSUM_PRIME;
+
+	return hash ^ (hash >> 32);
+}
+
+/**
+ * Checksum four words at a time in independent lanes, so it runs close to
+ * the memory bandwidth.
+ */
+static uint64_t checksum(uint64_t seed, const void* data, size_t size) {
+
+	const uint8_t* bytes = (const uint8_t*)data;
+	uint64_t length = size;
+	uint64_t lanes[4] = {seed, seed + 1, seed + 2, seed + 3};
+
+	while(size >= 32) {
+		uint64_t words[4];
+		memcpy(words, bytes, sizeof(words));
+
+		lanes[0] = checksum_mix(lanes[0], words[0]);
+		lanes[1] = checksum_mix(lanes[1], words[1]);
+		lanes[2] = checksum_mix(lanes[2], words[2]);
+		lanes[3] = checksum_mix(lanes[3], words[3]);
+
+		bytes += 32;
+		size -= 32;
+	}
+
+	uint64_t hash = checksum_mix(lanes[0], lanes[1]);
+	hash = checksum_mix(hash, lanes[2]);
+	hash = checksum_mix(hash, lanes[3]);
+
+	while(size > 0) {
+		uint64_t word = 0;
+		size_t chunk = size < sizeof(word) ? size : sizeof(word);
+		memcpy(&word, bytes, chunk);
+
+		hash = checksum_mix(hash, word);
+		bytes += chunk;
+		size -= chunk;
+	}
+
+	return checksum_mix(hash, length);
+}
+
+// Writer ****************************************************************
+
+/**
+ * Remove the partial file and exit.
+ */
+static void writer_error(snapshot_writer_t* writer, int errnum) {
+
+	unlink(writer->temp_path);
+	error(1, errnum, "error writing snapshot %s", writer->path);
+}
+
+static void writer_write(snapshot_writer_t* writer, const void* data, size_t size) {
+
+	if(size > 0 && fwrite(data, 1, size, writer->file)!=size) {
+		writer_error(writer, errno);
+	}
+	writer->offset += size;
+}
+
+static void writer_align(snapshot_writer_t* writer) {
+
+	static const uint8_t zeros[SECTION_ALIGN];
+
+	size_t padding = (SECTION_ALIGN - writer->offset % SECTION_ALIGN) % SECTION_ALIGN;
+	writer_write(writer, zeros, padding);
+}
+
+snapshot_writer_t* snapshot_writer_init(const char* path) {
+
+	snapshot_writer_t* writer = malloc(sizeof(snapshot_writer_t));
+	if(!writer) {
+		error(1, errno, "error allocating snapshot writer");
+	}
+
+	// The processes mapping the old file keep it until they map the new one
+	writer->path = path;
+	writer->temp_path = malloc(strlen(path) + sizeof(SNAPSHOT_TEMP_SUFFIX));
+	if(!writer->temp_path) {
+		error(1, errno, "error allocating snapshot writer");
+	}
+	strcpy(writer->temp_path, path);
+	strcat(writer->temp_path, SNAPSHOT_TEMP_SUFFIX);
+
+	int fd = mkstemp(writer->temp_path);
+	if(fd < 0) {
+		error(1, errno, "error opening snapshot %s", writer->temp_path);
+	}
+	// It is read by the other users too, as a file made by fopen would be
+	writer->file = fdopen(fd, "wb");
+	if(!writer->file || fchmod(fd, S_IRUSR | S_IWUSR | S_IRGRP | S_IROTH)!=0) {
+		writer_error(writer, errno);
+	}
+	writer->offset = 0;
+	writer->checksum = CHECKSUM_SEED;
+
+	writer->entries_size = 0;
+	writer->entries_capacity = 32;
+	writer->entries = malloc(sizeof(snapshot_entry_t) * writer->entries_capacity);
+	if(!writer->entries) {
+		error(1, errno, "error allocating snapshot sections");
+	}
+
+	// The header is rewritten on close
+	snapshot_header_t header;
+	memset(&header, 0, sizeof(header));
+	writer_write(writer, &header, sizeof(header));
+
+	return writer;
+}
+
+void snapshot_writer_section(snapshot_writer_t* writer, snapshot_section_t section, const void* data, size_t size) {
+
+	writer_align(writer);
+
+	if(writer->entries_size==writer->entries_capacity) {
+		writer->entries_capacity *= 2;
+		writer->entries = realloc(writer->entries, sizeof(snapshot_entry_t) * writer->entries_capacity);
+		if(!writer->entries) {
+			error(1, errno, "error growing snapshot sections");
+		}
+	}
+
+	snapshot_entry_t* entry = writer->entries + writer->entries_size++;
+	entry->section = section;
+	entry->reserved = 0;
+	entry->offset = writer->offset;
+	entry->size = size;
+
+	writer->checksum = checksum(writer->checksum, data, size);
+	writer_write(writer, data, size);
+}
+
+void snapshot_writer_strpool(snapshot_writer_t* writer, snapshot_section_t blob, snapshot_section_t offsets, const strpool_t* pool) {
+
+	uint32_t size = strpool_size(pool);
+
+	uint32_t* string_offsets = malloc(sizeof(uint32_t) * (size + 1));
+	if(!string_offsets) {
+		error(1, errno, "error allocating snapshot strings");
+	}
+
+	size_t blob_size = 0;
+	uint32_t id;
+	for(id=0; id<size; id++) {
+		string_offsets[id] = blob_size;
+		blob_size += strlen(strpool_get(pool, id)) + 1;
+		if(blob_size > UINT32_MAX) {
+			error(1, 0, "too many strings for snapshot %s", writer->path);
+		}
+	}
+
+	char* strings = malloc(blob_size + 1);
+	if(!strings) {
+		error(1, errno, "error allocating snapshot strings");
+	}
+	for(id=0; id<size; id++) {
+		strcpy(strings + string_offsets[id], strpool_get(pool, id));
+	}
+
+	snapshot_writer_section(writer, blob, strings, blob_size);
+	snapshot_writer_section(writer, offsets, string_offsets, sizeof(uint32_t) * size);
+
+	free(strings);
+	free(string_offsets);
+}
+
+void snapshot_writer_mphf(snapshot_writer_t* writer, snapshot_section_t section, snapshot_section_t ids_section, const mphf_t* mphf, const uint32_t* ids) {
+
+	size_t data_size;
+	const void* data = mphf_data(mphf, &data_size);
+
+	snapshot_writer_section(writer, section, data, data_size);
+	snapshot_writer_section(writer, ids_section, ids, sizeof(uint32_t) * mphf_size(mphf));
+}
+
+void snapshot_writer_close(snapshot_writer_t* writer) {
+
+	writer_align(writer);
+
+	snapshot_header_t header;
+	memset(&header, 0, sizeof(header));
+	memcpy(header.magic, SNAPSHOT_MAGIC, sizeof(header.magic));
+	header.version = SNAPSHOT_VERSION;
+	header.endian = SNAPSHOT_ENDIAN;
+	header.sections_offset = writer->offset;
+	header.sections_size = writer->entries_size;
+
+	size_t entries_size = sizeof(snapshot_entry_t) * writer->entries_size;
+	header.checksum = checksum(writer->checksum, writer->entries, entries_size);
+	header.sections_checksum = checksum(CHECKSUM_SEED, writer->entries, entries_size);
+	writer_write(writer, writer->entries, entries_size);
+	header.size = writer->offset;
+
+	if(fseek(writer->file, 0, SEEK_SET)!=0) {
+		writer_error(writer, errno);
+	}
+	writer_write(writer, &header, sizeof(header));
+
+	// The new file is complete on disk before it replaces the old one
+	if(fflush(writer->file)!=0 || fsync(fileno(writer->file))!=0) {
+		writer_error(writer, errno);
+	}
+	if(fclose(writer->file)!=0) {
+		writer_error(writer, errno);
+	}
+	if(rename(writer->temp_path, writer->path)!=0) {
+		writer_error(writer, errno);
+	}
+
+	free(writer->temp_path);
+	free(writer->entries);
+	free(writer);
+}
+
+// Reader ****************************************************************
+
+snapshot_t* snapshot_open(const char* path) {
+
+	int fd = open(path, O_RDONLY);
+	if(fd < 0) {
+		error(2, errno, "error opening snapshot %s", path);
+	}
+
+	struct stat st;
+	if(fstat(fd, &st)!=0) {
+		error(2, errno, "error reading snapshot %s", path);
+	}
+	if((size_t)st.st_size < sizeof(snapshot_header_t)) {
+		error(2, 0, "snapshot %s is truncated", path);
+	}
+
+	void* data = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+	if(data==MAP_FAILED) {
+		error(2, errno, "error mapping snapshot %s", path);
+	}
+	close(fd);
+
+	snapshot_t* snapshot = malloc(sizeof(snapshot_t));
+	if(!snapshot) {
+		error(1, errno, "error allocating snapshot");
+	}
+	snapshot->path = path;
+	snapshot->data = data;
+	snapshot->size = st.st_size;
+	snapshot->header = (const snapshot_header_t*)data;
+
+	const snapshot_header_t* header = snapshot->header;
+	if(memcmp(header->magic, SNAPSHOT_MAGIC, sizeof(header->magic))!=0) {
+		error(2, 0, "%s is not a wurfl snapshot", path);
+	}
+	if(header->version!=SNAPSHOT_VERSION || header->endian!=SNAPSHOT_ENDIAN) {
+		error(2, 0, "snapshot %s has version %u, expected %u on this platform", path, header->version, SNAPSHOT_VERSION);
+	}
+	if(header->size!=snapshot->size || header->sections_offset > header->size
+			|| (header->size - header->sections_offset) / sizeof(snapshot_entry_t) < header->sections_size) {
+		error(2, 0, "snapshot %s is truncated", path);
+	}
+	snapshot->entries = (const snapshot_entry_t*)(snapshot->data + header->sections_offset);
+
+	// Only the table is read, the sections pages are loaded when used
+	if(checksum(CHECKSUM_SEED, snapshot->entries, sizeof(snapshot_entry_t) * header->sections_size)!=header->sections_checksum) {
+		error(2, 0, "snapshot %s checksum mismatch", path);
+	}
+
+	uint32_t index;
+	for(index=0; index<header->sections_size; index++) {
+		const snapshot_entry_t* entry = snapshot->entries + index;
+		if(entry->offset > header->sections_offset || header->sections_offset - entry->offset < entry->size) {
+			error(2, 0, "snapshot %s is corrupted", path);
+		}
+	}
+
+	return snapshot;
+}
+
+bool snapshot_verify(const snapshot_t* snapshot) {
+
+	const snapshot_header_t* header = snapshot->header;
+
+	uint64_t hash = CHECKSUM_SEED;
+	uint32_t index;
+	for(index=0; index<header->sections_size; index++) {
+		const snapshot_entry_t* entry = snapshot->entries + index;
+		hash = checksum(hash, snapshot->data + entry->offset, entry->size);
+	}
+	hash = checksum(hash, snapshot->entries, sizeof(snapshot_entry_t) * header->sections_size);
+
+	return hash==header->checksum;
+}
+
+void snapshot_close(snapshot_t* snapshot) {
+
+	munmap((void*)snapshot->data, snapshot->size);
+	free(snapshot);
+}
+
+const void* snapshot_section(const snapshot_t* snapshot, snapshot_section_t section, size_t* size) {
+
+	uint32_t index;
+	for(index=0; index<snapshot->header->sections_size; index++) {
+		const snapshot_entry_t* entry = snapshot->entries + index;
+		if(entry->section==section) {
+			*size = entry->size;
+			return snapshot->data + entry->offset;
+		}
+	}
+
+	*size = 0;
+	return NULL;
+}
+
+const void* snapshot_array(const snapshot_t* snapshot, snapshot_section_t section, size_t items, size_t item_size) {
+
+	size_t size;
+	const void* data = snapshot_section(snapshot, section, &size);
+	if(data==NULL || size!=items * item_size) {
+		error(2, 0, "snapshot %s has a corrupted section %d", snapshot->path, section);
+	}
+
+	return data;
+}
+
+strpool_t* snapshot_strpool(const snapshot_t* snapshot, snapshot_section_t blob, snapshot_section_t offsets, uint32_t size, mphf_t* mphf, const uint32_t* ids) {
+
+	size_t blob_size;
+	const char* strings = snapshot_section(snapshot, blob, &blob_size);
+	const uint32_t* string_offsets = snapshot_array(snapshot, offsets, size, sizeof(uint32_t));
+
+	if(size > 0 && (strings==NULL || strings[blob_size - 1]!='\0')) {
+		error(2, 0, "snapshot %s has a corrupted section %d", snapshot->path, blob);
+	}
+
+	uint32_t id;
+	for(id=0; id<size; id++) {
+		if(string_offsets[id] >= blob_size) {
+			error(2, 0, "snapshot %s has a corrupted section %d", snapshot->path, offsets);
+		}
+	}
+
+	return strpool_init_mapped(strings, string_offsets, size, mphf, ids);
+}
+
+mphf_t* snapshot_mphf(const snapshot_t* snapshot, snapshot_section_t section, snapshot_section_t ids_section, uint32_t size, const uint32_t** ids) {
+
+	size_t data_size;
+	const void* data = snapshot_section(snapshot, section, &data_size);
+
+	mphf_t* mphf = mphf_init_mapped(data, data_size);
+	if(mphf==NULL || mphf_size(mphf)!=size) {
+		error(2, 0, "snapshot %s has a corrupted section %d", snapshot->path, section);
+	}
+
+	*ids = snapshot_array(snapshot, ids_section, size, sizeof(uint32_t));
+
+	uint32_t position;
+	for(position=0; position<size; position++) {
+		if((*ids)[position] >= size) {
+			error(2, 0, "snapshot %s has a corrupted section %d", snapshot->path, ids_section);
+		}
+	}
+
+	return mphf;
+}
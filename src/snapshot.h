@@ -0,0 +1,146 @@
+/* Copyright (C) 2011 Fantayeneh Asres Gizaw, Filippo De Luca
+ *
+ * This file is part of libWURFL.
+ *
+ * libWURFL is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * any later version.
+ *
+ * libWURFL is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with libWURFL.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/* Written by Filippo De Luca <me@filippodeluca.com>.  */
+
+#ifndef SNAPSHOT_H_
+#define SNAPSHOT_H_
+
+#include "utils/strpool.h"
+#include "utils/mphf.h"
+
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+/**
+ * The snapshot format version, bump it on every layout change.
+ */
+#define SNAPSHOT_VERSION 4
+
+/**
+ * The snapshot sections. Each one is an array of fixed size items or a blob
+ * of NUL terminated strings, the references between them are indexes or
+ * offsets, never pointers.
+ */
+typedef enum {
+	SNAPSHOT_CAPABILITY_NAMES = 1,
+	SNAPSHOT_CAPABILITY_OFFSETS,
+	SNAPSHOT_DEVICES,
+	SNAPSHOT_DEVICE_STRINGS,
+	SNAPSHOT_CAPSTORE,
+	SNAPSHOT_CAPSTORE_PARENTS,
+	SNAPSHOT_CAPSTORE_RECORDS,
+	SNAPSHOT_CAPSTORE_OVERRIDES,
+	SNAPSHOT_CAPSTORE_OVERRIDES_START,
+	SNAPSHOT_CAPSTORE_BLOOMS,
+	SNAPSHOT_CAPSTORE_VALUES,
+	SNAPSHOT_CAPSTORE_VALUE_OFFSETS,
+	SNAPSHOT_CAPSTORE_BOOLS_VALID,
+	SNAPSHOT_CAPSTORE_BOOLS,
+	SNAPSHOT_CAPSTORE_INTS_VALID,
+	SNAPSHOT_CAPSTORE_INTS,
+	SNAPSHOT_CAPSTORE_FLOATS_VALID,
+	SNAPSHOT_CAPSTORE_FLOATS,
+	SNAPSHOT_CAPSTORE_VIRTUAL_FLAGS,
+	SNAPSHOT_CAPABILITY_MPHF,
+	SNAPSHOT_CAPABILITY_MPHF_IDS,
+	SNAPSHOT_CAPSTORE_DEVICE_MPHF,
+	SNAPSHOT_CAPSTORE_DEVICE_MPHF_IDS,
+	SNAPSHOT_MATCHER_PREFIX,
+	SNAPSHOT_MATCHER_SUFFIX
+} snapshot_section_t;
+
+/**
+ * The snapshot_writer_t type.
+ *
+ * It writes the sections one after the other, each one aligned to a cache
+ * line, and the section table and checksum when it is closed. They are
+ * written to a temporary file renamed over the path on close, so the
+ * processes mapping the old snapshot keep reading it whole.
+ */
+typedef struct _snapshot_writer_t snapshot_writer_t;
+
+snapshot_writer_t* snapshot_writer_init(const char* path);
+
+void snapshot_writer_section(snapshot_writer_t* writer, snapshot_section_t section, const void* data, size_t size);
+
+/**
+ * Write the pool strings as a blob section and an offsets section.
+ */
+void snapshot_writer_strpool(snapshot_writer_t* writer, snapshot_section_t blob, snapshot_section_t offsets, const strpool_t* pool);
+
+/**
+ * Write a perfect hash as a section, and the ids of its positions as
+ * another one.
+ */
+void snapshot_writer_mphf(snapshot_writer_t* writer, snapshot_section_t section, snapshot_section_t ids_section, const mphf_t* mphf, const uint32_t* ids);
+
+void snapshot_writer_close(snapshot_writer_t* writer);
+
+/**
+ * The snapshot_t type.
+ *
+ * It is a snapshot file mapped in memory, read only. Its pages are shared
+ * with every process mapping the same file.
+ */
+typedef struct _snapshot_t snapshot_t;
+
+/**
+ * Map a snapshot file, checking its version and its section table. The
+ * sections are not read, snapshot_verify checks them.
+ */
+snapshot_t* snapshot_open(const char* path);
+
+/**
+ * Read every section of the snapshot and check its checksum.
+ *
+ * @return true if the sections are the ones written.
+ */
+bool snapshot_verify(const snapshot_t* snapshot);
+
+void snapshot_close(snapshot_t* snapshot);
+
+/**
+ * @param size It is set to the section size.
+ * @return the mapped section or NULL if the snapshot does not have it.
+ */
+const void* snapshot_section(const snapshot_t* snapshot, snapshot_section_t section, size_t* size);
+
+/**
+ * Like snapshot_section, but a missing section or one whose size is not
+ * items * item_size is a fatal error.
+ */
+const void* snapshot_array(const snapshot_t* snapshot, snapshot_section_t section, size_t items, size_t item_size);
+
+/**
+ * Check a blob of strings and their offsets written by
+ * snapshot_writer_strpool and map a strpool_t on them, indexed by the given
+ * perfect hash if it is not NULL.
+ */
+strpool_t* snapshot_strpool(const snapshot_t* snapshot, snapshot_section_t blob, snapshot_section_t offsets, uint32_t size, mphf_t* mphf, const uint32_t* ids);
+
+/**
+ * Check and map a perfect hash of size keys written by
+ * snapshot_writer_mphf.
+ *
+ * @param ids It is set to the ids of the positions, each one below size.
+ */
+mphf_t* snapshot_mphf(const snapshot_t* snapshot, snapshot_section_t section, snapshot_section_t ids_section, uint32_t size, const uint32_t** ids);
+
+#endif /* SNAPSHOT_H_ */
@@ -21,13 +21,19 @@
 #include "wurfl.h"
 #include "device.h"
 #include "normalizer.h"
+#include "scanner.h"
 #include "utils/utils.h"
 #include "utils/patricia.h"
+#include "utils/hashtable.h"
+#include "utils/hashmap.h"
+#include "utils/strpool.h"
+#include "utils/mphf.h"
 #include "utils/linkedlist.h"
 
 
 #include <unistd.h>
 #include <fcntl.h>
+#include <sys/stat.h>
 
 #include <stdio.h>
 #include <stdbool.h>
@@ -35,6 +41,7 @@
 #include <assert.h>
 #include <limits.h>
 #include <errno.h>
+#include <malloc.h>
 #include <check.h>
 
 extern int errno;
@@ -92,6 +99,46 @@ START_TEST(capabilities) {
 		fprintf(stderr, "}\n");
 
 		free(capabilities);
+
+		const char* expected[] = {
+			"is_wireless_device", "true",
+			"device_os", "Android",
+			"pointing_method", "touchscreen",
+			"is_tablet", "false",
+			"resolution_width", "480",
+			NULL
+		};
+		bool found[sizeof(expected) / sizeof(char*) / 2];
+		memset(found, 0, sizeof(found));
+
+		device_capability_iter_t iter;
+		const char* name;
+		const char* value;
+
+		// Nothing is allocated to iterate
+		struct mallinfo2 before = mallinfo2();
+
+		device_capabilities_iter(device, &iter);
+		while(device_capabilities_next(&iter, &name, &value)) {
+			uint32_t index;
+			for(index=0; expected[index]!=NULL; index+=2) {
+				if(strcmp(name, expected[index])==0) {
+					fail_unless(!found[index / 2], NULL);
+					fail_unless(strcmp(value, expected[index + 1])==0, NULL);
+					found[index / 2] = true;
+				}
+			}
+		}
+
+		struct mallinfo2 after = mallinfo2();
+		fail_unless(after.uordblks==before.uordblks, NULL);
+		fail_unless(after.hblkhd==before.hblkhd, NULL);
+
+		uint32_t index;
+		for(index=0; expected[index]!=NULL; index+=2) {
+			fail_unless(found[index / 2], NULL);
+		}
+		fail_unless(!device_capabilities_next(&iter, &name, &value), NULL);
 	}
 	
 	fail_unless(device!=NULL, NULL);
@@ -101,6 +148,936 @@ START_TEST(capabilities) {
 }
 END_TEST
 
+START_TEST(typed_capabilities) {
+
+	const char* user_agent = "Mozilla/5.0 (Linux; U; Android 2.2; en-us; Nexus One Build/FRF91) AppleWebKit/533.1 (KHTML, like Gecko) Version/4.0 Mobile Safari/533.1";
+
+	wurfl_t* wurfl = wurfl_init(root, patches);
+
+	device_t* device = wurfl_match(wurfl, user_agent);
+	fail_unless(device!=NULL, NULL);
+
+	bool wireless = false;
+	fail_unless(device_capability_bool(device, "is_wireless_device", &wireless), NULL);
+	fail_unless(wireless, NULL);
+
+	int32_t width = 0;
+	fail_unless(device_capability_int(device, "resolution_width", &width), NULL);
+	fail_unless(width==atoi(device_capability(device, "resolution_width")), NULL);
+
+	float fwidth = 0;
+	fail_unless(device_capability_float(device, "resolution_width", &fwidth), NULL);
+	fail_unless(fwidth==(float)width, NULL);
+
+	fail_unless(!device_capability_int(device, "device_os", &width), NULL);
+	fail_unless(!device_capability_bool(device, "not_a_capability", &wireless), NULL);
+
+	device_free(device);
+	wurfl_free(wurfl);
+}
+END_TEST
+
+START_TEST(virtual_capabilities) {
+
+	const char* user_agent = "Mozilla/5.0 (Linux; U; Android 2.2; en-us; Nexus One Build/FRF91) AppleWebKit/533.1 (KHTML, like Gecko) Version/4.0 Mobile Safari/533.1";
+
+	wurfl_t* wurfl = wurfl_init(root, patches);
+
+	device_t* device = wurfl_match(wurfl, user_agent);
+	fail_unless(device!=NULL, NULL);
+
+	uint64_t flags = device_virtual_flags(device);
+	fail_unless((flags & DEVICE_VIRTUAL_IS_SMARTPHONE)!=0, NULL);
+	fail_unless((flags & DEVICE_VIRTUAL_IS_TABLET)==0, NULL);
+	fail_unless((flags & DEVICE_VIRTUAL_IS_FULL_DESKTOP)==0, NULL);
+
+	bool value = false;
+	fail_unless(device_virtual_capability(device, "is_smartphone", &value), NULL);
+	fail_unless(value, NULL);
+	fail_unless(!device_virtual_capability(device, "not_a_virtual_capability", &value), NULL);
+
+	device_free(device);
+	wurfl_free(wurfl);
+}
+END_TEST
+
+START_TEST(capabilities_filter) {
+
+	const char* user_agent = "Mozilla/5.0 (Linux; U; Android 2.2; en-us; Nexus One Build/FRF91) AppleWebKit/533.1 (KHTML, like Gecko) Version/4.0 Mobile Safari/533.1";
+	const char* capabilities[] = {"resolution_width", "product_info", NULL};
+
+	wurfl_options_t options;
+	memset(&options, 0, sizeof(options));
+	options.capabilities = capabilities;
+
+	wurfl_t* wurfl = wurfl_init_options(root, patches, &options);
+
+	device_t* device = wurfl_match(wurfl, user_agent);
+	fail_unless(device!=NULL, NULL);
+
+	fail_unless(device_capability(device, "resolution_width")!=NULL, NULL);
+	fail_unless(device_capability(device, "is_wireless_device")!=NULL, NULL);
+	fail_unless(device_capability(device, "xhtml_support_level")==NULL, NULL);
+
+	device_free(device);
+	wurfl_free(wurfl);
+
+	// The sources of the virtual capabilities are kept by any filter
+	const char* unrelated[] = {"xhtml_support_level", NULL};
+	options.capabilities = unrelated;
+
+	wurfl = wurfl_init_options(root, patches, &options);
+
+	device = wurfl_match(wurfl, user_agent);
+	fail_unless(device!=NULL, NULL);
+
+	fail_unless(device_capability(device, "pointing_method")!=NULL, NULL);
+	fail_unless(device_capability(device, "resolution_width")!=NULL, NULL);
+	fail_unless(device_capability(device, "brand_name")==NULL, NULL);
+
+	bool value = false;
+	fail_unless(device_virtual_capability(device, "is_smartphone", &value), NULL);
+	fail_unless(value, NULL);
+	fail_unless((device_virtual_flags(device) & DEVICE_VIRTUAL_IS_TOUCHSCREEN)!=0, NULL);
+
+	device_free(device);
+	wurfl_free(wurfl);
+}
+END_TEST
+
+START_TEST(lazy_capabilities) {
+
+	const char* user_agent = "Mozilla/5.0 (Linux; U; Android 2.2; en-us; Nexus One Build/FRF91) AppleWebKit/533.1 (KHTML, like Gecko) Version/4.0 Mobile Safari/533.1";
+
+	wurfl_options_t options;
+	memset(&options, 0, sizeof(options));
+	options.capabilities_mode = WURFL_CAPABILITIES_LAZY;
+
+	wurfl_t* flat_wurfl = wurfl_init(root, patches);
+	wurfl_t* lazy_wurfl = wurfl_init_options(root, patches, &options);
+
+	device_t* flat_device = wurfl_match(flat_wurfl, user_agent);
+	device_t* lazy_device = wurfl_match(lazy_wurfl, user_agent);
+	fail_unless(strcmp(device_id(flat_device), device_id(lazy_device))==0, NULL);
+
+	char** flat_capabilities = device_capabilities(flat_device, NULL);
+	char** lazy_capabilities = device_capabilities(lazy_device, NULL);
+
+	int index;
+	for(index=0; flat_capabilities[index]!=NULL; index++) {
+		fail_unless(lazy_capabilities[index]!=NULL, NULL);
+		fail_unless(strcmp(flat_capabilities[index], lazy_capabilities[index])==0, NULL);
+	}
+	fail_unless(lazy_capabilities[index]==NULL, NULL);
+
+	free(flat_capabilities);
+	free(lazy_capabilities);
+	device_free(flat_device);
+	device_free(lazy_device);
+	wurfl_free(flat_wurfl);
+	wurfl_free(lazy_wurfl);
+}
+END_TEST
+
+START_TEST(snapshot) {
+
+	const char* user_agent = "Mozilla/5.0 (Linux; U; Android 2.2; en-us; Nexus One Build/FRF91) AppleWebKit/533.1 (KHTML, like Gecko) Version/4.0 Mobile Safari/533.1";
+
+	char path[] = "/tmp/wurfl-snapshot-XXXXXX";
+	int fd = mkstemp(path);
+	fail_unless(fd>=0, NULL);
+	close(fd);
+
+	wurfl_t* wurfl = wurfl_init(root, patches);
+	wurfl_snapshot_write(wurfl, path);
+
+	wurfl_t* snapshot_wurfl = wurfl_init_snapshot(path);
+	fail_unless(wurfl_size(wurfl)==wurfl_size(snapshot_wurfl), NULL);
+
+	device_t* device = wurfl_match(wurfl, user_agent);
+	device_t* snapshot_device = wurfl_match(snapshot_wurfl, user_agent);
+	fail_unless(strcmp(device_id(device), device_id(snapshot_device))==0, NULL);
+	fail_unless(device_virtual_flags(device)==device_virtual_flags(snapshot_device), NULL);
+
+	char** capabilities = device_capabilities(device, NULL);
+	char** snapshot_capabilities = device_capabilities(snapshot_device, NULL);
+
+	int index;
+	for(index=0; capabilities[index]!=NULL; index++) {
+		fail_unless(snapshot_capabilities[index]!=NULL, NULL);
+		fail_unless(strcmp(capabilities[index], snapshot_capabilities[index])==0, NULL);
+	}
+	fail_unless(snapshot_capabilities[index]==NULL, NULL);
+
+	int32_t width;
+	fail_unless(device_capability_int(snapshot_device, "resolution_width", &width), NULL);
+
+	// A new snapshot is another file, the mapped one is still read whole
+	struct stat old_stat;
+	struct stat new_stat;
+	fail_unless(stat(path, &old_stat)==0, NULL);
+	wurfl_snapshot_write(wurfl, path);
+	fail_unless(stat(path, &new_stat)==0, NULL);
+	fail_unless(old_stat.st_ino!=new_stat.st_ino, NULL);
+	device_t* remapped_device = wurfl_match(snapshot_wurfl, user_agent);
+	fail_unless(strcmp(device_id(device), device_id(remapped_device))==0, NULL);
+	device_free(remapped_device);
+
+	// A corrupted section is found by the verify only
+	fail_unless(wurfl_snapshot_verify(path), NULL);
+	fd = open(path, O_RDWR);
+	fail_unless(fd>=0, NULL);
+	char byte;
+	fail_unless(pread(fd, &byte, 1, 100)==1, NULL);
+	byte ^= 0x01;
+	fail_unless(pwrite(fd, &byte, 1, 100)==1, NULL);
+	close(fd);
+	fail_unless(!wurfl_snapshot_verify(path), NULL);
+
+	free(capabilities);
+	free(snapshot_capabilities);
+	device_free(device);
+	device_free(snapshot_device);
+	wurfl_free(snapshot_wurfl);
+	wurfl_free(wurfl);
+	unlink(path);
+}
+END_TEST
+
+START_TEST(memory_and_fd) {
+
+	const char* user_agent = "Mozilla/5.0 (Linux; U; Android 2.2; en-us; Nexus One Build/FRF91) AppleWebKit/533.1 (KHTML, like Gecko) Version/4.0 Mobile Safari/533.1";
+
+	int fd = open(root, O_RDONLY);
+	fail_unless(fd>=0, NULL);
+
+	off_t size = lseek(fd, 0, SEEK_END);
+	fail_unless(size>0, NULL);
+	lseek(fd, 0, SEEK_SET);
+
+	char* buffer = malloc(size);
+	fail_unless(buffer!=NULL, NULL);
+	fail_unless(read(fd, buffer, size)==size, NULL);
+	lseek(fd, 0, SEEK_SET);
+
+	wurfl_t* wurfl = wurfl_init(root, patches);
+	wurfl_t* mem_wurfl = wurfl_init_mem(buffer, size, patches, NULL);
+	free(buffer);
+	wurfl_t* fd_wurfl = wurfl_init_fd(fd, patches, NULL);
+	close(fd);
+
+	fail_unless(wurfl_size(wurfl)==wurfl_size(mem_wurfl), NULL);
+	fail_unless(wurfl_size(wurfl)==wurfl_size(fd_wurfl), NULL);
+
+	device_t* device = wurfl_match(wurfl, user_agent);
+	device_t* mem_device = wurfl_match(mem_wurfl, user_agent);
+	device_t* fd_device = wurfl_match(fd_wurfl, user_agent);
+	fail_unless(strcmp(device_id(device), device_id(mem_device))==0, NULL);
+	fail_unless(strcmp(device_id(device), device_id(fd_device))==0, NULL);
+	fail_unless(strcmp(device_capability(device, "brand_name"), device_capability(mem_device, "brand_name"))==0, NULL);
+
+	device_free(device);
+	device_free(mem_device);
+	device_free(fd_device);
+	wurfl_free(fd_wurfl);
+	wurfl_free(mem_wurfl);
+	wurfl_free(wurfl);
+}
+END_TEST
+
+static void count_scanned_start(void* xtra, scanner_element_t element, const scanner_attribute_t* attributes, int attributes_size) {
+	(*(int*)xtra)++;
+}
+
+static void count_scanned_end(void* xtra, scanner_element_t element) {
+}
+
+START_TEST(parsers) {
+
+	const char* user_agent = "Mozilla/5.0 (Linux; U; Android 2.2; en-us; Nexus One Build/FRF91) AppleWebKit/533.1 (KHTML, like Gecko) Version/4.0 Mobile Safari/533.1";
+
+	wurfl_options_t options = {NULL, WURFL_CAPABILITIES_FLAT, WURFL_PARSER_LIBXML2};
+	wurfl_t* scanned_wurfl = wurfl_init(root, patches);
+	wurfl_t* xml_wurfl = wurfl_init_options(root, patches, &options);
+	fail_unless(wurfl_size(scanned_wurfl)==wurfl_size(xml_wurfl), NULL);
+	fail_unless(wurfl_capabilities_size(scanned_wurfl)==wurfl_capabilities_size(xml_wurfl), NULL);
+
+	device_t* scanned_device = wurfl_match(scanned_wurfl, user_agent);
+	device_t* xml_device = wurfl_match(xml_wurfl, user_agent);
+	fail_unless(strcmp(device_id(scanned_device), device_id(xml_device))==0, NULL);
+
+	char** scanned_capabilities = device_capabilities(scanned_device, NULL);
+	char** xml_capabilities = device_capabilities(xml_device, NULL);
+
+	int index;
+	for(index=0; xml_capabilities[index]!=NULL; index++) {
+		fail_unless(scanned_capabilities[index]!=NULL, NULL);
+		fail_unless(strcmp(scanned_capabilities[index], xml_capabilities[index])==0, NULL);
+	}
+	fail_unless(scanned_capabilities[index]==NULL, NULL);
+
+	free(scanned_capabilities);
+	free(xml_capabilities);
+	device_free(scanned_device);
+	device_free(xml_device);
+	wurfl_free(xml_wurfl);
+	wurfl_free(scanned_wurfl);
+
+	// The predefined entities and the character references are scanned
+	const char* document = "<?xml version=\"1.0\"?>\n<wurfl><version><ver>1 &amp; 2</ver></version><devices>"
+			"<device id=\"generic\" user_agent=\"\" fall_back=\"root\"><group id=\"product_info\">"
+			"<capability name=\"brand_name\" value=\"Black &lt;&gt; White &amp; &quot;&apos;\"/>"
+			"<capability name=\"model_name\" value=\"&#x41;&#66;C\"/>"
+			"</group></device>"
+			"<device id=\"test_device\" user_agent=\"Test&#47;1.0\" fall_back=\"generic\"/>"
+			"</devices></wurfl>\n";
+
+	int scanned = 0;
+	fail_unless(scanner_parse(document, strlen(document), &count_scanned_start, &count_scanned_end, &scanned), NULL);
+	fail_unless(scanned==9, NULL);
+
+	wurfl_t* wurfl = wurfl_init_mem(document, strlen(document), patches, NULL);
+	xml_wurfl = wurfl_init_mem(document, strlen(document), patches, &options);
+	fail_unless(wurfl_size(wurfl)==2, NULL);
+
+	wurfl_t* wurfls[] = {wurfl, xml_wurfl};
+	for(index=0; index<2; index++) {
+		device_t* device = wurfl_match(wurfls[index], "Test/1.0");
+		fail_unless(strcmp(device_id(device), "test_device")==0, NULL);
+		fail_unless(strcmp(device_capability(device, "brand_name"), "Black <> White & \"'")==0, NULL);
+		fail_unless(strcmp(device_capability(device, "model_name"), "ABC")==0, NULL);
+		device_free(device);
+	}
+
+	wurfl_free(xml_wurfl);
+	wurfl_free(wurfl);
+
+	// Any other reference is left to libxml2
+	const char* others[] = {"&nbsp;", "&#0;", "&#xD800;", "&amp", "&#x;"};
+	for(index=0; index<sizeof(others) / sizeof(char*); index++) {
+		char other[256];
+		sprintf(other, "<wurfl><devices><device id=\"generic\" user_agent=\"%s\" fall_back=\"root\"/></devices></wurfl>", others[index]);
+		fail_unless(!scanner_parse(other, strlen(other), &count_scanned_start, &count_scanned_end, &scanned), NULL);
+	}
+}
+END_TEST
+
+START_TEST(parallel_parsing) {
+
+	const char* user_agent = "Mozilla/5.0 (Linux; U; Android 2.2; en-us; Nexus One Build/FRF91) AppleWebKit/533.1 (KHTML, like Gecko) Version/4.0 Mobile Safari/533.1";
+
+	wurfl_options_t single_options = {NULL, WURFL_CAPABILITIES_FLAT, WURFL_PARSER_AUTO, 1};
+	wurfl_options_t parallel_options = {NULL, WURFL_CAPABILITIES_FLAT, WURFL_PARSER_AUTO, 4};
+	wurfl_t* single_wurfl = wurfl_init_options(root, patches, &single_options);
+	wurfl_t* parallel_wurfl = wurfl_init_options(root, patches, &parallel_options);
+	fail_unless(wurfl_size(single_wurfl)==wurfl_size(parallel_wurfl), NULL);
+	fail_unless(wurfl_capabilities_size(single_wurfl)==wurfl_capabilities_size(parallel_wurfl), NULL);
+
+	device_t* single_device = wurfl_match(single_wurfl, user_agent);
+	device_t* parallel_device = wurfl_match(parallel_wurfl, user_agent);
+	fail_unless(strcmp(device_id(single_device), device_id(parallel_device))==0, NULL);
+
+	char** single_capabilities = device_capabilities(single_device, NULL);
+	char** parallel_capabilities = device_capabilities(parallel_device, NULL);
+
+	int index;
+	for(index=0; single_capabilities[index]!=NULL; index++) {
+		fail_unless(parallel_capabilities[index]!=NULL, NULL);
+		fail_unless(strcmp(single_capabilities[index], parallel_capabilities[index])==0, NULL);
+	}
+	fail_unless(parallel_capabilities[index]==NULL, NULL);
+
+	free(single_capabilities);
+	free(parallel_capabilities);
+	device_free(single_device);
+	device_free(parallel_device);
+	wurfl_free(parallel_wurfl);
+	wurfl_free(single_wurfl);
+}
+END_TEST
+
+static void write_patch(char* path, const char* document) {
+
+	int fd = mkstemp(path);
+	fail_unless(fd>=0, NULL);
+	fail_unless(write(fd, document, strlen(document))==(ssize_t)strlen(document), NULL);
+	close(fd);
+}
+
+START_TEST(parallel_patching) {
+
+	const char* document = "<?xml version=\"1.0\"?>\n<wurfl><devices>"
+			"<device id=\"generic\" user_agent=\"\" fall_back=\"root\"><group id=\"product_info\">"
+			"<capability name=\"brand_name\" value=\"generic\"/>"
+			"</group></device>"
+			"<device id=\"test_device\" user_agent=\"Test/1.0 (en-us)\" fall_back=\"generic\"/>"
+			"</devices></wurfl>\n";
+
+	char first_path[] = "/tmp/wurfl-patch-XXXXXX";
+	write_patch(first_path, "<?xml version=\"1.0\"?>\n<wurfl_patch><devices>"
+			"<device id=\"test_device\" user_agent=\"Test/1.0 (en-us)\" fall_back=\"generic\"><group id=\"product_info\">"
+			"<capability name=\"model_name\" value=\"first\"/>"
+			"<capability name=\"brand_name\" value=\"first\"/>"
+			"</group></device>"
+			"</devices></wurfl_patch>\n");
+
+	char second_path[] = "/tmp/wurfl-patch-XXXXXX";
+	write_patch(second_path, "<?xml version=\"1.0\"?>\n<wurfl_patch><devices>"
+			"<device id=\"test_device\" user_agent=\"Test/1.0 (en-us)\" fall_back=\"generic\"><group id=\"product_info\">"
+			"<capability name=\"marketing_name\" value=\"second\"/>"
+			"<capability name=\"brand_name\" value=\"second\"/>"
+			"</group></device>"
+			"<device id=\"other_device\" user_agent=\"Other/1.0\" fall_back=\"generic\"/>"
+			"</devices></wurfl_patch>\n");
+
+	const char* patch_paths[] = {first_path, second_path, NULL};
+
+	wurfl_options_t single_options = {NULL, WURFL_CAPABILITIES_FLAT, WURFL_PARSER_AUTO, 1};
+	wurfl_options_t parallel_options = {NULL, WURFL_CAPABILITIES_FLAT, WURFL_PARSER_AUTO, 4};
+	wurfl_t* single_wurfl = wurfl_init_mem(document, strlen(document), patch_paths, &single_options);
+	wurfl_t* parallel_wurfl = wurfl_init_mem(document, strlen(document), patch_paths, &parallel_options);
+	unlink(first_path);
+	unlink(second_path);
+
+	fail_unless(wurfl_size(parallel_wurfl)==3, NULL);
+	fail_unless(wurfl_capabilities_size(parallel_wurfl)==3, NULL);
+	fail_unless(wurfl_size(single_wurfl)==wurfl_size(parallel_wurfl), NULL);
+	fail_unless(wurfl_capabilities_size(single_wurfl)==wurfl_capabilities_size(parallel_wurfl), NULL);
+
+	// The patches are applied in their order, the user agents normalized
+	device_t* single_device = wurfl_match(single_wurfl, "Test/1.0 (en-us)");
+	device_t* parallel_device = wurfl_match(parallel_wurfl, "Test/1.0 (en-us)");
+	fail_unless(strcmp(device_id(parallel_device), "test_device")==0, NULL);
+	fail_unless(strcmp(device_user_agent(parallel_device), "Test/1.0 (xx-xx)")==0, NULL);
+	fail_unless(strcmp(device_capability(parallel_device, "brand_name"), "second")==0, NULL);
+	fail_unless(strcmp(device_capability(parallel_device, "model_name"), "first")==0, NULL);
+	fail_unless(strcmp(device_capability(parallel_device, "marketing_name"), "second")==0, NULL);
+
+	char** single_capabilities = device_capabilities(single_device, NULL);
+	char** parallel_capabilities = device_capabilities(parallel_device, NULL);
+
+	int index;
+	for(index=0; single_capabilities[index]!=NULL; index++) {
+		fail_unless(parallel_capabilities[index]!=NULL, NULL);
+		fail_unless(strcmp(single_capabilities[index], parallel_capabilities[index])==0, NULL);
+	}
+	fail_unless(parallel_capabilities[index]==NULL, NULL);
+
+	free(single_capabilities);
+	free(parallel_capabilities);
+	device_free(single_device);
+	device_free(parallel_device);
+	wurfl_free(parallel_wurfl);
+	wurfl_free(single_wurfl);
+}
+END_TEST
+
+static bool count_item(const void* item, void* xtra) {
+
+	(*(uint32_t*)xtra)++;
+
+	return false;
+}
+
+START_TEST(hashtable) {
+
+	const uint32_t size = 10000;
+	char (*keys)[16] = malloc(sizeof(char[16]) * size);
+	fail_unless(keys!=NULL, NULL);
+
+	hashtable_t* hashtable = hashtable_init(&string_eq, &string_hash, NULL);
+
+	uint32_t index;
+	for(index=0; index<size; index++) {
+		sprintf(keys[index], "key-%u", index);
+		fail_unless(hashtable_add(hashtable, keys[index], NULL, NULL)==NULL, NULL);
+	}
+	fail_unless(hashtable_size(hashtable)==size, NULL);
+
+	// An equal item replaces the old one
+	char key[16] = "key-42";
+	fail_unless(hashtable_add(hashtable, key, NULL, NULL)==keys[42], NULL);
+	fail_unless(hashtable_get(hashtable, "key-42")==key, NULL);
+	fail_unless(hashtable_size(hashtable)==size, NULL);
+
+	// The removed slots do not hide the items probed after them
+	for(index=0; index<size; index+=2) {
+		fail_unless(hashtable_remove(hashtable, keys[index])!=NULL, NULL);
+	}
+	for(index=0; index<size; index++) {
+		fail_unless(hashtable_contains(hashtable, keys[index])==(index % 2==1), NULL);
+	}
+	fail_unless(!hashtable_contains(hashtable, "missing"), NULL);
+
+	for(index=0; index<size; index+=2) {
+		hashtable_add(hashtable, keys[index], NULL, NULL);
+	}
+	uint32_t counted = 0;
+	hashtable_foreach(hashtable, &count_item, &counted);
+	fail_unless(counted==size, NULL);
+	fail_unless(hashtable_size(hashtable)==size, NULL);
+
+	hashtable_clear(hashtable, NULL, NULL);
+	fail_unless(hashtable_empty(hashtable), NULL);
+	fail_unless(!hashtable_contains(hashtable, keys[1]), NULL);
+
+	hashtable_free(hashtable, NULL, NULL);
+	free(keys);
+}
+END_TEST
+
+static bool check_entry(const void* item, void* xtra) {
+
+	const char* const* kv = (const char* const*)item;
+	fail_unless(strcmp(kv[0], kv[1])==0, NULL);
+	(*(uint32_t*)xtra)++;
+
+	return false;
+}
+
+START_TEST(hashmap) {
+
+	const uint32_t size = 10000;
+	char (*keys)[16] = malloc(sizeof(char[16]) * size);
+	fail_unless(keys!=NULL, NULL);
+
+	hashmap_t* map = hashmap_init(&string_eq, &string_hash, NULL);
+
+	uint32_t index;
+	for(index=0; index<size; index++) {
+		sprintf(keys[index], "key-%u", index);
+		fail_unless(hashmap_put(map, keys[index], keys[index])==NULL, NULL);
+	}
+	fail_unless(hashmap_size(map)==size, NULL);
+	fail_unless(hashmap_put(map, "key-7", keys[7])==keys[7], NULL);
+	fail_unless(hashmap_get(map, "key-7")==keys[7], NULL);
+
+	for(index=0; index<size; index+=2) {
+		fail_unless(hashmap_remove(map, keys[index])==keys[index], NULL);
+	}
+	fail_unless(hashmap_size(map)==size / 2, NULL);
+	fail_unless(!hashmap_contains(map, "key-0"), NULL);
+	fail_unless(hashmap_contains(map, "key-1"), NULL);
+
+	hashmap_t* copy = hashmap_init(&string_eq, &string_hash, NULL);
+	hashmap_put(copy, keys[0], keys[0]);
+	hashmap_putall(copy, map);
+	fail_unless(hashmap_size(copy)==size / 2 + 1, NULL);
+
+	uint32_t counted = 0;
+	hashmap_foreach(copy, &check_entry, &counted);
+	fail_unless(counted==hashmap_size(copy), NULL);
+
+	hashmap_free(copy, NULL, NULL);
+	hashmap_free(map, NULL, NULL);
+	free(keys);
+}
+END_TEST
+
+START_TEST(string_hashing) {
+
+	char data[128];
+	uint32_t index;
+	for(index=0; index<sizeof(data); index++) {
+		data[index] = 'a' + index % 26;
+	}
+
+	// Every length takes a different path, the prefixes must not collide
+	uint64_t hashes[sizeof(data)];
+	uint32_t size;
+	for(size=0; size<sizeof(data); size++) {
+		hashes[size] = hash_bytes(data, size, 42);
+		fail_unless(hashes[size]==hash_bytes(data, size, 42), NULL);
+		fail_unless(hashes[size]!=hash_bytes(data, size, 43), NULL);
+		for(index=0; index<size; index++) {
+			fail_unless(hashes[index]!=hashes[size], NULL);
+		}
+	}
+
+	uint64_t hash = hash_bytes("generic", 7, hash_seed());
+	fail_unless(string_hash("generic")==(uint32_t)(hash ^ (hash >> 32)), NULL);
+
+	strpool_t* pool = strpool_init();
+	uint32_t id = strpool_add(pool, "generic");
+	fail_unless(strpool_hash(pool, id)==string_hash("generic"), NULL);
+	fail_unless(strpool_add_hashed(pool, "generic", string_hash("generic"))==id, NULL);
+
+	strpool_t* copy = strpool_init();
+	strpool_add(copy, "generic_xhtml");
+	uint32_t copied = strpool_add_hashed(copy, strpool_get(pool, id), strpool_hash(pool, id));
+	fail_unless(strpool_id(copy, "generic")==copied, NULL);
+	fail_unless(strpool_hash(copy, copied)==strpool_hash(pool, id), NULL);
+
+	hashmap_t* map = hashmap_init(&string_eq, &string_hash, NULL);
+	uint32_t key_hash = hashmap_hash(map, "generic");
+	hashmap_put_hashed(map, "generic", key_hash, &id);
+	fail_unless(hashmap_get(map, "generic")==&id, NULL);
+	fail_unless(hashmap_get_hashed(map, "generic", key_hash)==&id, NULL);
+
+	hashmap_free(map, NULL, NULL);
+	strpool_free(copy);
+	strpool_free(pool);
+}
+END_TEST
+
+START_TEST(perfect_hashing) {
+
+	const uint32_t size = 5000;
+	char (*keys)[16] = malloc(sizeof(char[16]) * size);
+	const char** key_ptrs = malloc(sizeof(char*) * size);
+	char* positions = calloc(size, 1);
+	fail_unless(keys!=NULL && key_ptrs!=NULL && positions!=NULL, NULL);
+
+	uint32_t index;
+	for(index=0; index<size; index++) {
+		sprintf(keys[index], "device-%u", index);
+		key_ptrs[index] = keys[index];
+	}
+
+	mphf_t* mphf = mphf_init(key_ptrs, size);
+	size_t data_size;
+	const void* data = mphf_data(mphf, &data_size);
+	mphf_t* mapped = mphf_init_mapped(data, data_size);
+	fail_unless(mapped!=NULL, NULL);
+	fail_unless(data_size * 8 < size * 4, NULL);
+
+	for(index=0; index<size; index++) {
+		uint32_t position = mphf_get(mphf, keys[index]);
+		fail_unless(position < size, NULL);
+		fail_unless(!positions[position], NULL);
+		fail_unless(mphf_get(mapped, keys[index])==position, NULL);
+		positions[position] = 1;
+	}
+	fail_unless(mphf_init_mapped(data, data_size - 1)==NULL, NULL);
+
+	mphf_free(mapped);
+	mphf_free(mphf);
+
+	// The frozen capabilities and the devices are found by perfect hash
+	char path[] = "/tmp/wurfl-snapshot-XXXXXX";
+	int fd = mkstemp(path);
+	fail_unless(fd>=0, NULL);
+	close(fd);
+
+	wurfl_t* wurfl = wurfl_init(root, patches);
+	wurfl_snapshot_write(wurfl, path);
+	wurfl_t* snapshot_wurfl = wurfl_init_snapshot(path);
+
+	wurfl_t* wurfls[] = {wurfl, snapshot_wurfl};
+	for(index=0; index<2; index++) {
+		device_t* device = wurfl_get_device(wurfls[index], "generic");
+		fail_unless(device!=NULL, NULL);
+		fail_unless(strcmp(device_id(device), "generic")==0, NULL);
+		fail_unless(device_capability(device, "resolution_width")!=NULL, NULL);
+		fail_unless(device_capability(device, "no_such_capability")==NULL, NULL);
+		device_free(device);
+
+		fail_unless(wurfl_get_device(wurfls[index], "no_such_device")==NULL, NULL);
+	}
+
+	wurfl_free(snapshot_wurfl);
+	wurfl_free(wurfl);
+	unlink(path);
+	free(positions);
+	free(key_ptrs);
+	free(keys);
+}
+END_TEST
+
+static bool count_trie_entry(const void* item, void* xtra) {
+	void** kv = (void**)item;
+	uint32_t* counted = (uint32_t*)xtra;
+
+	fail_unless(strcmp((char*)kv[0], (char*)kv[1])==0, NULL);
+	(*counted)++;
+
+	return false;
+}
+
+static bool find_trie_key(const void* item, void* xtra) {
+	void** kv = (void**)item;
+
+	return strcmp((char*)kv[0], (char*)xtra)==0;
+}
+
+static bool collect_trie_value(const void* item, void* xtra) {
+	void** kv = (void**)item;
+	void*** values = (void***)xtra;
+
+	*(*values)++ = kv[1];
+
+	return false;
+}
+
+static void count_trie_value(void* item, const void* xtra) {
+	(*(uint32_t*)xtra)++;
+}
+
+static uint32_t trie_value_index(const void* value) {
+	return *(const uint32_t*)value;
+}
+
+typedef struct {
+	const char* const* keys;
+	uint32_t size;
+	// A bit per key iterated
+	uint32_t iterated;
+} trie_keys_t;
+
+static bool mark_trie_key(const void* item, void* xtra) {
+	void** kv = (void**)item;
+	trie_keys_t* trie_keys = (trie_keys_t*)xtra;
+
+	uint32_t index;
+	for(index=0; index<trie_keys->size; index++) {
+		if(strcmp((char*)kv[0], trie_keys->keys[index])==0) {
+			fail_unless((trie_keys->iterated & (1u << index))==0, NULL);
+			trie_keys->iterated |= 1u << index;
+		}
+	}
+
+	return false;
+}
+
+START_TEST(patricia) {
+
+	const uint32_t size = 2000;
+	char (*keys)[32] = malloc(sizeof(char[32]) * size);
+	fail_unless(keys!=NULL, NULL);
+
+	patricia_t* trie = patricia_init(NULL, NULL, NULL);
+
+	uint32_t index;
+	for(index=0; index<size; index++) {
+		sprintf(keys[index], "Mozilla/%u.%u (%u)", index % 7, index % 13, index);
+		patricia_put(trie, keys[index], keys[index]);
+	}
+	// A key put again replaces the old one
+	patricia_put(trie, keys[7], keys[7]);
+
+	for(index=0; index<size; index++) {
+		fail_unless(patricia_get(trie, keys[index])==keys[index], NULL);
+	}
+	fail_unless(patricia_get(trie, "Mozilla/") == NULL, NULL);
+
+	uint32_t counted = 0;
+	patricia_foreach(trie, &count_trie_entry, &counted);
+	fail_unless(counted==size, NULL);
+
+	// Every search finds some keys, the ones sharing nothing too
+	const char* needles[] = {"Mozilla/3.5 (1)", "Opera", "\x01", ""};
+	for(index=0; index<sizeof(needles) / sizeof(char*); index++) {
+		counted = 0;
+		patricia_search_foreach(trie, needles[index], &count_trie_entry, &counted);
+		fail_unless(counted > 0, NULL);
+	}
+
+	// The nearest keys of a key include it
+	for(index=0; index<size; index+=97) {
+		fail_unless(patricia_search_foreach(trie, keys[index], &find_trie_key, keys[index]), NULL);
+	}
+
+	// The nearest keys are ranked, and no more than asked
+	patricia_entry_t nearest[4];
+	uint32_t found = patricia_search_nearest(trie, keys[100], 0, UINT32_MAX, nearest, 4);
+	fail_unless(found > 0 && found <= 4, NULL);
+	fail_unless(nearest[0].value==keys[100] && nearest[0].shared==strlen(keys[100]) + 1, NULL);
+	for(index=1; index<found; index++) {
+		fail_unless(nearest[index].shared <= nearest[index - 1].shared, NULL);
+	}
+	counted = 0;
+	patricia_search_foreach(trie, "Opera", &count_trie_entry, &counted);
+	patricia_entry_t* all = malloc(sizeof(patricia_entry_t) * size);
+	fail_unless(all!=NULL, NULL);
+	fail_unless(patricia_search_nearest(trie, "Opera", 0, UINT32_MAX, all, size)==counted, NULL);
+	fail_unless(patricia_search_nearest(trie, "Opera", 0, UINT32_MAX, all, 1)==1, NULL);
+	free(all);
+	// No key is that short
+	fail_unless(patricia_search_nearest(trie, keys[100], 0, 8, nearest, 4)==0, NULL);
+
+	// The nearest keys are the bit-wise trie ones: the labels branch on their
+	// low bits first, the empty key is the key of zero bits
+	patricia_t* bits = patricia_init(NULL, NULL, NULL);
+	patricia_put(bits, "b", "b");
+	patricia_put(bits, "d", "d");
+	patricia_put(bits, "", "");
+	fail_unless(strcmp(patricia_search(bits, "e"), "d")==0, NULL);
+	fail_unless(strcmp(patricia_search(bits, "\x01"), "")==0, NULL);
+	counted = 0;
+	patricia_search_foreach(bits, "e", &count_trie_entry, &counted);
+	fail_unless(counted==1, NULL);
+	counted = 0;
+	patricia_search_foreach(bits, "\x01", &count_trie_entry, &counted);
+	fail_unless(counted==2, NULL);
+	patricia_free(bits, NULL, NULL);
+
+	// A search iterates the nearest key and the keys a bit-wise trie of all
+	// the keys branches off its path last. They depend on the keys only, not
+	// on the order they are put in as with the old trie.
+	const char* ua_keys[] = {
+		"",
+		"Mozilla/4.0 (compatible; MSIE 6.0; Windows CE)",
+		"Mozilla/5.0 (Linux; U; Android 2.2; xx-xx; Nexus One)",
+		"Mozilla/5.0 (Linux; U; Android 4.0; xx-xx; GT-I9100)",
+		"Mozilla/5.0 (iPhone; CPU iPhone OS 5_0 like Mac OS X)",
+		"Mozilla/5.0 (iPad; CPU OS 5_0 like Mac OS X)",
+		"Nokia6300/2.0 (04.20) Profile/MIDP-2.0",
+		"Nokia6230i/2.0 (03.80) Profile/MIDP-2.0",
+		"Opera/9.80 (J2ME/MIDP; Opera Mini/9.80)",
+		"SAMSUNG-SGH-E250/1.0 Profile/MIDP-2.0",
+		"SonyEricssonK800i/R1CB Browser/NetFront/3.3"
+	};
+	const uint32_t ua_size = sizeof(ua_keys) / sizeof(char*);
+	const struct {
+		const char* needle;
+		uint32_t nearest;
+		uint32_t iterated;
+	} ua_searches[] = {
+		{"Mozilla/5.0 (Linux; U; Android 2.3; xx-xx; Nexus S)", 2, 0x00c},
+		{"Mozilla/5.0 (iPod; CPU iPhone OS 5_0 like Mac OS X)", 5, 0x030},
+		{"Mozilla/5.0 (Windows NT 6.1)", 4, 0x030},
+		{"Mozilla/3.0", 3, 0x00c},
+		{"Mozilla/4.0 (compatible; MSIE 8.0)", 1, 0x03e},
+		{"Nokia6500/2.0", 6, 0x0c0},
+		{"NokiaN95", 6, 0x0c0},
+		{"Opera/9.80 (Android)", 8, 0x700},
+		{"SAMSUNG-GT-S5230", 9, 0x600},
+		{"Sony", 10, 0x600},
+		{"BlackBerry9700", 6, 0x0c0},
+		{"\x01", 1, 0x03e},
+		// The empty key is the nearest, every other key is iterated
+		{"HTC_Touch", 0, 0x7fe},
+		{"", 0, 0x7fe}
+	};
+
+	patricia_t* ua_tries[3];
+	ua_tries[0] = patricia_init(NULL, NULL, NULL);
+	ua_tries[1] = patricia_init(NULL, NULL, NULL);
+	for(index=0; index<ua_size; index++) {
+		patricia_put(ua_tries[0], ua_keys[index], ua_keys[index]);
+		patricia_put(ua_tries[1], ua_keys[ua_size - index - 1], ua_keys[ua_size - index - 1]);
+	}
+	ua_tries[2] = patricia_init_bulk((const void* const*)ua_keys, (const void* const*)ua_keys, ua_size, NULL, NULL, NULL);
+
+	uint32_t ua_index;
+	for(ua_index=0; ua_index<3; ua_index++) {
+		for(index=0; index<sizeof(ua_searches) / sizeof(ua_searches[0]); index++) {
+			fail_unless(patricia_search(ua_tries[ua_index], ua_searches[index].needle)==ua_keys[ua_searches[index].nearest], NULL);
+
+			trie_keys_t trie_keys;
+			trie_keys.keys = ua_keys;
+			trie_keys.size = ua_size;
+			trie_keys.iterated = 0;
+			patricia_search_foreach(ua_tries[ua_index], ua_searches[index].needle, &mark_trie_key, &trie_keys);
+			fail_unless(trie_keys.iterated==ua_searches[index].iterated, NULL);
+		}
+		patricia_free(ua_tries[ua_index], NULL, NULL);
+	}
+
+	// The bulk built trie is the same, a key given twice too
+	const void** bulk_keys = malloc(sizeof(void*) * (size + 1));
+	void** values = malloc(sizeof(void*) * size);
+	void** bulk_values = malloc(sizeof(void*) * size);
+	fail_unless(bulk_keys!=NULL && values!=NULL && bulk_values!=NULL, NULL);
+	for(index=0; index<size; index++) {
+		bulk_keys[index] = keys[size - index - 1];
+	}
+	bulk_keys[size] = keys[7];
+
+	patricia_t* bulk = patricia_init_bulk(bulk_keys, bulk_keys, size + 1, NULL, NULL, NULL);
+	void** values_end = values;
+	patricia_foreach(trie, &collect_trie_value, &values_end);
+	void** bulk_values_end = bulk_values;
+	patricia_foreach(bulk, &collect_trie_value, &bulk_values_end);
+	fail_unless(values_end - values==size && bulk_values_end - bulk_values==size, NULL);
+	fail_unless(memcmp(values, bulk_values, sizeof(void*) * size)==0, NULL);
+	for(index=0; index<sizeof(needles) / sizeof(char*); index++) {
+		fail_unless(patricia_search(bulk, needles[index])==patricia_search(trie, needles[index]), NULL);
+	}
+	patricia_free(bulk, NULL, NULL);
+
+	// The frozen trie is the same, mapped again from its block too
+	uint32_t* indexes = malloc(sizeof(uint32_t) * size);
+	const void** frozen_values = malloc(sizeof(void*) * size);
+	fail_unless(indexes!=NULL && frozen_values!=NULL, NULL);
+	for(index=0; index<size; index++) {
+		indexes[index] = index;
+		frozen_values[index] = indexes + index;
+	}
+	bulk = patricia_init_bulk(bulk_keys, frozen_values, size, NULL, NULL, NULL);
+	patricia_t* frozen = patricia_init_bulk(bulk_keys, frozen_values, size, NULL, NULL, NULL);
+	patricia_freeze(frozen, &trie_value_index, frozen_values);
+
+	size_t data_size;
+	fail_unless(patricia_data(bulk, &data_size)==NULL, NULL);
+	const void* data = patricia_data(frozen, &data_size);
+	fail_unless(data!=NULL, NULL);
+	fail_unless(patricia_init_mapped(data, data_size - 1, frozen_values, size)==NULL, NULL);
+	fail_unless(patricia_init_mapped(data, data_size, frozen_values, size - 1)==NULL, NULL);
+	patricia_t* mapped = patricia_init_mapped(data, data_size, frozen_values, size);
+	fail_unless(mapped!=NULL, NULL);
+
+	patricia_t* frozen_tries[] = {frozen, mapped};
+	uint32_t frozen_index;
+	for(frozen_index=0; frozen_index<2; frozen_index++) {
+		patricia_t* frozen_trie = frozen_tries[frozen_index];
+
+		values_end = values;
+		patricia_foreach(bulk, &collect_trie_value, &values_end);
+		bulk_values_end = bulk_values;
+		patricia_foreach(frozen_trie, &collect_trie_value, &bulk_values_end);
+		fail_unless(bulk_values_end - bulk_values==size, NULL);
+		fail_unless(memcmp(values, bulk_values, sizeof(void*) * size)==0, NULL);
+
+		for(index=0; index<size; index++) {
+			fail_unless(patricia_get(frozen_trie, bulk_keys[index])==frozen_values[index], NULL);
+		}
+		fail_unless(patricia_get(frozen_trie, "Mozilla/")==NULL, NULL);
+
+		for(index=0; index<sizeof(needles) / sizeof(char*); index++) {
+			fail_unless(patricia_search(frozen_trie, needles[index])==patricia_search(bulk, needles[index]), NULL);
+
+			patricia_entry_t frozen_nearest[4];
+			found = patricia_search_nearest(bulk, needles[index], 0, UINT32_MAX, nearest, 4);
+			fail_unless(patricia_search_nearest(frozen_trie, needles[index], 0, UINT32_MAX, frozen_nearest, 4)==found, NULL);
+			uint32_t position;
+			for(position=0; position<found; position++) {
+				fail_unless(strcmp(frozen_nearest[position].key, nearest[position].key)==0, NULL);
+				fail_unless(frozen_nearest[position].value==nearest[position].value, NULL);
+				fail_unless(frozen_nearest[position].shared==nearest[position].shared, NULL);
+			}
+		}
+	}
+	patricia_free(mapped, NULL, NULL);
+	patricia_free(frozen, NULL, NULL);
+	patricia_free(bulk, NULL, NULL);
+	free(frozen_values);
+	free(indexes);
+
+	free(bulk_values);
+	free(values);
+	free(bulk_keys);
+
+	counted = 0;
+	patricia_free(trie, &count_trie_value, &counted);
+	fail_unless(counted==size, NULL);
+	free(keys);
+
+	// Every key is a prefix of the next one, a node per key
+	char deep_key[256];
+	memset(deep_key, '\0', sizeof(deep_key));
+	trie = patricia_init(NULL, &coll_default_unduper, NULL);
+	for(index=0; index<200; index++) {
+		deep_key[index] = 'a';
+		patricia_put(trie, strdup(deep_key), strdup(deep_key));
+	}
+	counted = 0;
+	patricia_foreach(trie, &count_trie_entry, &counted);
+	fail_unless(counted==200, NULL);
+	patricia_free(trie, &coll_default_unduper, NULL);
+}
+END_TEST
+
 START_TEST(normalizers) {
 
 	const char* expected = "Mozilla/5.0 (Linux; U; Android 2.2; xx-xx; Nexus One Build/FRF91) AppleWebKit/533.1 (KHTML, like Gecko) Version/4.0 Mobile Safari/533.1";
@@ -116,6 +1093,25 @@ START_TEST(normalizers) {
 	
 	fail_unless(strcmp(language_output, expected)==0, NULL);
 
+	// Every handler normalizes the output of the ones before, the untouched
+	// User-Agents are given back as they are
+	const char* inputs[] = {
+		"Vodafone/1.0/V802SE/SN123456789012345 Browser/NetFront/3.3 Profile/MIDP-2.0",
+		"Vodafone/1.0/V802SE/SN123456789012345 Browser/NetFront/3.3 (en-gb) Profile/MIDP-2.0",
+		"Opera/9.80 (J2ME/MIDP; Opera Mini/9.80)"
+	};
+	const char* outputs[] = {
+		"Vodafone/1.0/V802SE/SNXXXXXXXXXXXXXXX Browser/NetFront/3.3 Profile/MIDP-2.0",
+		"Vodafone/1.0/V802SE/SNXXXXXXXXXXXXXXX Browser/NetFront/3.3 (xx-xx) Profile/MIDP-2.0",
+		"Opera/9.80 (J2ME/MIDP; Opera Mini/9.80)"
+	};
+	char output[1024];
+	uint32_t index;
+	for(index=0; index<sizeof(inputs) / sizeof(char*); index++) {
+		normalizer_apply(normalizer, output, inputs[index]);
+		fail_unless(strcmp(output, outputs[index])==0, NULL);
+	}
+
 	normalizer_free(normalizer);
 }
 END_TEST
@@ -140,6 +1136,58 @@ static int test_match(const char* user_agent, const char* expected_id) {
 	return result;
 }
 
+START_TEST(nearest_matching) {
+
+	const char* document = "<?xml version=\"1.0\"?>\n<wurfl><devices>"
+			"<device id=\"generic\" user_agent=\"\" fall_back=\"root\"/>"
+			"<device id=\"msie_6\" user_agent=\"Mozilla/4.0 (compatible; MSIE 6.0; Windows CE)\" fall_back=\"generic\"/>"
+			"<device id=\"nexus_one\" user_agent=\"Mozilla/5.0 (Linux; U; Android 2.2; xx-xx; Nexus One)\" fall_back=\"generic\"/>"
+			"<device id=\"galaxy_s2\" user_agent=\"Mozilla/5.0 (Linux; U; Android 4.0; xx-xx; GT-I9100)\" fall_back=\"generic\"/>"
+			"<device id=\"iphone\" user_agent=\"Mozilla/5.0 (iPhone; CPU iPhone OS 5_0 like Mac OS X)\" fall_back=\"generic\"/>"
+			"<device id=\"ipad\" user_agent=\"Mozilla/5.0 (iPad; CPU OS 5_0 like Mac OS X)\" fall_back=\"generic\"/>"
+			"<device id=\"nokia_6300\" user_agent=\"Nokia6300/2.0 (04.20) Profile/MIDP-2.0\" fall_back=\"generic\"/>"
+			"<device id=\"nokia_6230i\" user_agent=\"Nokia6230i/2.0 (03.80) Profile/MIDP-2.0\" fall_back=\"generic\"/>"
+			"<device id=\"opera_mini\" user_agent=\"Opera/9.80 (J2ME/MIDP; Opera Mini/9.80)\" fall_back=\"generic\"/>"
+			"<device id=\"samsung_e250\" user_agent=\"SAMSUNG-SGH-E250/1.0 Profile/MIDP-2.0\" fall_back=\"generic\"/>"
+			"<device id=\"sonyericsson_k800i\" user_agent=\"SonyEricssonK800i/R1CB Browser/NetFront/3.3\" fall_back=\"generic\"/>"
+			"</devices></wurfl>\n";
+
+	// The devices the unknown User-Agents match, among the candidates the
+	// byte-wise tries give
+	const char* entries[] = {
+		"Mozilla/5.0 (Linux; U; Android 2.3; en-us; Nexus S)", "nexus_one",
+		"Mozilla/5.0 (Linux; U; Android 4.0; de-de; GT-I9100)", "galaxy_s2",
+		"Mozilla/5.0 (iPod; CPU iPhone OS 5_0 like Mac OS X)", "iphone",
+		"Mozilla/5.0 (Windows NT 6.1)", "ipad",
+		"Mozilla/4.0 (compatible; MSIE 8.0)", "msie_6",
+		"Mozilla/3.0", "samsung_e250",
+		"Nokia6230i/2.0 (03.80) Profile/MIDP-2.0", "nokia_6230i",
+		"Nokia6500/2.0", "nokia_6300",
+		"NokiaN95", "nokia_6300",
+		"Opera/9.80 (Android)", "opera_mini",
+		"SAMSUNG-GT-S5230", "samsung_e250",
+		"SonyEricssonW800i/R1CB", "sonyericsson_k800i",
+		"BlackBerry9700", "nokia_6300",
+		"HTC_Touch", "samsung_e250",
+		"Profile/MIDP-2.0", "samsung_e250",
+		NULL
+	};
+
+	const char* no_patches[] = {NULL};
+	wurfl_t* wurfl = wurfl_init_mem(document, strlen(document), no_patches, NULL);
+
+	uint32_t index;
+	for(index=0; entries[index]!=NULL; index+=2) {
+		device_t* device = wurfl_match(wurfl, entries[index]);
+		fail_unless(device!=NULL, NULL);
+		fail_unless(strcmp(device_id(device), entries[index + 1])==0, NULL);
+		device_free(device);
+	}
+
+	wurfl_free(wurfl);
+}
+END_TEST
+
 START_TEST(matching) {
 	
 	const char* user_agent = "Mozilla/5.0 (Macintosh; Intel Mac OS X 10_8_2) AppleWebKit/536.26.14 (KHTML, like Gecko) Version/6.0.1 Safari/536.26.14";
@@ -154,7 +1202,22 @@ Suite* wurfl_suite (void) {
 		
 	TCase* tc_core = tcase_create("Core");
 	tcase_add_test(tc_core, capabilities);
+	tcase_add_test(tc_core, typed_capabilities);
+	tcase_add_test(tc_core, virtual_capabilities);
+	tcase_add_test(tc_core, capabilities_filter);
+	tcase_add_test(tc_core, lazy_capabilities);
+	tcase_add_test(tc_core, snapshot);
+	tcase_add_test(tc_core, memory_and_fd);
+	tcase_add_test(tc_core, parsers);
+	tcase_add_test(tc_core, parallel_parsing);
+	tcase_add_test(tc_core, parallel_patching);
+	tcase_add_test(tc_core, hashtable);
+	tcase_add_test(tc_core, hashmap);
+	tcase_add_test(tc_core, string_hashing);
+	tcase_add_test(tc_core, perfect_hashing);
+	tcase_add_test(tc_core, patricia);
 	tcase_add_test(tc_core, normalizers);
+	tcase_add_test(tc_core, nearest_matching);
 	tcase_add_test(tc_core, matching);
 	
 	Suite* suite = suite_create("libwurfl");
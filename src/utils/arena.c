@@ -0,0 +1,158 @@
+/* Copyright (C) 2011 Fantayeneh Asres Gizaw, Filippo De Luca
+ *
+ * This file is part of libWURFL.
+ *
+ * libWURFL is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * any later version.
+ *
+ * libWURFL is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with libWURFL.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/* Written by Filippo De Luca <me@filippodeluca.com>.  */
+
+#include "arena.h"
+
+#include "error.h"
+
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <sys/mman.h>
+
+#if !defined(MAP_ANONYMOUS) && defined(MAP_ANON)
+#define MAP_ANONYMOUS MAP_ANON
+#endif
+
+#define ARENA_BLOCK_SIZE (1024 * 1024)
+
+#define ARENA_ALIGN (sizeof(uint64_t) > sizeof(void*) ? sizeof(uint64_t) : sizeof(void*))
+
+#define ALIGN_UP(size, align) (((size) + (align) - 1) & ~((size_t)(align) - 1))
+
+extern int errno;
+
+typedef struct _arena_block_t arena_block_t;
+
+struct _arena_block_t {
+	arena_block_t* next;
+	size_t size;
+	size_t used;
+};
+
+struct _arena_t {
+	arena_block_t* blocks;
+	size_t size;
+};
+
+static arena_block_t* block_init(arena_t* arena, size_t min_size) {
+
+	size_t header_size = ALIGN_UP(sizeof(arena_block_t), ARENA_ALIGN);
+	size_t size = header_size + min_size > ARENA_BLOCK_SIZE ? header_size + min_size : ARENA_BLOCK_SIZE;
+
+	void* memory = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if(memory==MAP_FAILED) {
+		error(1, errno, "error allocating arena block");
+	}
+
+	arena_block_t* block = (arena_block_t*)memory;
+	block->size = size;
+	block->used = header_size;
+	block->next = arena->blocks;
+
+	arena->blocks = block;
+	arena->size += size;
+
+	return block;
+}
+
+arena_t* arena_init() {
+
+	arena_t* arena = malloc(sizeof(arena_t));
+	if(!arena) {
+		error(1, errno, "error allocating arena");
+	}
+	arena->blocks = NULL;
+	arena->size = 0;
+
+	return arena;
+}
+
+void arena_free(arena_t* arena) {
+
+	arena_block_t* block = arena->blocks;
+	while(block!=NULL) {
+		arena_block_t* next = block->next;
+		munmap(block, block->size);
+		block = next;
+	}
+
+	free(arena);
+}
+
+void* arena_alloc(arena_t* arena, size_t size) {
+
+	size = ALIGN_UP(size, ARENA_ALIGN);
+
+	arena_block_t* block = arena->blocks;
+	if(block!=NULL && size > ARENA_BLOCK_SIZE / 4) {
+		// A large allocation gets its own block, behind the current one
+		arena_block_t* current = block;
+		arena->blocks = current->next;
+		block = block_init(arena, size);
+		arena->blocks = current;
+		current->next = block;
+	}
+	else if(block==NULL || block->size - block->used < size) {
+		block = block_init(arena, size);
+	}
+
+	void* allocated = (char*)block + block->used;
+	block->used += size;
+
+	return allocated;
+}
+
+char* arena_strdup(arena_t* arena, const char* string) {
+
+	size_t size = strlen(string) + 1;
+
+	char* copy = arena_alloc(arena, size);
+	memcpy(copy, string, size);
+
+	return copy;
+}
+
+void arena_merge(arena_t* arena, arena_t* moved) {
+
+	if(moved->blocks!=NULL) {
+		arena_block_t* last = moved->blocks;
+		while(last->next!=NULL) {
+			last = last->next;
+		}
+
+		// The moved blocks go behind the current one
+		if(arena->blocks!=NULL) {
+			last->next = arena->blocks->next;
+			arena->blocks->next = moved->blocks;
+		}
+		else {
+			arena->blocks = moved->blocks;
+		}
+		arena->size += moved->size;
+	}
+
+	free(moved);
+}
+
+size_t arena_size(const arena_t* arena) {
+	return arena->size;
+}
@@ -0,0 +1,71 @@
+/* Copyright (C) 2011 Fantayeneh Asres Gizaw, Filippo De Luca
+ *
+ * This file is part of libWURFL.
+ *
+ * libWURFL is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * any later version.
+ *
+ * libWURFL is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with libWURFL.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/* Written by Filippo De Luca <me@filippodeluca.com>.  */
+
+#ifndef ARENA_H_
+#define ARENA_H_
+
+#include <stdlib.h>
+
+/**
+ * The arena_t type.
+ *
+ * It is a bump pointer allocator. The memory is taken from the system in
+ * large blocks and it is never freed piece by piece: arena_free() releases
+ * every block at once.
+ */
+typedef struct _arena_t arena_t;
+
+arena_t* arena_init();
+
+/**
+ * Release every allocation made from the arena.
+ */
+void arena_free(arena_t* arena);
+
+/**
+ * Allocate memory from the arena. It is aligned to the size of a pointer
+ * or a 64 bit integer, whatever is larger.
+ *
+ * @param arena The arena to allocate from.
+ * @param size The size to allocate.
+ * @return the allocated memory, it is not zeroed.
+ */
+void* arena_alloc(arena_t* arena, size_t size);
+
+/**
+ * Copy a string in the arena.
+ */
+char* arena_strdup(arena_t* arena, const char* string);
+
+/**
+ * Move the allocations of an arena to another one, so they are released
+ * with it. The moved arena is freed.
+ *
+ * @param arena The arena to move the allocations to.
+ * @param moved The arena to move the allocations from.
+ */
+void arena_merge(arena_t* arena, arena_t* moved);
+
+/**
+ * @return the bytes taken from the system by the arena.
+ */
+size_t arena_size(const arena_t* arena);
+
+#endif /* ARENA_H_ */
@@ -0,0 +1,150 @@
+/* Copyright (C) 2011 Fantayeneh Asres Gizaw, Filippo De Luca
+ *  
+ * This file is part of libWURFL.
+ *
+ * libWURFL is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or 
+ * any later version.
+ *
+ * libWURFL is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with libWURFL.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/* Written by Filippo De Luca <me@filippodeluca.com>.  */
+
+#ifndef HASHMAPDEFINE_H_
+#define HASHMAPDEFINE_H_
+
+#include "hashtable-impl.h"
+#include "error.h"
+
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <errno.h>
+
+/**
+ * Define a hashmap specialized for the given key and value types, like
+ * klib khash does. The keys and the values are stored by value in the table
+ * slots. The hash and the equals function are called directly, so they can
+ * be inlined. The table is the hashmap_t one, without removal, and its
+ * probe loops are the HASHTABLE_DEFINE_SLOTS ones.
+ *
+ * HASHMAP_DEFINE(name, key_type, value_type, key_hash_f, key_equals_f)
+ * defines:
+ *
+ * - name_t, the map type
+ * - name_t* name_init(uint32_t capacity)
+ * - void name_free(name_t* map)
+ * - void name_clear(name_t* map)
+ * - uint32_t name_size(const name_t* map)
+ * - value_type* name_get(const name_t* map, key_type key)
+ * - value_type* name_put(name_t* map, key_type key, bool* added)
+ *
+ * and the *_hashed variants of get and put, taking the key hash already
+ * computed. name_get returns the address of the key value, NULL if the key
+ * is not in the map. name_put returns the address of the key value, adding
+ * the key if it is not in the map: added tells if it was. The addresses are
+ * valid until the next name_put.
+ *
+ * @param key_hash_f uint32_t key_hash_f(key_type key), the map reinforces
+ * the result.
+ * @param key_equals_f bool key_equals_f(key_type lkey, key_type rkey).
+ */
+#define HASHMAP_DEFINE(name, key_type, value_type, key_hash_f, key_equals_f) \
+\
+typedef struct { \
+	uint32_t hash; \
+	key_type key; \
+	value_type value; \
+} name##_entry_t; \
+\
+typedef struct { \
+	uint8_t* ctrl; \
+	name##_entry_t* table; \
+	uint32_t table_size; \
+	uint32_t table_used; \
+	uint32_t threshold; \
+	uint32_t size; \
+	float lfactor; \
+} name##_t; \
+\
+static inline bool name##_entry_equals(const name##_t* map, const name##_entry_t* entry, key_type key) { \
+	(void)map; \
+	return key_equals_f(entry->key, key); \
+} \
+\
+HASHTABLE_DEFINE_SLOTS(name, name##_t, name##_entry_t, key_type, name##_entry_equals) \
+\
+static inline name##_t* name##_init(uint32_t capacity) { \
+	name##_t* map = malloc(sizeof(name##_t)); \
+	if(map==NULL) { \
+		error(1, errno, "error allocating " #name); \
+	} \
+	uint32_t table_size = HASHTABLE_GROUP_SIZE; \
+	while(table_size * HASHTABLE_MAX_LFACTOR < capacity && table_size < MAXIMUM_CAPACITY) { \
+		table_size <<= 1; \
+	} \
+	map->lfactor = HASHTABLE_MAX_LFACTOR; \
+	map->size = 0; \
+	name##_table_alloc(map, table_size); \
+	return map; \
+} \
+\
+static inline void name##_free(name##_t* map) { \
+	free(map->ctrl); \
+	free(map->table); \
+	free(map); \
+} \
+\
+static inline void name##_clear(name##_t* map) { \
+	memset(map->ctrl, HASHTABLE_CTRL_EMPTY, sizeof(uint8_t) * (map->table_size + HASHTABLE_GROUP_SIZE)); \
+	map->table_used = 0; \
+	map->size = 0; \
+} \
+\
+static inline uint32_t name##_size(const name##_t* map) { \
+	return map->size; \
+} \
+\
+/* The reinforced hash is the one stored */ \
+static inline name##_entry_t* name##_find(const name##_t* map, key_type key, uint32_t hash) { \
+	uint32_t slot = name##_find_slot(map, hash, key); \
+	return slot!=HASHTABLE_NO_SLOT ? map->table + slot : NULL; \
+} \
+\
+static inline value_type* name##_get_hashed(const name##_t* map, key_type key, uint32_t key_hash) { \
+	name##_entry_t* entry = name##_find(map, key, hashtable_reinforce_hash(key_hash)); \
+	return entry!=NULL ? &entry->value : NULL; \
+} \
+\
+static inline value_type* name##_get(const name##_t* map, key_type key) { \
+	return name##_get_hashed(map, key, key_hash_f(key)); \
+} \
+\
+static inline value_type* name##_put_hashed(name##_t* map, key_type key, uint32_t key_hash, bool* added) { \
+	uint32_t reinforced = hashtable_reinforce_hash(key_hash); \
+	name##_entry_t* entry = name##_find(map, key, reinforced); \
+	*added = entry==NULL; \
+	if(entry==NULL) { \
+		if(map->table_used >= map->threshold) { \
+			name##_resize(map); \
+		} \
+		entry = name##_put_slot(map, reinforced); \
+		entry->key = key; \
+	} \
+	return &entry->value; \
+} \
+\
+static inline value_type* name##_put(name##_t* map, key_type key, bool* added) { \
+	return name##_put_hashed(map, key, key_hash_f(key), added); \
+}
+
+#endif /* HASHMAPDEFINE_H_ */
@@ -26,42 +26,31 @@
 
 #include <stdbool.h>
 
-typedef struct _hashmap_item_t {
-	const void *key;
+/**
+ * A slot of the map, the key and the item are stored inline.
+ */
+typedef struct {
+	// The reinforced key hash
+	uint32_t hash;
+	const void* key;
 	void* item;
-	hashmap_t* owner;
-} hashmap_item_t;
+} hashmap_entry_t;
 
+/**
+ * The same open addressing table of the hashtable, see hashtable-impl.h,
+ * with a key next to every item.
+ */
 struct _hashmap_t {
-	hashtable_t* hashtable;
+	uint8_t* ctrl;
+	hashmap_entry_t* table;
+	uint32_t table_size;
+	// The full and the deleted slots
+	uint32_t table_used;
 	coll_hash_f* key_hash;
 	coll_equals_f* key_equals;
+	uint32_t threshold;
+	uint32_t size;
+	float lfactor;
 };
 
-// Item *******************************************************************
-
-hashmap_item_t* item_init(hashmap_t* hashmap, const void* key, const void* item);
-
-void item_free(void* item, const void* xtra);
-
-bool item_eq(const void* litem, const void* ritem);
-
-uint32_t item_hash(const void *item);
-
-bool item_functor(const void* item, void* data);
-
-// Functors ***************************************************************
-
-//typedef struct {
-//	coll_predicate_t* key_predicate;
-//} item_evaluate_data_t;
-//
-//bool item_evaluate(const void* item, void* data);
-
-typedef struct {
-	hashmap_t* dest;
-} putall_data_t;
-
-bool putall_functor(const void* item, void* data);
-
 #endif /* HASHMAP_IMPL_H_ */
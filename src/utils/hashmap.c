@@ -20,8 +20,8 @@
 
 #include "hashmap-impl.h"
 
-#include "hashtable-impl.h"
 #include "functors.h"
+#include "error.h"
 
 #include <stdlib.h>
 #include <stdint.h>
@@ -33,126 +33,75 @@
 
 extern int errno;
 
+#define HASHMAP_DEFAULT_INIT_CAPACITY 128
 
-// Item functions *********************************************************
+// Table functions ********************************************************
 
-bool item_eq(const void* litem, const void* ritem) {
-	hashmap_item_t* lhashmap_item = (hashmap_item_t*)litem;
-	hashmap_item_t* rhashmap_item = (hashmap_item_t*)ritem;
-
-	return lhashmap_item->owner->key_equals(lhashmap_item->key, rhashmap_item->key);
-}
-
-hashmap_item_t* item_init(hashmap_t* hashmap, const void* key, const void* item) {
-
-	hashmap_item_t* hashmap_item = malloc(sizeof(hashmap_item_t));
-	hashmap_item->key = key;
-	hashmap_item->item = item;
-	hashmap_item->owner = hashmap;
-
-	return hashmap_item;
+static inline bool key_equals(const hashmap_t* map, const hashmap_entry_t* entry, const void* key) {
+	return map->key_equals(entry->key, key);
 }
 
-typedef struct {
-	coll_unduper_f* unduper;
-	void* data;
-} item_destroy_data_t;
+HASHTABLE_DEFINE_SLOTS(hashmap, hashmap_t, hashmap_entry_t, const void*, key_equals)
 
-void item_free(void* item, const void* data) {
+/**
+ * Put the key with its reinforced hash, already computed.
+ */
+static void* put_hashed(hashmap_t* map, uint32_t hash, const void* key, const void* item) {
 
-	item_destroy_data_t* destroy_data = data;
-	hashmap_item_t* hashmap_item = item;
+	void* replaced = NULL;
 
-	if(destroy_data && destroy_data->unduper) {
-		destroy_data->unduper(hashmap_item->item, destroy_data->data);
+	uint32_t slot = hashmap_find_slot(map, hash, key);
+	if(slot!=HASHTABLE_NO_SLOT) {
+		// The old key stays, it is equal
+		replaced = map->table[slot].item;
+		map->table[slot].item = (void*)item;
+	}
+	else {
+		if(map->table_used >= map->threshold) {
+			hashmap_resize(map);
+		}
+		hashmap_entry_t* entry = hashmap_put_slot(map, hash);
+		entry->key = key;
+		entry->item = (void*)item;
 	}
 
-	free(hashmap_item);
-}
-
-uint32_t item_hash(const void *item) {
-	const hashmap_item_t* hashmap_item = item;
-	hashmap_t* map = hashmap_item->owner;
-
-	return map->key_hash(hashmap_item->key);
-}
-
-//bool item_evaluate(const void* item, void* data) {
-//	const hashmap_item_t* hashmap_item = item;
-//	item_evaluate_data_t* ev_data = data;
-//
-//	return ev_data->key_predicate->evaluate(hashmap_item->key, ev_data->key_predicate->data);
-//}
-
-
-
-// Functors ***************************************************************
-
-typedef struct {
-	coll_functor_f* functor;
-	void* data;
-
-} item_functor_data_t;
-
-bool item_functor(const void* item, void* data) {
-
-	hashmap_item_t* hashmap_item = (hashmap_item_t*)item;
-	item_functor_data_t* functor_data = data;
-
-	return functor_data->functor(hashmap_item->item, functor_data->data);
-}
-
-bool kv_functor(const void* item, void* data) {
-
-	hashmap_item_t* hashmap_item = (hashmap_item_t*)item;
-	item_functor_data_t* functor_data = data;
-
-	void* kv[2];
-	kv[0] = hashmap_item->key;
-	kv[1] = hashmap_item->item;
-
-	return functor_data->functor(kv, functor_data->data);
+	return replaced;
 }
 
-bool putall_functor(const void* item, void* data) {
-
-	hashmap_item_t* hashmap_item = item;
-	hashmap_t* dest = data;
+// Interface funcions *****************************************************
 
-	// FIXME add memory check
-	hashmap_item_t* cloned = malloc(sizeof(hashmap_item_t));
-	cloned->key = hashmap_item->key;
-	cloned->item = hashmap_item->item;
-	cloned->owner = dest;
+hashmap_t* hashmap_init(coll_equals_f* key_equals, coll_hash_f* key_hash, hashmap_options_t* options) {
 
-	hashmap_item_t* replaced = hashtable_add(dest->hashtable, cloned, NULL, NULL);
-	if(replaced!=NULL) {
-		free(replaced);
+	hashmap_options_t default_opts = {HASHMAP_DEFAULT_INIT_CAPACITY, HASHTABLE_MAX_LFACTOR};
+	if(options==NULL) {
+		options = &default_opts;
 	}
 
-	return 0;
-}
+	assert(options->initial_capacity > 0);
+	assert(options->load_factor > 0);
 
-// Interface funcions *****************************************************
+	uint32_t initial_capacity = options->initial_capacity;
+	if (initial_capacity > MAXIMUM_CAPACITY) {
+		initial_capacity = MAXIMUM_CAPACITY;
+	}
 
-hashmap_t* hashmap_init(coll_equals_f* key_equals, coll_hash_f* key_hash, hashmap_options_t* options) {
+	// Find a power of 2 >= initialCapacity, a group at least
+	uint32_t capacity = HASHTABLE_GROUP_SIZE;
+	while (capacity < initial_capacity) {
+		capacity <<= 1;
+	}
 
 	hashmap_t* map = malloc(sizeof(hashmap_t));
+	if(map==NULL) {
+		error(1, errno, "error allocating hashmap");
+	}
 
 	map->key_hash = key_hash;
 	map->key_equals = key_equals;
+	map->lfactor = options->load_factor < HASHTABLE_MAX_LFACTOR ? options->load_factor : HASHTABLE_MAX_LFACTOR;
+	map->size = 0;
 
-	hashtable_options_t hashtable_options;
-	if(options!=NULL) {
-		hashtable_options.initial_capacity = options->initial_capacity;
-		hashtable_options.load_factor = options->load_factor;
-	}
-	else {
-		hashtable_options.initial_capacity = 128;
-		hashtable_options.load_factor = 1.5f;
-	}
-
-	map->hashtable = hashtable_init(&item_eq, &item_hash, &hashtable_options);
+	hashmap_table_alloc(map, capacity);
 
 	return map;
 }
@@ -161,11 +110,10 @@ void hashmap_free(hashmap_t* map, coll_unduper_f* unduper, void* unduper_data) {
 
 	assert(map!=NULL);
 
-	item_destroy_data_t item_destroy_data;
-	item_destroy_data.unduper = unduper;
-	item_destroy_data.data = unduper_data;
+	hashmap_clear(map, unduper, unduper_data);
 
-	hashtable_free(map->hashtable, &item_free, &item_destroy_data);
+	free(map->ctrl);
+	free(map->table);
 	free(map);
 }
 
@@ -175,16 +123,15 @@ void* hashmap_put(hashmap_t* map, const void* key, const void* item) {
 	assert(map!=NULL);
 	assert(key!=NULL);
 
-	hashmap_item_t* hashmap_item = item_init(map, key, item);
-	hashmap_item_t* replaced_item = hashtable_add(map->hashtable, hashmap_item, NULL, NULL);
+	return put_hashed(map, hashtable_reinforce_hash(map->key_hash(key)), key, item);
+}
 
-	void *replaced = NULL;
-	if(replaced_item!=NULL) {
-		replaced = replaced_item->item;
-		free(replaced_item);
-	}
+void* hashmap_put_hashed(hashmap_t* map, const void* key, uint32_t hash, const void* item) {
 
-	return replaced;
+	assert(map!=NULL);
+	assert(key!=NULL);
+
+	return put_hashed(map, hashtable_reinforce_hash(hash), key, item);
 }
 
 void hashmap_putall(hashmap_t* dest, const hashmap_t* src) {
@@ -192,7 +139,18 @@ void hashmap_putall(hashmap_t* dest, const hashmap_t* src) {
 	assert(dest!=NULL);
 	assert(src!=NULL);
 
-	hashtable_foreach(src->hashtable, &putall_functor, dest);
+	// The stored hashes are good for maps with the same hash function
+	bool same_hash = dest->key_hash==src->key_hash;
+
+	uint32_t index;
+	for(index=0; index<src->table_size; index++) {
+		if(hashtable_ctrl_full(src->ctrl[index])) {
+			const hashmap_entry_t* entry = src->table + index;
+			uint32_t hash = same_hash ? entry->hash : hashtable_reinforce_hash(dest->key_hash(entry->key));
+
+			put_hashed(dest, hash, entry->key, entry->item);
+		}
+	}
 }
 
 void* hashmap_get(hashmap_t* map, const void* key) {
@@ -200,37 +158,42 @@ void* hashmap_get(hashmap_t* map, const void* key) {
 	assert(map!=NULL);
 	assert(key!=NULL);
 
-	void* item = NULL;
+	uint32_t slot = hashmap_find_slot(map, hashtable_reinforce_hash(map->key_hash(key)), key);
 
-	hashmap_item_t map_item;
-	map_item.key = key;
-	map_item.owner = map;
+	return slot!=HASHTABLE_NO_SLOT ? map->table[slot].item : NULL;
+}
 
-	hashmap_item_t* found = hashtable_get(map->hashtable, &map_item);
+void* hashmap_get_hashed(hashmap_t* map, const void* key, uint32_t hash) {
 
-	if(found){
-		item = found->item;
-	}
+	assert(map!=NULL);
+	assert(key!=NULL);
+
+	uint32_t slot = hashmap_find_slot(map, hashtable_reinforce_hash(hash), key);
 
-	return item;
+	return slot!=HASHTABLE_NO_SLOT ? map->table[slot].item : NULL;
 }
 
-void* hashmap_remove(hashmap_t* map, const void* key) {
+uint32_t hashmap_hash(hashmap_t* map, const void* key) {
 
 	assert(map!=NULL);
 	assert(key!=NULL);
 
+	return map->key_hash(key);
+}
 
-	hashmap_item_t hashmap_item;
-	hashmap_item.key = key;
-	hashmap_item.owner = map;
+void* hashmap_remove(hashmap_t* map, const void* key) {
 
-	hashmap_item_t* removed_item = hashtable_remove(map->hashtable, &hashmap_item);
+	assert(map!=NULL);
+	assert(key!=NULL);
 
 	void* removed = NULL;
-	if(removed_item){
-		removed = removed_item->item;
-		free(removed_item);
+
+	uint32_t slot = hashmap_find_slot(map, hashtable_reinforce_hash(map->key_hash(key)), key);
+	if(slot!=HASHTABLE_NO_SLOT) {
+		removed = map->table[slot].item;
+
+		hashtable_set_ctrl(map->ctrl, map->table_size, slot, HASHTABLE_CTRL_DELETED);
+		map->size--;
 	}
 
 	return removed;
@@ -240,7 +203,7 @@ uint32_t hashmap_size(hashmap_t* map){
 
 	assert(map!=NULL);
 
-	return hashtable_size(map->hashtable);
+	return map->size;
 }
 
 bool hashmap_empty(hashmap_t* hashmap) {
@@ -261,46 +224,37 @@ void hashmap_clear(hashmap_t* map, coll_unduper_f* unduper, void* unduper_data)
 
 	assert(map!=NULL);
 
-	item_destroy_data_t item_destroy_data;
-	item_destroy_data.unduper = unduper;
-	item_destroy_data.data = unduper_data;
+	uint32_t index;
+	for(index=0; index<map->table_size; index++) {
+		if(hashtable_ctrl_full(map->ctrl[index]) && unduper!=NULL) {
+			unduper(map->table[index].item, unduper_data);
+		}
+	}
 
-	hashtable_clear(map->hashtable, &item_free, &item_destroy_data);
+	memset(map->ctrl, HASHTABLE_CTRL_EMPTY, sizeof(uint8_t) * (map->table_size + HASHTABLE_GROUP_SIZE));
+	map->table_used = 0;
+	map->size = 0;
 }
 
-//void* hashmap_find(hashmap_t* map, coll_predicate_t* predicate, void* predicate_data) {
-//
-//	assert(map!=NULL);
-//	assert(predicate!=NULL);
-//	assert(nth>=0);
-//
-//	void* found = NULL;
-//
-//	item_evaluate_data_t item_evaluate_data;
-//	item_evaluate_data.key_predicate = predicate;
-//
-//	coll_predicate_t map_predicate;
-//	map_predicate.evaluate = &item_evaluate;
-//	map_predicate.data = &item_evaluate_data;
-//
-//	hashmap_item_t* map_item = hashtable_find(map->hashtable, &map_predicate, nth);
-//	if(map_item != NULL) {
-//		found = map_item->item;
-//	}
-//
-//	return found;
-//}
-
 bool hashmap_foreach(hashmap_t* hashmap, coll_functor_f* functor, void* functor_data) {
 
 	assert(hashmap!=NULL);
 	assert(functor!=NULL);
 
-	item_functor_data_t item_functor_data;
-	item_functor_data.functor = functor;
-	item_functor_data.data = functor_data;
+	bool finish = false;
+
+	uint32_t index;
+	for(index=0; index<hashmap->table_size && !finish; index++) {
+		if(hashtable_ctrl_full(hashmap->ctrl[index])) {
+			void* kv[2];
+			kv[0] = (void*)hashmap->table[index].key;
+			kv[1] = hashmap->table[index].item;
+
+			finish = functor(kv, functor_data);
+		}
+	}
 
-	return hashtable_foreach(hashmap->hashtable, &kv_functor, &item_functor_data);
+	return finish;
 }
 
 bool hashmap_foreach_value(hashmap_t* hashmap, coll_functor_f* functor, void* functor_data) {
@@ -308,10 +262,14 @@ bool hashmap_foreach_value(hashmap_t* hashmap, coll_functor_f* functor, void* fu
 	assert(hashmap!=NULL);
 	assert(functor!=NULL);
 
-	item_functor_data_t item_functor_data;
-	item_functor_data.functor = functor;
-	item_functor_data.data = functor_data;
+	bool finish = false;
 
-	return hashtable_foreach(hashmap->hashtable, &item_functor, &item_functor_data);
-}
+	uint32_t index;
+	for(index=0; index<hashmap->table_size && !finish; index++) {
+		if(hashtable_ctrl_full(hashmap->ctrl[index])) {
+			finish = functor(hashmap->table[index].item, functor_data);
+		}
+	}
 
+	return finish;
+}
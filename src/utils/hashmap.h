@@ -44,6 +44,22 @@ void* hashmap_put(hashmap_t* hashmap, const void* key, const void* item);
 
 void hashmap_putall(hashmap_t* dest, const hashmap_t* src);
 
+/**
+ * Calculate the hash of a key by the map hash function. A key hashed once can
+ * be looked up and put by the *_hashed functions, without hashing it again.
+ */
+uint32_t hashmap_hash(hashmap_t* hashmap, const void* key);
+
+/**
+ * As hashmap_get, with the key hash already computed by hashmap_hash.
+ */
+void* hashmap_get_hashed(hashmap_t* hashmap, const void* key, uint32_t hash);
+
+/**
+ * As hashmap_put, with the key hash already computed by hashmap_hash.
+ */
+void* hashmap_put_hashed(hashmap_t* hashmap, const void* key, uint32_t hash, const void* item);
+
 void* hashmap_remove(hashmap_t* hashmap, const void* key);
 
 void hashmap_clear(hashmap_t* hashmap, coll_unduper_f* unduper, void* unduper_data);
@@ -22,6 +22,15 @@
 #define HASHTABLEIMPL_H_
 
 #include "hashtable.h"
+#include "error.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
 
 /**
  * The default initial capacity - MUST be a power of two.
@@ -40,17 +49,34 @@
  */
 #define HASHTABLE_DEFAULT_LFACTOR 0.75f
 
-typedef struct _hashtable_entry_t hashtable_entry_t;
+/**
+ * The slots probed together, the control bytes of a group are matched at
+ * once.
+ */
+#define HASHTABLE_GROUP_SIZE 16
 
-struct _hashtable_entry_t {
-	hashtable_entry_t* next;
-	int32_t hash;
-	void* item;
-};
+/**
+ * The highest load factor, the probe sequences get long above it.
+ */
+#define HASHTABLE_MAX_LFACTOR 0.875f
+
+#define HASHTABLE_CTRL_EMPTY 0x80
+#define HASHTABLE_CTRL_DELETED 0xFE
+
+typedef struct {
+	// The reinforced hash, the table grows without hashing again
+	uint32_t hash;
+	const void* item;
+} hashtable_entry_t;
 
 struct _hashtable_t {
-	hashtable_entry_t** table;
+	// A control byte per slot: EMPTY, DELETED or the low 7 bits of the
+	// hash. The first group is repeated after the last slot, so every
+	// slot starts a whole group.
+	uint8_t* ctrl;
+	hashtable_entry_t* table;
 	uint32_t table_size;
+	// The full and the deleted slots
 	uint32_t table_used;
 	coll_hash_f* hash_fn;
 	coll_equals_f* eq_fn;
@@ -59,10 +85,203 @@ struct _hashtable_t {
 	float lfactor;
 };
 
-uint32_t hashtable_index(const int32_t hash, uint32_t length);
+// The open addressing helpers, shared with the hashmap ******************
+
+/**
+ * Mix the bits of the given hash, the control byte and the probe start
+ * are taken from different bits and both must change with every input
+ * bit. It is the murmur3 finalizer.
+ */
+static inline uint32_t hashtable_reinforce_hash(uint32_t weak_hash) {
+
+	uint32_t hash = weak_hash;
+
+	hash ^= hash >> 16;
+	hash *= 0x85ebca6b;
+	hash ^= hash >> 13;
+	hash *= 0xc2b2ae35;
+	return hash ^ (hash >> 16);
+}
+
+static inline uint8_t hashtable_hash_ctrl(uint32_t hash) {
+	return hash & 0x7F;
+}
 
-hashtable_entry_t* hashtable_find_entry(hashtable_t* hashtable, uint32_t table_index, const void* item);
-hashtable_entry_t* hashtable_add_entry(hashtable_t* hashtable, uint32_t table_index, const void* item);
-hashtable_entry_t* hashtable_remove_entry(hashtable_t* hashtable, uint32_t table_index, const void* item);
+/**
+ * The empty and the deleted control bytes are the only ones with the high
+ * bit set.
+ */
+static inline bool hashtable_ctrl_full(uint8_t ctrl) {
+	return !(ctrl & 0x80);
+}
+
+static inline uint32_t hashtable_hash_slot(uint32_t hash, uint32_t table_size) {
+	return (hash >> 7) & (table_size - 1);
+}
+
+/**
+ * @return a bit for every control byte of the group equal to the given one.
+ */
+static inline uint32_t hashtable_group_match(const uint8_t* group, uint8_t ctrl) {
+
+#ifdef __SSE2__
+	__m128i bytes = _mm_loadu_si128((const __m128i*)group);
+	return _mm_movemask_epi8(_mm_cmpeq_epi8(bytes, _mm_set1_epi8((char)ctrl)));
+#else
+	uint32_t mask = 0;
+	int index;
+	for(index=0; index<HASHTABLE_GROUP_SIZE; index++) {
+		if(group[index]==ctrl) {
+			mask |= 1u << index;
+		}
+	}
+	return mask;
+#endif
+}
+
+/**
+ * @return a bit for every empty or deleted slot of the group.
+ */
+static inline uint32_t hashtable_group_match_free(const uint8_t* group) {
+
+#ifdef __SSE2__
+	return _mm_movemask_epi8(_mm_loadu_si128((const __m128i*)group));
+#else
+	uint32_t mask = 0;
+	int index;
+	for(index=0; index<HASHTABLE_GROUP_SIZE; index++) {
+		if(!hashtable_ctrl_full(group[index])) {
+			mask |= 1u << index;
+		}
+	}
+	return mask;
+#endif
+}
+
+/**
+ * Set the control byte of a slot, and of its copy after the last slot.
+ */
+static inline void hashtable_set_ctrl(uint8_t* ctrl, uint32_t table_size, uint32_t slot, uint8_t value) {
+
+	ctrl[slot] = value;
+	if(slot < HASHTABLE_GROUP_SIZE) {
+		ctrl[table_size + slot] = value;
+	}
+}
+
+/**
+ * The slot returned by the find functions for a missing key.
+ */
+#define HASHTABLE_NO_SLOT UINT32_MAX
+
+/**
+ * Define the open addressing functions of a table type, the probe loops
+ * the hashtable, the hashmap and the HASHMAP_DEFINE maps share. The table
+ * type has the ctrl, table, table_size, table_used, threshold, size and
+ * lfactor fields of struct _hashtable_t; the entry type starts with the
+ * uint32_t hash and is moved by value.
+ *
+ * HASHTABLE_DEFINE_SLOTS(name, table_type, entry_type, key_type, entry_equals)
+ * defines:
+ *
+ * - void name_table_alloc(table_type* table, uint32_t table_size)
+ * - uint32_t name_find_slot(const table_type* table, uint32_t hash, key_type key),
+ *   HASHTABLE_NO_SLOT if the key is not in the table
+ * - entry_type* name_put_slot(table_type* table, uint32_t hash), the entry
+ *   of a key known not to be in the table, the caller fills it but the hash
+ * - void name_resize(table_type* table)
+ *
+ * @param entry_equals bool entry_equals(const table_type* table,
+ * const entry_type* entry, key_type key), a function or a macro, called
+ * for the entries with the same hash only.
+ */
+#define HASHTABLE_DEFINE_SLOTS(name, table_type, entry_type, key_type, entry_equals) \
+\
+static inline void name##_table_alloc(table_type* table, uint32_t table_size) { \
+	table->ctrl = malloc(sizeof(uint8_t) * (table_size + HASHTABLE_GROUP_SIZE)); \
+	table->table = malloc(sizeof(entry_type) * table_size); \
+	if(table->ctrl==NULL || table->table==NULL) { \
+		error(1, errno, "error allocating " #name " table"); \
+	} \
+	memset(table->ctrl, HASHTABLE_CTRL_EMPTY, sizeof(uint8_t) * (table_size + HASHTABLE_GROUP_SIZE)); \
+	table->table_size = table_size; \
+	table->table_used = 0; \
+	table->threshold = table_size * table->lfactor; \
+	if(table->threshold==0) { \
+		table->threshold = 1; \
+	} \
+} \
+\
+static inline uint32_t name##_find_slot(const table_type* table, uint32_t hash, key_type key) { \
+	uint32_t mask = table->table_size - 1; \
+	uint32_t position = hashtable_hash_slot(hash, table->table_size); \
+	uint32_t stride = 0; \
+	while(true) { \
+		const uint8_t* group = table->ctrl + position; \
+		uint32_t matches = hashtable_group_match(group, hashtable_hash_ctrl(hash)); \
+		while(matches) { \
+			uint32_t slot = (position + __builtin_ctz(matches)) & mask; \
+			const entry_type* entry = table->table + slot; \
+			if(entry->hash==hash && entry_equals(table, entry, key)) { \
+				return slot; \
+			} \
+			matches &= matches - 1; \
+		} \
+		/* An empty slot ends the probe sequence, the key would be there */ \
+		if(hashtable_group_match(group, HASHTABLE_CTRL_EMPTY)) { \
+			return HASHTABLE_NO_SLOT; \
+		} \
+		/* Triangular probing visits every group once */ \
+		stride += HASHTABLE_GROUP_SIZE; \
+		position = (position + stride) & mask; \
+	} \
+} \
+\
+/* The first empty or deleted slot of the probe sequence */ \
+static inline entry_type* name##_put_slot(table_type* table, uint32_t hash) { \
+	uint32_t mask = table->table_size - 1; \
+	uint32_t position = hashtable_hash_slot(hash, table->table_size); \
+	uint32_t stride = 0; \
+	uint32_t frees; \
+	while(!(frees = hashtable_group_match_free(table->ctrl + position))) { \
+		stride += HASHTABLE_GROUP_SIZE; \
+		position = (position + stride) & mask; \
+	} \
+	uint32_t slot = (position + __builtin_ctz(frees)) & mask; \
+	if(table->ctrl[slot]==HASHTABLE_CTRL_EMPTY) { \
+		table->table_used++; \
+	} \
+	hashtable_set_ctrl(table->ctrl, table->table_size, slot, hashtable_hash_ctrl(hash)); \
+	entry_type* entry = table->table + slot; \
+	entry->hash = hash; \
+	table->size++; \
+	return entry; \
+} \
+\
+/* Rebuild the table, twice as large if it is at least half full, without \
+ * the deleted slots. The stored hashes place the entries without hashing \
+ * or comparing the keys. */ \
+static inline void name##_resize(table_type* table) { \
+	uint8_t* old_ctrl = table->ctrl; \
+	entry_type* old_table = table->table; \
+	uint32_t old_size = table->table_size; \
+	uint32_t new_size = old_size; \
+	if(table->size >= table->threshold / 2) { \
+		if(old_size==MAXIMUM_CAPACITY) { \
+			error(1, 0, #name " is full, it holds %u items", table->size); \
+		} \
+		new_size *= 2; \
+	} \
+	name##_table_alloc(table, new_size); \
+	table->size = 0; \
+	uint32_t index; \
+	for(index=0; index<old_size; index++) { \
+		if(hashtable_ctrl_full(old_ctrl[index])) { \
+			*name##_put_slot(table, old_table[index].hash) = old_table[index]; \
+		} \
+	} \
+	free(old_ctrl); \
+	free(old_table); \
+}
 
 #endif /* HASHTABLEIMPL_H_ */
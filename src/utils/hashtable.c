@@ -20,6 +20,7 @@
 
 #include "hashtable-impl.h"
 #include "functors.h"
+#include "error.h"
 
 #include <stdio.h>
 #include <assert.h>
@@ -30,77 +31,16 @@
 
 extern int errno;
 
-static void hashtable_resize(hashtable_t* hashtable, int new_capacity) {
-
-	uint32_t index;
-
-    if (hashtable->table_size == MAXIMUM_CAPACITY) {
-    	hashtable->threshold = UINT32_MAX;
-        return;
-    }
-
-    hashtable_entry_t** old_table = hashtable->table;
-	uint32_t old_capacity = hashtable->table_size;
-
-    hashtable_entry_t** new_table =  malloc(sizeof(hashtable_entry_t*) * new_capacity);
-    if(new_table!=NULL) {
-
-    	// reset table
-		// Reset table
-    	// FIXME use memset
-		for(index=0; index<new_capacity; index++) {
-			*(new_table+index)=NULL;
-		}
-
-        hashtable->table = new_table;
-        hashtable->table_size = new_capacity;
-        hashtable->table_used = 0;
-        hashtable->size = 0;
-        hashtable->threshold = new_capacity * hashtable->lfactor;
-
-    	for(index=0; index<old_capacity; index++) {
-
-    		hashtable_entry_t* entry = *(old_table + index);
-    		while(entry!=NULL) {
-    			void* item = entry->item;
-    			hashtable_add(hashtable, item, NULL, NULL);
-    			hashtable_entry_t* this_entry = entry;
-    			entry=entry->next;
-    			free(this_entry);
-    		}
-    	}
-
-    	free(old_table);
-    }
-    else {
-    	// TODO errore
-    	//error(-1, errno, "Errore resize hashtable");
-    }
-
+static inline bool item_equals(const hashtable_t* hashtable, const hashtable_entry_t* entry, const void* item) {
+	return hashtable->eq_fn(entry->item, item);
 }
 
-/**
- * Applies a supplemental hash function to a given hashCode, which
- * defends against poor quality hash functions.  This is critical
- * because HashMap uses power-of-two length hash tables, that
- * otherwise encounter collisions for hashCodes that do not differ
- * in lower bits. Note: Null keys always map to hash 0, thus index 0.
- */
-static int hashtable_reinforce_hash(const int weak_hash) {
-
-	uint32_t hash = weak_hash;
-
-	// This function ensures that hashCodes that differ only by
-	// constant multiples at each bit position have a bounded
-	// number of collisions (approximately 8 at default load factor).
-	hash ^= (hash >> 20) ^ (hash >> 12);
-	return hash ^ (hash >> 7) ^ (hash >> 4);
-}
+HASHTABLE_DEFINE_SLOTS(hashtable, hashtable_t, hashtable_entry_t, const void*, item_equals)
 
 hashtable_t* hashtable_init(coll_equals_f* eq_fn, coll_hash_f* hash_fn, hashtable_options_t* options) {
 
+	hashtable_options_t default_opts = {HASHTABLE_DEFAULT_INIT_CAPACITY, HASHTABLE_DEFAULT_LFACTOR};
 	if(options==NULL) {
-		hashtable_options_t default_opts = {16, 0.75f};
 		options = &default_opts;
 	}
 
@@ -113,42 +53,23 @@ hashtable_t* hashtable_init(coll_equals_f* eq_fn, coll_hash_f* hash_fn, hashtabl
 		initial_capacity = MAXIMUM_CAPACITY;
 	}
 
-	// Find a power of 2 >= initialCapacity
-	uint32_t capacity = 1;
+	// Find a power of 2 >= initialCapacity, a group at least
+	uint32_t capacity = HASHTABLE_GROUP_SIZE;
 	while (capacity < initial_capacity) {
 		capacity <<= 1;
 	}
 
 	hashtable_t* hashtable = malloc(sizeof(hashtable_t));
 	if(hashtable==NULL) {
-		// TODO error
-		//error(-1, errno, "Error allocating hashtable");
-	}
-
-	hashtable_entry_t** table = malloc(sizeof(hashtable_entry_t*) * capacity);
-	if(table==NULL) {
-		free(hashtable);
-		// TODO error
-		//error(-1, errno, "Error allocating hashtable table");
-	}
-	else {
-		// Reset table
-		uint32_t i;
-		for(i=0; i<capacity; i++) {
-			*(table+i)=NULL;
-		}
-
-		hashtable->table = table;
-		hashtable->table_size = capacity;
-		hashtable->table_used = 0;
-		hashtable->size = 0;
+		error(1, errno, "error allocating hashtable");
 	}
 
 	hashtable->hash_fn = hash_fn;
 	hashtable->eq_fn = eq_fn;
+	hashtable->lfactor = options->load_factor < HASHTABLE_MAX_LFACTOR ? options->load_factor : HASHTABLE_MAX_LFACTOR;
+	hashtable->size = 0;
 
-	hashtable->lfactor = options->load_factor;
-	hashtable->threshold = capacity * options->load_factor;
+	hashtable_table_alloc(hashtable, capacity);
 
 	return hashtable;
 }
@@ -157,40 +78,40 @@ void hashtable_free(hashtable_t* hashtable, coll_unduper_f* unduper, void* undup
 
 	hashtable_clear(hashtable, unduper, unduper_data);
 
+	free(hashtable->ctrl);
 	free(hashtable->table);
 	free(hashtable);
 }
 
 void* hashtable_get(hashtable_t* hashtable, const void* item) {
 
-	int hashcode = hashtable_reinforce_hash(hashtable->hash_fn(item));
-	uint32_t table_index = hashtable_index(hashcode, hashtable->table_size);
-
-	hashtable_entry_t* entry = hashtable_find_entry(hashtable, table_index, item);
+	uint32_t hash = hashtable_reinforce_hash(hashtable->hash_fn(item));
+	uint32_t slot = hashtable_find_slot(hashtable, hash, item);
 
-	return entry!=NULL?entry->item:NULL;
+	return slot!=HASHTABLE_NO_SLOT ? (void*)hashtable->table[slot].item : NULL;
 }
 
 void* hashtable_add(hashtable_t* hashtable, const void* item, coll_duper_f* duper, void* duper_data) {
 
 	void* replaced = NULL;
 
-	int hashcode = hashtable_reinforce_hash(hashtable->hash_fn(item));
-	uint32_t table_index = hashtable_index(hashcode, hashtable->table_size);
-
-	hashtable_entry_t* entry = hashtable_find_entry(hashtable, table_index, item);
+	uint32_t hash = hashtable_reinforce_hash(hashtable->hash_fn(item));
+	uint32_t slot = hashtable_find_slot(hashtable, hash, item);
 
 	if(!duper) {
 		duper = &coll_nop_duper;
 	}
 	void* duped_item = duper(item, duper_data);
 
-	if(entry!=NULL) {
-		replaced = entry->item;
-		entry->item = duped_item;
+	if(slot!=HASHTABLE_NO_SLOT) {
+		replaced = (void*)hashtable->table[slot].item;
+		hashtable->table[slot].item = duped_item;
 	}
 	else {
-		hashtable_add_entry(hashtable, table_index, duped_item);
+		if(hashtable->table_used >= hashtable->threshold) {
+			hashtable_resize(hashtable);
+		}
+		hashtable_put_slot(hashtable, hash)->item = duped_item;
 	}
 
 	return replaced;
@@ -200,14 +121,15 @@ void* hashtable_remove(hashtable_t* hashtable, const void* item) {
 
 	void* removed = NULL;
 
-	int hashcode = hashtable_reinforce_hash(hashtable->hash_fn(item));
-	uint32_t table_index = hashtable_index(hashcode, hashtable->table_size);
+	uint32_t hash = hashtable_reinforce_hash(hashtable->hash_fn(item));
+	uint32_t slot = hashtable_find_slot(hashtable, hash, item);
 
-	hashtable_entry_t* entry = hashtable_remove_entry(hashtable, table_index, item);
+	if(slot!=HASHTABLE_NO_SLOT) {
+		removed = (void*)hashtable->table[slot].item;
 
-	if(entry!=NULL) {
-		removed = entry->item;
-		free(entry);
+		// The slot may be in the middle of a probe sequence
+		hashtable_set_ctrl(hashtable->ctrl, hashtable->table_size, slot, HASHTABLE_CTRL_DELETED);
+		hashtable->size--;
 	}
 
     return removed;
@@ -215,23 +137,16 @@ void* hashtable_remove(hashtable_t* hashtable, const void* item) {
 
 void hashtable_clear(hashtable_t* hashtable, coll_unduper_f* unduper, void* unduper_data) {
 
-	uint32_t tindex = 0;
-	for(tindex=0; tindex<hashtable->table_size; tindex++) {
-
-		hashtable_entry_t* entry = *(hashtable->table+tindex);
-		while(entry!=NULL) {
-			hashtable_entry_t* next = entry->next;
-			*(hashtable->table+tindex)=next;
-
-			if(unduper!=NULL) {
-				unduper(entry->item, unduper_data);
-			}
-
-			free(entry);
-			entry = next;
+	uint32_t index;
+	for(index=0; index<hashtable->table_size; index++) {
+		if(hashtable_ctrl_full(hashtable->ctrl[index]) && unduper!=NULL) {
+			unduper((void*)hashtable->table[index].item, unduper_data);
 		}
 	}
 
+	memset(hashtable->ctrl, HASHTABLE_CTRL_EMPTY, sizeof(uint8_t) * (hashtable->table_size + HASHTABLE_GROUP_SIZE));
+	hashtable->table_used = 0;
+	hashtable->size = 0;
 }
 
 bool hashtable_contains(hashtable_t* hashtable, void* item) {
@@ -248,15 +163,12 @@ bool hashtable_empty(hashtable_t* hashtable) {
 
 bool hashtable_foreach(hashtable_t* hashtable, coll_functor_f* functor, void* functor_data) {
 
-	uint32_t tindex = 0;
 	bool finish = false;
 
-	for(tindex=0; tindex<hashtable->table_size && !finish; tindex++) {
-
-		hashtable_entry_t* entry = *(hashtable->table+tindex);
-		while(entry!=NULL && !finish) {
-			finish = functor(entry->item, functor_data);
-			entry = entry->next;
+	uint32_t index;
+	for(index=0; index<hashtable->table_size && !finish; index++) {
+		if(hashtable_ctrl_full(hashtable->ctrl[index])) {
+			finish = functor(hashtable->table[index].item, functor_data);
 		}
 	}
 
@@ -274,65 +186,3 @@ bool hashtable_foreach(hashtable_t* hashtable, coll_functor_f* functor, void* fu
 //
 //	return found;
 //}
-
-uint32_t hashtable_index(const int32_t hash, uint32_t length) {
-    return hash & (length-1);
-}
-
-hashtable_entry_t* hashtable_find_entry(hashtable_t* hashtable, uint32_t table_index, const void* item) {
-
-	hashtable_entry_t* entry = *(hashtable->table + table_index);
-	while(entry!=NULL && !hashtable->eq_fn(entry->item, item)) {
-		entry = entry->next;
-	}
-
-	return entry;
-}
-
-hashtable_entry_t* hashtable_add_entry(hashtable_t* hashtable, uint32_t table_index, const void* item) {
-
-	hashtable_entry_t* bucket_head = *(hashtable->table+table_index);
-
-	// Create entry
-	hashtable_entry_t* entry = malloc(sizeof(hashtable_entry_t));
-	entry->hash = hashtable->hash_fn(item);
-	entry->item = item;
-	entry->next = bucket_head;
-
-	*(hashtable->table+table_index) = entry;
-	hashtable->size++;
-
-	// Bucket added
-	if(bucket_head==NULL) {
-		hashtable->table_used++;
-		if (hashtable->table_used >= hashtable->threshold) {
-			hashtable_resize(hashtable, 2 * hashtable->table_size);
-		}
-	}
-
-    return entry;
-}
-
-hashtable_entry_t* hashtable_remove_entry(hashtable_t* hashtable, uint32_t table_index, const void* item) {
-
-    hashtable_entry_t *entry = *(hashtable->table + table_index);
-    hashtable_entry_t *prev = NULL;
-
-    while(entry != NULL && !hashtable->eq_fn(entry->item, item)) {
-    	prev = entry;
-    	entry = entry->next;
-    }
-
-    if(entry!=NULL) {
-    	if(prev!=NULL) {
-    		prev->next = entry->next;
-    	}
-    	else {
-    		*(hashtable->table + table_index) = entry->next;
-    	}
-
-    	hashtable->size--;
-    }
-
-    return entry;
-}
@@ -0,0 +1,390 @@
+/* Copyright (C) 2011 Fantayeneh Asres Gizaw, Filippo De Luca
+ *
+ * This file is part of libWURFL.
+ *
+ * libWURFL is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * any later version.
+ *
+ * libWURFL is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with libWURFL.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/* Written by Filippo De Luca <me@filippodeluca.com>.  */
+
+#include "mphf.h"
+
+#include "utils.h"
+#include "error.h"
+
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <assert.h>
+#include <errno.h>
+
+extern int errno;
+
+/**
+ * The average strings in a bucket, the pilots take 16 / MPHF_BUCKET_KEYS
+ * bits per string.
+ */
+#define MPHF_BUCKET_KEYS 5
+
+/**
+ * The strings fill this much of the positions tried, the ones falling
+ * over the last string are remapped to the free ones.
+ */
+#define MPHF_LOAD_FACTOR 0.99
+
+/**
+ * 60% of the strings go to the first 30% of the buckets: the large buckets
+ * are placed while most positions are free, the small ones then fill the
+ * gaps.
+ */
+#define MPHF_DENSE_KEYS UINT32_C(2576980377)
+#define MPHF_DENSE_BUCKETS 0.3
+
+#define MPHF_MAX_PILOT UINT16_MAX
+
+#define MPHF_ATTEMPTS 16
+
+#define MPHF_SEED UINT64_C(0x9e3779b97f4a7c15)
+
+/*
+ * The memory block: the meta, the pilot of every bucket and the position
+ * of the strings falling over the last one, at table_size - size.
+ */
+typedef struct {
+	uint64_t seed;
+	uint32_t size;
+	uint32_t table_size;
+	uint32_t buckets;
+	uint32_t dense_buckets;
+} mphf_meta_t;
+
+struct _mphf_t {
+	// NULL if the block is mapped
+	void* owned;
+	const mphf_meta_t* meta;
+	const uint16_t* pilots;
+	const uint32_t* remap;
+	size_t data_size;
+};
+
+static size_t pilots_offset() {
+	return sizeof(mphf_meta_t);
+}
+
+static size_t remap_offset(const mphf_meta_t* meta) {
+	size_t offset = pilots_offset() + sizeof(uint16_t) * meta->buckets;
+	return (offset + sizeof(uint32_t) - 1) & ~(sizeof(uint32_t) - 1);
+}
+
+static size_t data_size(const mphf_meta_t* meta) {
+	return remap_offset(meta) + sizeof(uint32_t) * (meta->table_size - meta->size);
+}
+
+static mphf_t* mphf_alloc(void* owned, const void* data) {
+
+	mphf_t* mphf = malloc(sizeof(mphf_t));
+	if(!mphf) {
+		error(1, errno, "error allocating perfect hash");
+	}
+
+	mphf->owned = owned;
+	mphf->meta = data;
+	mphf->pilots = (const uint16_t*)((const char*)data + pilots_offset());
+	mphf->remap = (const uint32_t*)((const char*)data + remap_offset(mphf->meta));
+	mphf->data_size = data_size(mphf->meta);
+
+	return mphf;
+}
+
+static inline uint32_t fastrange(uint32_t hash, uint32_t range) {
+	return ((uint64_t)hash * range) >> 32;
+}
+
+static inline uint32_t key_bucket(const mphf_meta_t* meta, uint64_t hash) {
+
+	uint32_t high = hash >> 32;
+	if((uint32_t)hash < MPHF_DENSE_KEYS || meta->dense_buckets==meta->buckets) {
+		return fastrange(high, meta->dense_buckets);
+	}
+	else {
+		return meta->dense_buckets + fastrange(high, meta->buckets - meta->dense_buckets);
+	}
+}
+
+/**
+ * Every pilot moves the string somewhere else, the murmur3 64 bits
+ * finalizer makes the positions of different pilots unrelated.
+ */
+static inline uint32_t key_position(const mphf_meta_t* meta, uint64_t hash, uint16_t pilot) {
+
+	uint64_t mixed = hash ^ ((uint64_t)(pilot + 1) * MPHF_SEED);
+	mixed ^= mixed >> 33;
+	mixed *= UINT64_C(0xff51afd7ed558ccd);
+	mixed ^= mixed >> 33;
+	mixed *= UINT64_C(0xc4ceb9fe1a85ec53);
+	mixed ^= mixed >> 33;
+
+	return fastrange(mixed >> 32, meta->table_size);
+}
+
+static inline uint64_t key_hash(const mphf_meta_t* meta, const char* key) {
+	return hash_bytes(key, strlen(key), meta->seed);
+}
+
+static int hash_cmp(const void* litem, const void* ritem) {
+	uint64_t lhash = *(const uint64_t*)litem;
+	uint64_t rhash = *(const uint64_t*)ritem;
+
+	return lhash < rhash ? -1 : (lhash > rhash ? 1 : 0);
+}
+
+static inline bool taken(const uint64_t* bits, uint32_t position) {
+	return (bits[position >> 6] >> (position & 63)) & 1;
+}
+
+static inline void take(uint64_t* bits, uint32_t position) {
+	bits[position >> 6] |= UINT64_C(1) << (position & 63);
+}
+
+static inline void release(uint64_t* bits, uint32_t position) {
+	bits[position >> 6] &= ~(UINT64_C(1) << (position & 63));
+}
+
+/**
+ * Find the pilots of the given seed in the block already sized.
+ *
+ * @return false if two strings have the same hash or a bucket does not
+ *         fit, a different seed is needed.
+ */
+static bool build(mphf_meta_t* meta, uint16_t* pilots, uint32_t* remap, const char* const* keys) {
+
+	uint32_t size = meta->size;
+	bool built = false;
+
+	uint64_t* hashes = malloc(sizeof(uint64_t) * size);
+	uint32_t* bucket_start = calloc(meta->buckets + 1, sizeof(uint32_t));
+	uint64_t* bucket_hashes = malloc(sizeof(uint64_t) * size);
+	uint32_t* order = malloc(sizeof(uint32_t) * meta->buckets);
+	uint64_t* bits = calloc((meta->table_size + 63) / 64, sizeof(uint64_t));
+	uint32_t positions[256];
+	if(!hashes || !bucket_start || !bucket_hashes || !order || !bits) {
+		error(1, errno, "error allocating perfect hash");
+	}
+
+	uint32_t index;
+	for(index=0; index<size; index++) {
+		hashes[index] = key_hash(meta, keys[index]);
+	}
+
+	// The strings of a bucket are told apart by their hash only
+	memcpy(bucket_hashes, hashes, sizeof(uint64_t) * size);
+	qsort(bucket_hashes, size, sizeof(uint64_t), &hash_cmp);
+	for(index=1; index<size; index++) {
+		if(bucket_hashes[index]==bucket_hashes[index - 1]) {
+			goto done;
+		}
+	}
+
+	// Group the hashes by bucket
+	for(index=0; index<size; index++) {
+		bucket_start[key_bucket(meta, hashes[index]) + 1]++;
+	}
+	uint32_t bucket;
+	uint32_t max_bucket_size = 0;
+	for(bucket=0; bucket<meta->buckets; bucket++) {
+		if(bucket_start[bucket + 1] > max_bucket_size) {
+			max_bucket_size = bucket_start[bucket + 1];
+		}
+		bucket_start[bucket + 1] += bucket_start[bucket];
+	}
+	if(max_bucket_size > sizeof(positions) / sizeof(uint32_t)) {
+		goto done;
+	}
+	for(index=0; index<size; index++) {
+		bucket = key_bucket(meta, hashes[index]);
+		bucket_hashes[bucket_start[bucket]++] = hashes[index];
+	}
+	for(bucket=meta->buckets; bucket>0; bucket--) {
+		bucket_start[bucket] = bucket_start[bucket - 1];
+	}
+	bucket_start[0] = 0;
+
+	// The largest buckets first, by a counting sort on the size
+	uint32_t* sizes_start = calloc(max_bucket_size + 2, sizeof(uint32_t));
+	if(!sizes_start) {
+		error(1, errno, "error allocating perfect hash");
+	}
+	for(bucket=0; bucket<meta->buckets; bucket++) {
+		sizes_start[max_bucket_size - (bucket_start[bucket + 1] - bucket_start[bucket]) + 1]++;
+	}
+	for(index=0; index<=max_bucket_size; index++) {
+		sizes_start[index + 1] += sizes_start[index];
+	}
+	for(bucket=0; bucket<meta->buckets; bucket++) {
+		order[sizes_start[max_bucket_size - (bucket_start[bucket + 1] - bucket_start[bucket])]++] = bucket;
+	}
+	free(sizes_start);
+
+	for(index=0; index<meta->buckets; index++) {
+		bucket = order[index];
+		const uint64_t* bucket_keys = bucket_hashes + bucket_start[bucket];
+		uint32_t bucket_size = bucket_start[bucket + 1] - bucket_start[bucket];
+
+		pilots[bucket] = 0;
+		if(bucket_size==0) {
+			continue;
+		}
+
+		uint32_t pilot;
+		for(pilot=0; pilot<=MPHF_MAX_PILOT; pilot++) {
+			uint32_t placed;
+			for(placed=0; placed<bucket_size; placed++) {
+				uint32_t position = key_position(meta, bucket_keys[placed], pilot);
+				if(taken(bits, position)) {
+					break;
+				}
+				take(bits, position);
+				positions[placed] = position;
+			}
+			if(placed==bucket_size) {
+				break;
+			}
+			while(placed > 0) {
+				release(bits, positions[--placed]);
+			}
+		}
+		if(pilot > MPHF_MAX_PILOT) {
+			goto done;
+		}
+		pilots[bucket] = pilot;
+	}
+
+	// The positions over the last string take the free ones below it
+	uint32_t free_position = 0;
+	uint32_t position;
+	for(position=size; position<meta->table_size; position++) {
+		if(taken(bits, position)) {
+			while(taken(bits, free_position)) {
+				free_position++;
+			}
+			remap[position - size] = free_position++;
+		}
+		else {
+			remap[position - size] = 0;
+		}
+	}
+	built = true;
+
+done:
+	free(hashes);
+	free(bucket_start);
+	free(bucket_hashes);
+	free(order);
+	free(bits);
+
+	return built;
+}
+
+mphf_t* mphf_init(const char* const* keys, uint32_t size) {
+
+	mphf_meta_t meta;
+	memset(&meta, 0, sizeof(meta));
+	meta.size = size;
+	meta.table_size = size;
+	if(size > 0) {
+		meta.table_size = size / MPHF_LOAD_FACTOR;
+		if(meta.table_size < size) {
+			meta.table_size = size;
+		}
+		meta.buckets = (size + MPHF_BUCKET_KEYS - 1) / MPHF_BUCKET_KEYS;
+		meta.dense_buckets = meta.buckets * MPHF_DENSE_BUCKETS;
+		if(meta.dense_buckets==0) {
+			meta.dense_buckets = meta.buckets;
+		}
+	}
+
+	size_t size_of_data = data_size(&meta);
+	char* data = calloc(size_of_data, 1);
+	if(!data) {
+		error(1, errno, "error allocating perfect hash");
+	}
+
+	uint32_t attempt;
+	for(attempt=0; attempt<MPHF_ATTEMPTS; attempt++) {
+		meta.seed = MPHF_SEED * (attempt + 1);
+		memcpy(data, &meta, sizeof(meta));
+		if(size==0 || build((mphf_meta_t*)data, (uint16_t*)(data + pilots_offset()), (uint32_t*)(data + remap_offset(&meta)), keys)) {
+			return mphf_alloc(data, data);
+		}
+	}
+
+	error(1, 0, "error building the perfect hash of %u strings", size);
+	return NULL;
+}
+
+mphf_t* mphf_init_mapped(const void* data, size_t size_of_data) {
+
+	if(data==NULL || size_of_data < sizeof(mphf_meta_t) || ((uintptr_t)data & (sizeof(uint64_t) - 1))!=0) {
+		return NULL;
+	}
+
+	const mphf_meta_t* meta = data;
+	if(meta->table_size < meta->size
+			|| (meta->size > 0 && (meta->buckets==0 || meta->dense_buckets==0 || meta->dense_buckets > meta->buckets))
+			|| data_size(meta)!=size_of_data) {
+		return NULL;
+	}
+
+	mphf_t* mphf = mphf_alloc(NULL, data);
+
+	uint32_t index;
+	for(index=0; index<meta->table_size - meta->size; index++) {
+		if(mphf->remap[index] >= meta->size) {
+			mphf_free(mphf);
+			return NULL;
+		}
+	}
+
+	return mphf;
+}
+
+void mphf_free(mphf_t* mphf) {
+
+	free(mphf->owned);
+	free(mphf);
+}
+
+uint32_t mphf_get(const mphf_t* mphf, const char* key) {
+
+	const mphf_meta_t* meta = mphf->meta;
+	if(meta->size==0) {
+		return MPHF_NONE;
+	}
+
+	uint64_t hash = key_hash(meta, key);
+	uint32_t position = key_position(meta, hash, mphf->pilots[key_bucket(meta, hash)]);
+
+	return position < meta->size ? position : mphf->remap[position - meta->size];
+}
+
+uint32_t mphf_size(const mphf_t* mphf) {
+	return mphf->meta->size;
+}
+
+const void* mphf_data(const mphf_t* mphf, size_t* size_of_data) {
+
+	*size_of_data = mphf->data_size;
+
+	return mphf->meta;
+}
@@ -0,0 +1,84 @@
+/* Copyright (C) 2011 Fantayeneh Asres Gizaw, Filippo De Luca
+ *
+ * This file is part of libWURFL.
+ *
+ * libWURFL is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * any later version.
+ *
+ * libWURFL is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with libWURFL.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/* Written by Filippo De Luca <me@filippodeluca.com>.  */
+
+#ifndef MPHF_H_
+#define MPHF_H_
+
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+/**
+ * The position returned by the empty perfect hash.
+ */
+#define MPHF_NONE UINT32_MAX
+
+/**
+ * The mphf_t type.
+ *
+ * It is a minimal perfect hash of a set of strings known in advance: it
+ * maps each of the n strings to a different position in [0, n), with one
+ * probe and about 3.5 bits per string. The strings are not stored, a string
+ * not in the set gets some position too: the caller compares it with the
+ * string at that position.
+ *
+ * It is built as PTHash does: the strings are split in buckets, and every
+ * bucket gets the pilot value moving all its strings to free positions.
+ * The whole hash is a single memory block, it can be written to a file and
+ * mapped back as it is.
+ */
+typedef struct _mphf_t mphf_t;
+
+/**
+ * Build the perfect hash of the given strings. The build is deterministic,
+ * the same strings get the same positions in every process.
+ *
+ * @param keys The strings, they must be different.
+ * @param size The number of strings.
+ */
+mphf_t* mphf_init(const char* const* keys, uint32_t size);
+
+/**
+ * Map a perfect hash written from mphf_data. Nothing is copied, the data
+ * must outlive the hash.
+ *
+ * @return the perfect hash or NULL if the data is not a valid one.
+ */
+mphf_t* mphf_init_mapped(const void* data, size_t data_size);
+
+void mphf_free(mphf_t* mphf);
+
+/**
+ * @return the position of the key, MPHF_NONE if the set is empty.
+ */
+uint32_t mphf_get(const mphf_t* mphf, const char* key);
+
+/**
+ * @return the number of strings.
+ */
+uint32_t mphf_size(const mphf_t* mphf);
+
+/**
+ * @param data_size It is set to the block size.
+ * @return the memory block of the hash, to be mapped by mphf_init_mapped.
+ */
+const void* mphf_data(const mphf_t* mphf, size_t* data_size);
+
+#endif /* MPHF_H_ */
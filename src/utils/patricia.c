@@ -32,144 +32,744 @@
 #include <errno.h>
 #include <stdio.h>
 
-typedef struct _patricia_node_t patricia_node_t;
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
 
-struct _patricia_node_t {
-	int32_t msd;
+/**
+ * The entry of the empty key, it is not iterated: it has no byte to
+ * branch on.
+ */
+#define PATRICIA_EMPTY 0
+
+/**
+ * A link to an entry has this bit set, a link to a node has not.
+ */
+#define PATRICIA_LEAF 0x80000000u
 
-	void *key;
-	void *value;
+#define PATRICIA_NONE UINT32_MAX
 
-	patricia_node_t *left;
-	patricia_node_t *right;
-};
+#define PATRICIA_INIT_CAPACITY 64
+
+/**
+ * The labels or the key bytes matched at once, the wider nodes have a
+ * multiple of labels.
+ */
+#define PATRICIA_GROUP_SIZE 16
+
+/**
+ * The nodes an iteration stacks before allocating, a node per byte the keys
+ * branch at.
+ */
+#define PATRICIA_STACK_SIZE 64
+
+/**
+ * The keys sorted by insertion rather than split by a word.
+ */
+#define PATRICIA_SORT_SMALL 16
+
+/**
+ * The keys a pass over them loads ahead, they are scattered in memory.
+ */
+#define PATRICIA_PREFETCH 8
+
+/**
+ * The parts of a frozen trie start at a cache line.
+ */
+#define PATRICIA_ALIGN 64
+
+/*
+ * It is a crit-bit trie branching on whole bytes. A node links the keys
+ * sharing their first byte bytes, one link per value of the next byte,
+ * sorted by it. A key ending there is linked by its terminator, so the
+ * prefixes need no special case.
+ *
+ * The links of a node are a range of the edges pool: the labels apart
+ * from the links, so the labels of a wide node are matched a group at
+ * once. A node outgrowing its range moves it to the end of the pool.
+ */
+typedef struct {
+	uint32_t byte;
+	uint32_t edges;
+	uint16_t size;
+	uint16_t capacity;
+} patricia_node_t;
+
+/**
+ * A node being iterated and the position of its next link.
+ */
+typedef struct {
+	uint32_t node;
+	uint32_t position;
+} patricia_frame_t;
+
+/*
+ * The memory block of a frozen trie: the meta, the nodes in depth first
+ * order, the labels and the links of each one, the offsets of the keys and
+ * the indexes of the values, then the keys. The entries are numbered in key
+ * order, so the entries below a link are a range; the empty key one is the
+ * first.
+ */
+typedef struct {
+	uint32_t root;
+	uint32_t nodes_size;
+	uint32_t edges_size;
+	uint32_t size;
+	uint32_t key_bytes_size;
+} patricia_meta_t;
 
 struct _patricia_t {
-	patricia_node_t *root;
+	uint32_t root;
+
+	patricia_node_t* nodes;
+	uint32_t nodes_size;
+	uint32_t nodes_capacity;
+
+	uint8_t* labels;
+	uint32_t* links;
+	uint32_t edges_size;
+	uint32_t edges_capacity;
+
+	// The entries, with their key lengths
+	const char** keys;
+	uint32_t* lengths;
+	const void** values;
+	uint32_t size;
+	uint32_t capacity;
+
 	coll_duper_f* key_dupe;
 	coll_unduper_f* key_undupe;
 	void* key_dupe_xtra;
+
+	// The frozen block, NULL until the trie is frozen. The nodes, labels
+	// and links are in it, the keys and values are not used.
+	const patricia_meta_t* meta;
+	// NULL if the block is mapped
+	void* owned;
+	const uint32_t* key_offsets;
+	const char* key_bytes;
+	const uint32_t* value_indexes;
+	const void* const* value_array;
 };
 
 extern int errno;
 
-static bool key_eq(const void *key, const void *other) {
+/**
+ * @return the capacity of a pool holding the needed items, doubled as many
+ * times as it takes.
+ */
+static uint32_t pool_capacity(uint32_t capacity, uint32_t needed) {
+
+	if(capacity==0) {
+		capacity = PATRICIA_INIT_CAPACITY;
+	}
+	while(capacity < needed) {
+		if(capacity > UINT32_MAX / 4) {
+			error(1, 0, "trie is full, it needs %u items", needed);
+		}
+		capacity *= 2;
+	}
 
-	const char* chkey = key;
-	const char* chother = other;
+	return capacity;
+}
+
+static void* pool_resize(void* pool, size_t item_size, uint32_t capacity) {
 
-	if((chkey == NULL || strlen(chkey)==0) && (chother == NULL || strlen(chother)==0)){
-		return true;
+	pool = realloc(pool, item_size * capacity);
+	if(pool==NULL) {
+		error(1, errno, "error allocating trie pool");
 	}
-	else if(chkey ==NULL || strlen(chkey)==0 || chother == NULL || strlen(chother)==0) {
-		return false;
+
+	return pool;
+}
+
+static size_t frozen_align(size_t offset) {
+	return (offset + PATRICIA_ALIGN - 1) & ~(size_t)(PATRICIA_ALIGN - 1);
+}
+
+static size_t nodes_offset() {
+	return frozen_align(sizeof(patricia_meta_t));
+}
+
+static size_t labels_offset(const patricia_meta_t* meta) {
+	return frozen_align(nodes_offset() + sizeof(patricia_node_t) * meta->nodes_size);
+}
+
+static size_t links_offset(const patricia_meta_t* meta) {
+	return frozen_align(labels_offset(meta) + sizeof(uint8_t) * meta->edges_size);
+}
+
+static size_t key_offsets_offset(const patricia_meta_t* meta) {
+	return frozen_align(links_offset(meta) + sizeof(uint32_t) * meta->edges_size);
+}
+
+static size_t value_indexes_offset(const patricia_meta_t* meta) {
+	return frozen_align(key_offsets_offset(meta) + sizeof(uint32_t) * ((size_t)meta->size + 1));
+}
+
+static size_t key_bytes_offset(const patricia_meta_t* meta) {
+	return frozen_align(value_indexes_offset(meta) + sizeof(uint32_t) * meta->size);
+}
+
+static size_t data_size(const patricia_meta_t* meta) {
+	return key_bytes_offset(meta) + meta->key_bytes_size;
+}
+
+/**
+ * @return the links a frozen node has room for: its own, as many groups of
+ * them as it takes if it is a wide one.
+ */
+static uint16_t frozen_capacity(uint16_t size) {
+	return size < PATRICIA_GROUP_SIZE ? size : (size + PATRICIA_GROUP_SIZE - 1) & ~(PATRICIA_GROUP_SIZE - 1);
+}
+
+static inline const char* entry_key(const patricia_t* trie, uint32_t entry) {
+	return trie->meta!=NULL ? trie->key_bytes + trie->key_offsets[entry] : trie->keys[entry];
+}
+
+static inline uint32_t entry_length(const patricia_t* trie, uint32_t entry) {
+	return trie->meta!=NULL ? trie->key_offsets[entry + 1] - trie->key_offsets[entry] - 1 : trie->lengths[entry];
+}
+
+static inline void* entry_value(const patricia_t* trie, uint32_t entry) {
+
+	if(trie->meta!=NULL) {
+		uint32_t index = trie->value_indexes[entry];
+		return index!=PATRICIA_NONE ? (void*)trie->value_array[index] : NULL;
 	}
-	else {
-		return strcmp(chkey, chother) == 0;
+
+	return (void*)trie->values[entry];
+}
+
+static inline uint8_t key_byte(const char* key, uint32_t length, uint32_t byte) {
+	return byte < length ? (uint8_t)key[byte] : 0;
+}
+
+/**
+ * @return the bytes shared by the keys, the length plus one if they are
+ * equal.
+ */
+static uint32_t key_shared(const char* key, uint32_t length, const char* other, uint32_t other_length) {
+
+	uint32_t shortest = length < other_length ? length : other_length;
+
+	uint32_t byte = 0;
+
+#ifdef __SSE2__
+	while(byte + PATRICIA_GROUP_SIZE <= shortest) {
+		__m128i block = _mm_loadu_si128((const __m128i*)(key + byte));
+		__m128i other_block = _mm_loadu_si128((const __m128i*)(other + byte));
+		uint32_t equals = _mm_movemask_epi8(_mm_cmpeq_epi8(block, other_block));
+		if(equals!=0xFFFF) {
+			return byte + __builtin_ctz(~equals);
+		}
+		byte += PATRICIA_GROUP_SIZE;
 	}
+#endif
+
+	while(byte < shortest && key[byte]==other[byte]) {
+		byte++;
+	}
+
+	return byte==shortest && length==other_length ? length + 1 : byte;
 }
 
-static bool key_isset(const void *key, int32_t index) {
+/**
+ * @return the position of the label in the node, or its size if it has no
+ * such label.
+ */
+static inline uint32_t node_find(const patricia_t* trie, const patricia_node_t* node, uint8_t label) {
 
-	const char* strkey = (char*)key;
+	const uint8_t* labels = trie->labels + node->edges;
+	uint32_t position = 0;
 
-	if(strkey == NULL) {
-		return false;
+#ifdef __SSE2__
+	// The wide nodes capacity is a multiple of the group
+	__m128i needle = _mm_set1_epi8((char)label);
+	for(; position + PATRICIA_GROUP_SIZE <= node->capacity && position < node->size; position += PATRICIA_GROUP_SIZE) {
+		__m128i group = _mm_loadu_si128((const __m128i*)(labels + position));
+		uint32_t matches = _mm_movemask_epi8(_mm_cmpeq_epi8(group, needle));
+		if(matches) {
+			position += __builtin_ctz(matches);
+			return position < node->size ? position : node->size;
+		}
 	}
-	else if(index >= strlen(strkey) * CHAR_BIT) {
-		return false;
+#endif
+
+	for(; position < node->size; position++) {
+		if(labels[position]==label) {
+			return position;
+		}
 	}
-	else {
-		char mask = 1;
 
-		int byte = index / CHAR_BIT;
-		int offset = index % CHAR_BIT;
+	return node->size;
+}
+
+/**
+ * @return the low bits shared by the bytes, the bit-wise trie tested them
+ * first.
+ */
+static inline uint32_t label_shared(uint8_t label, uint8_t other) {
 
-		mask = mask << offset;
+	uint32_t diff = label ^ other;
 
-		return strkey[byte] & mask;
+	return diff!=0 ? __builtin_ctz(diff) : CHAR_BIT;
+}
+
+/**
+ * @return true if one of the labels is equal to the given bits in the bits
+ * of the mask.
+ */
+static inline bool labels_have_bits(const uint8_t* labels, uint32_t size, uint8_t mask, uint8_t bits) {
+
+	uint32_t position;
+	for(position=0; position<size; position++) {
+		if((labels[position] & mask)==bits) {
+			return true;
+		}
 	}
+
+	return false;
 }
 
-static patricia_node_t* node_alloc(patricia_t* trie, const void *key, const void *value, int32_t msd) {
+/**
+ * @return the label a bit-wise trie of the given labels would reach, testing
+ * the low bits first: the bits of the label where the labels branch, their
+ * common bits elsewhere. The zero label is one of them if zero is set.
+ */
+static uint8_t labels_nearest(const uint8_t* labels, uint32_t size, bool zero, uint8_t label) {
 
-	// Allocate the node
-	patricia_node_t* node = malloc(sizeof(patricia_node_t));
-	if(node==NULL) {
-		error(1, errno, "error allocating new trie node");
+	uint8_t mask = 0;
+	uint8_t bits = 0;
+	uint32_t bit;
+	for(bit=0; bit<CHAR_BIT; bit++) {
+		mask |= 1u << bit;
+		bits |= label & (1u << bit);
+		if(!(zero && bits==0) && !labels_have_bits(labels, size, mask, bits)) {
+			bits ^= 1u << bit;
+		}
 	}
 
-	node->key = trie->key_dupe(key, trie->key_dupe_xtra);
-	node->value = value;
-	node->msd = msd;
+	return bits;
+}
+
+/**
+ * @return the position of the label a bit-wise trie of the node labels
+ * would reach.
+ */
+static uint32_t node_nearest(const patricia_t* trie, const patricia_node_t* node, uint8_t label) {
+	return node_find(trie, node, labels_nearest(trie->labels + node->edges, node->size, false, label));
+}
 
-	node->left = NULL;
-	node->right = NULL;
+/**
+ * Follow the key bytes down to an entry, the nearest link of a node
+ * without the key byte. The entry shares the most bytes with the key,
+ * among all, the node linking it is put in parent.
+ */
+static uint32_t entry_search(const patricia_t* trie, const char* key, uint32_t length, uint32_t* parent) {
 
-	return node;
+	uint32_t current = trie->root;
+	*parent = PATRICIA_NONE;
+
+	while(!(current & PATRICIA_LEAF)) {
+		const patricia_node_t* node = trie->nodes + current;
+		uint8_t label = key_byte(key, length, node->byte);
+
+		uint32_t position = node_find(trie, node, label);
+		if(position==node->size) {
+			position = node_nearest(trie, node, label);
+		}
+		*parent = current;
+		current = trie->links[node->edges + position];
+	}
+
+	return current & ~PATRICIA_LEAF;
+}
+
+/**
+ * Follow the key bytes down to the first link whose keys share the given
+ * bytes with the key.
+ *
+ * @return the position of the link in the edges pool, PATRICIA_NONE for
+ * the root one.
+ */
+static uint32_t link_search(const patricia_t* trie, const char* key, uint32_t length, uint32_t shared) {
+
+	uint32_t link = PATRICIA_NONE;
+	uint32_t current = trie->root;
+
+	while(!(current & PATRICIA_LEAF) && trie->nodes[current].byte < shared) {
+		const patricia_node_t* node = trie->nodes + current;
+
+		uint32_t position = node_find(trie, node, key_byte(key, length, node->byte));
+		assert(position < node->size);
+		link = node->edges + position;
+		current = trie->links[link];
+	}
+
+	return link;
 }
 
-static void node_free(patricia_t* trie, patricia_node_t* node) {
-	free(node);
+static uint32_t entry_alloc(patricia_t* trie, const char* key, uint32_t length, const void* value) {
+
+	if(trie->size==trie->capacity) {
+		if(trie->size >= PATRICIA_LEAF) {
+			error(1, 0, "trie is full, it holds %u keys", trie->size);
+		}
+		trie->capacity = pool_capacity(trie->capacity, trie->size + 1);
+		trie->keys = pool_resize(trie->keys, sizeof(char*), trie->capacity);
+		trie->lengths = pool_resize(trie->lengths, sizeof(uint32_t), trie->capacity);
+		trie->values = pool_resize(trie->values, sizeof(void*), trie->capacity);
+	}
+
+	uint32_t entry = trie->size++;
+	trie->keys[entry] = key!=NULL ? trie->key_dupe(key, trie->key_dupe_xtra) : NULL;
+	trie->lengths[entry] = length;
+	trie->values[entry] = value;
+
+	return entry;
 }
 
-static bool node_foreach(patricia_node_t* current, int32_t msd, coll_functor_f* functor, void* functor_data) {
+/**
+ * Replace the key and the value of the entry.
+ */
+static void entry_set(patricia_t* trie, uint32_t entry, const char* key, const void* value) {
 
-	if(current->msd <= msd) {
-		return false;
+	if(trie->keys[entry]!=NULL) {
+		trie->key_undupe((void*)trie->keys[entry], trie->key_dupe_xtra);
 	}
-	else {
-		void* keyValue[2];
-		keyValue[0] = current->key;
-		keyValue[1] = current->value;
-		bool finished = functor(keyValue, functor_data);
-		finished = finished || node_foreach(current->left, current->msd, functor, functor_data);
-		finished = finished || node_foreach(current->right, current->msd, functor, functor_data);
-		return finished;
+	trie->keys[entry] = key!=NULL ? trie->key_dupe(key, trie->key_dupe_xtra) : NULL;
+	trie->values[entry] = value;
+}
+
+static uint32_t edges_alloc(patricia_t* trie, uint32_t capacity) {
+
+	if(trie->edges_size + capacity > trie->edges_capacity) {
+		trie->edges_capacity = pool_capacity(trie->edges_capacity, trie->edges_size + capacity);
+		trie->labels = pool_resize(trie->labels, sizeof(uint8_t), trie->edges_capacity);
+		trie->links = pool_resize(trie->links, sizeof(uint32_t), trie->edges_capacity);
 	}
+
+	uint32_t edges = trie->edges_size;
+	trie->edges_size += capacity;
+
+	return edges;
 }
 
-void node_destroy(patricia_t* trie, patricia_node_t* current, int32_t msd, coll_unduper_f* undupe, void* undupe_data) {
+static uint32_t node_alloc(patricia_t* trie, uint32_t byte) {
 
-	if(current->msd < msd) {
-		node_destroy(trie, current->left, current->msd, undupe, undupe_data);
-		node_destroy(trie, current->right, current->msd, undupe, undupe_data);
-		node_free(trie, current);
+	if(trie->nodes_size==trie->nodes_capacity) {
+		trie->nodes_capacity = pool_capacity(trie->nodes_capacity, trie->nodes_size + 1);
+		trie->nodes = pool_resize(trie->nodes, sizeof(patricia_node_t), trie->nodes_capacity);
 	}
+
+	uint32_t edges = edges_alloc(trie, 2);
+
+	uint32_t node = trie->nodes_size++;
+	trie->nodes[node].byte = byte;
+	trie->nodes[node].edges = edges;
+	trie->nodes[node].size = 0;
+	trie->nodes[node].capacity = 2;
+
+	return node;
 }
 
-static patricia_node_t* node_search(patricia_node_t* current, const void* key, int32_t msd) {
+/**
+ * Link the node to the given link, keeping the labels sorted.
+ */
+static void node_link(patricia_t* trie, uint32_t current, uint8_t label, uint32_t link) {
+
+	patricia_node_t* node = trie->nodes + current;
+
+	if(node->size==node->capacity) {
+		// The moved ranges are never reused, they are at most the pool half
+		uint16_t capacity = node->capacity * 2;
+		uint32_t edges = edges_alloc(trie, capacity);
+		node = trie->nodes + current;
+
+		memcpy(trie->labels + edges, trie->labels + node->edges, sizeof(uint8_t) * node->size);
+		memcpy(trie->links + edges, trie->links + node->edges, sizeof(uint32_t) * node->size);
+		node->edges = edges;
+		node->capacity = capacity;
+	}
+
+	uint8_t* labels = trie->labels + node->edges;
+	uint32_t* links = trie->links + node->edges;
+
+	uint32_t position = node->size;
+	while(position > 0 && labels[position - 1] > label) {
+		labels[position] = labels[position - 1];
+		links[position] = links[position - 1];
+		position--;
+	}
 
-    if (current->msd <= msd) {
-    	// this is an uplink
-    	return current;
-    }
-    else {
-    	patricia_node_t* next_node = key_isset(key, current->msd)?current->right:current->left;
-    	return  node_search(next_node, key, current->msd);
-    }
+	labels[position] = label;
+	links[position] = link;
+	node->size++;
 }
 
-static patricia_node_t* node_put(patricia_node_t* node, patricia_node_t* start, patricia_node_t* parent) {
+/**
+ * Visit an entry while iterating, it returns true to stop.
+ */
+typedef bool (entry_visit_f)(const patricia_t* trie, uint32_t entry, void* data);
+
+/**
+ * Grow the stack of an iteration, it starts as the local one.
+ */
+static patricia_frame_t* stack_grow(patricia_frame_t* stack, const patricia_frame_t* local, uint32_t* capacity) {
+
+	uint32_t size = *capacity;
+	*capacity *= 2;
 
-	// We have overpass the node or this is the last node
-	if(start->msd >= node->msd  || start->msd <= parent->msd) {
-		node->left = key_isset(node->key, node->msd)?start:node;
-		node->right = key_isset(node->key, node->msd)?node:start;
-		return node;
+	if(stack==local) {
+		stack = malloc(sizeof(patricia_frame_t) * *capacity);
+		if(stack!=NULL) {
+			memcpy(stack, local, sizeof(patricia_frame_t) * size);
+		}
 	}
 	else {
-		if(!key_isset(node->key, start->msd)) {
-			start->left = node_put(node, start->left, start);
+		stack = realloc(stack, sizeof(patricia_frame_t) * *capacity);
+	}
+	if(stack==NULL) {
+		error(1, errno, "error allocating trie stack");
+	}
+
+	return stack;
+}
+
+/**
+ * @return the entry the link leads to by its first links, or by its last
+ * ones.
+ */
+static uint32_t link_entry(const patricia_t* trie, uint32_t link, bool last) {
+
+	while(!(link & PATRICIA_LEAF)) {
+		const patricia_node_t* node = trie->nodes + link;
+		link = trie->links[node->edges + (last ? node->size - 1 : 0)];
+	}
+
+	return link & ~PATRICIA_LEAF;
+}
+
+/**
+ * Iterate the entries below the link in key order, a node at a time from
+ * an explicit stack: the deep tries do not use the call stack. The entries
+ * of a frozen trie are a range, between the first and the last one.
+ */
+static bool link_foreach(const patricia_t* trie, uint32_t link, entry_visit_f* visit, void* visit_data) {
+
+	if(trie->meta!=NULL) {
+		uint32_t last = link_entry(trie, link, true);
+		uint32_t entry;
+		for(entry=link_entry(trie, link, false); entry<=last; entry++) {
+			if(visit(trie, entry, visit_data)) {
+				return true;
+			}
+		}
+		return false;
+	}
+
+	if(link & PATRICIA_LEAF) {
+		return visit(trie, link & ~PATRICIA_LEAF, visit_data);
+	}
+
+	patricia_frame_t local[PATRICIA_STACK_SIZE];
+	patricia_frame_t* stack = local;
+	uint32_t capacity = PATRICIA_STACK_SIZE;
+
+	uint32_t size = 1;
+	stack[0].node = link;
+	stack[0].position = 0;
+
+	bool finished = false;
+	while(size > 0 && !finished) {
+		patricia_frame_t* top = stack + size - 1;
+		const patricia_node_t* node = trie->nodes + top->node;
+
+		if(top->position==node->size) {
+			size--;
+			continue;
+		}
+
+		uint32_t next = trie->links[node->edges + top->position++];
+		if(next & PATRICIA_LEAF) {
+			finished = visit(trie, next & ~PATRICIA_LEAF, visit_data);
 		}
 		else {
-			start->right = node_put(node, start->right, start);
+			if(size==capacity) {
+				stack = stack_grow(stack, local, &capacity);
+			}
+			stack[size].node = next;
+			stack[size].position = 0;
+			size++;
 		}
-		return start;
 	}
+
+	if(stack!=local) {
+		free(stack);
+	}
+
+	return finished;
 }
 
-patricia_t* patricia_init(coll_duper_f* key_dupe, coll_unduper_f* key_undupe, void* key_dupe_xtra) {
+/**
+ * Iterate the link with the given label, one of the node, and the ones a
+ * bit-wise trie of the node labels would branch off it last: its deepest
+ * crit-bit is the most low bits another label shares with it, the labels
+ * below share at least as many. The zero label, if set, has no link.
+ */
+static bool node_nearest_foreach(const patricia_t* trie, const patricia_node_t* node, bool zero, uint8_t label, entry_visit_f* visit, void* visit_data) {
+
+	const uint8_t* labels = trie->labels + node->edges;
+
+	uint32_t most = zero && label!=0 ? label_shared(0, label) : 0;
+	uint32_t position;
+	for(position=0; position<node->size; position++) {
+		uint32_t shared = label_shared(labels[position], label);
+		if(labels[position]!=label && shared > most) {
+			most = shared;
+		}
+	}
+
+	bool finished = false;
+	for(position=0; position<node->size && !finished; position++) {
+		if(label_shared(labels[position], label) >= most) {
+			finished = link_foreach(trie, trie->links[node->edges + position], visit, visit_data);
+		}
+	}
+
+	return finished;
+}
+
+/**
+ * The empty key is linked by no node, it has no byte to branch on, but a
+ * bit-wise trie holds it as the key of zero bits, branching off the others
+ * at their first byte.
+ *
+ * @return true if a bit-wise trie would reach the empty key searching the
+ * given one, a key whose first byte is no label of the first byte.
+ */
+static bool empty_nearest(const patricia_t* trie, const char* key, uint32_t length) {
+
+	uint8_t label = key_byte(key, length, 0);
+
+	if(!(trie->root & PATRICIA_LEAF) && trie->nodes[trie->root].byte==0) {
+		const patricia_node_t* node = trie->nodes + trie->root;
+		return node_find(trie, node, label)==node->size && labels_nearest(trie->labels + node->edges, node->size, true, label)==0;
+	}
+
+	// The keys share their first byte
+	uint32_t entry = link_entry(trie, trie->root, false);
+	uint8_t first = key_byte(entry_key(trie, entry), entry_length(trie, entry), 0);
+
+	return label!=first && labels_nearest(&first, 1, true, label)==0;
+}
+
+/**
+ * Iterate the entries nearest to the key: the nearest one and the ones a
+ * bit-wise trie branches off it last.
+ */
+static bool search_foreach(const patricia_t* trie, const char* key, uint32_t length, entry_visit_f* visit, void* visit_data) {
+
+	if(trie->root==PATRICIA_NONE) {
+		return false;
+	}
+
+	// The empty key branches off the whole trie
+	uint32_t parent = PATRICIA_NONE;
+	uint32_t nearest = PATRICIA_EMPTY;
+	if(!empty_nearest(trie, key, length)) {
+		nearest = entry_search(trie, key, length, &parent);
+	}
+	if(nearest==PATRICIA_EMPTY || parent==PATRICIA_NONE) {
+		return link_foreach(trie, trie->root, visit, visit_data);
+	}
+
+	// The node at the first byte is the one holding the empty key too
+	const patricia_node_t* node = trie->nodes + parent;
+	uint8_t label = key_byte(entry_key(trie, nearest), entry_length(trie, nearest), node->byte);
+
+	return node_nearest_foreach(trie, node, node->byte==0, label, visit, visit_data);
+}
+
+typedef struct {
+	coll_functor_f* functor;
+	void* functor_data;
+} functor_visit_data_t;
+
+static bool functor_visit(const patricia_t* trie, uint32_t entry, void* data) {
+	functor_visit_data_t* visit_data = (functor_visit_data_t*)data;
+
+	void* keyValue[2];
+	keyValue[0] = (void*)entry_key(trie, entry);
+	keyValue[1] = entry_value(trie, entry);
+
+	return visit_data->functor(keyValue, visit_data->functor_data);
+}
+
+typedef struct {
+	const char* key;
+	uint32_t length;
+	uint32_t min_length;
+	uint32_t max_length;
+	// The nearest entries so far, the nearest first
+	patricia_entry_t* entries;
+	uint32_t size;
+	uint32_t capacity;
+} nearest_visit_data_t;
+
+/**
+ * @return true if the entry ranks before the other one: it shares more
+ * bytes with the key, or as many with a nearer length.
+ */
+static bool entry_nearer(const patricia_entry_t* entry, const patricia_entry_t* other, uint32_t length) {
+
+	if(entry->shared!=other->shared) {
+		return entry->shared > other->shared;
+	}
+
+	uint32_t difference = entry->length > length ? entry->length - length : length - entry->length;
+	uint32_t other_difference = other->length > length ? other->length - length : length - other->length;
+
+	return difference < other_difference;
+}
+
+static bool nearest_visit(const patricia_t* trie, uint32_t entry, void* data) {
+	nearest_visit_data_t* visit_data = (nearest_visit_data_t*)data;
+
+	uint32_t length = entry_length(trie, entry);
+	if(length < visit_data->min_length || length > visit_data->max_length) {
+		return false;
+	}
+
+	patricia_entry_t candidate;
+	candidate.key = entry_key(trie, entry);
+	candidate.value = entry_value(trie, entry);
+	candidate.length = length;
+	candidate.shared = key_shared(visit_data->key, visit_data->length, candidate.key, length);
+
+	// After the ones ranking the same, they came first
+	patricia_entry_t* entries = visit_data->entries;
+	uint32_t position = visit_data->size;
+	while(position > 0 && entry_nearer(&candidate, entries + position - 1, visit_data->length)) {
+		position--;
+	}
+
+	if(position < visit_data->capacity) {
+		if(visit_data->size < visit_data->capacity) {
+			visit_data->size++;
+		}
+		memmove(entries + position + 1, entries + position, sizeof(patricia_entry_t) * (visit_data->size - position - 1));
+		entries[position] = candidate;
+	}
+
+	return false;
+}
+
+/**
+ * @return a trie without entries, not even the empty key one.
+ */
+static patricia_t* trie_alloc(coll_duper_f* key_dupe, coll_unduper_f* key_undupe, void* key_dupe_xtra) {
 
 	patricia_t* trie = malloc(sizeof(patricia_t));
 	if(!trie) {
@@ -186,60 +786,704 @@ patricia_t* patricia_init(coll_duper_f* key_dupe, coll_unduper_f* key_undupe, vo
 		trie->key_undupe = &coll_nop_unduper;
 	}
 
-	trie->root = node_alloc(trie, NULL, NULL, -1);
-	trie->root->left = trie->root;
+	trie->root = PATRICIA_NONE;
+
+	trie->nodes = NULL;
+	trie->nodes_size = 0;
+	trie->nodes_capacity = 0;
+	trie->labels = NULL;
+	trie->links = NULL;
+	trie->edges_size = 0;
+	trie->edges_capacity = 0;
+	trie->keys = NULL;
+	trie->lengths = NULL;
+	trie->values = NULL;
+	trie->size = 0;
+	trie->capacity = 0;
+
+	trie->meta = NULL;
+	trie->owned = NULL;
+	trie->key_offsets = NULL;
+	trie->key_bytes = NULL;
+	trie->value_indexes = NULL;
+	trie->value_array = NULL;
 
 	return trie;
 }
 
+patricia_t* patricia_init(coll_duper_f* key_dupe, coll_unduper_f* key_undupe, void* key_dupe_xtra) {
+
+	patricia_t* trie = trie_alloc(key_dupe, key_undupe, key_dupe_xtra);
+
+	// The empty key entry holds nothing until the empty key is put
+	entry_alloc(trie, NULL, 0, NULL);
+
+	return trie;
+}
+
+typedef struct {
+	const char* key;
+	uint32_t length;
+	// The position in the given keys
+	uint32_t index;
+	// The key bytes being sorted on, the first one in the high byte
+	uint64_t bytes;
+} patricia_sorted_t;
+
+static int sorted_index_cmp(const void* litem, const void* ritem) {
+	const patricia_sorted_t* lsorted = (const patricia_sorted_t*)litem;
+	const patricia_sorted_t* rsorted = (const patricia_sorted_t*)ritem;
+
+	return lsorted->index < rsorted->index ? -1 : lsorted->index > rsorted->index;
+}
+
+/**
+ * @return the key bytes from the given one, as many as fit a word, so the
+ * words compare as the bytes do. The bytes past the key end are 0.
+ */
+static inline uint64_t sorted_bytes(const patricia_sorted_t* sorted, uint32_t byte) {
+
+	uint64_t bytes = 0;
+
+	if(byte + sizeof(uint64_t) <= sorted->length) {
+		memcpy(&bytes, sorted->key + byte, sizeof(uint64_t));
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__==__ORDER_LITTLE_ENDIAN__
+		bytes = __builtin_bswap64(bytes);
+#endif
+	}
+	else {
+		uint32_t position;
+		for(position=0; position<sizeof(uint64_t); position++) {
+			bytes = bytes << CHAR_BIT | key_byte(sorted->key, sorted->length, byte + position);
+		}
+	}
+
+	return bytes;
+}
+
+static inline void sorted_swap(patricia_sorted_t* sorted, uint32_t position, uint32_t other) {
+
+	patricia_sorted_t swapped = sorted[position];
+	sorted[position] = sorted[other];
+	sorted[other] = swapped;
+}
+
+/**
+ * @return the bytes shared by the words of key bytes.
+ */
+static inline uint32_t bytes_shared(uint64_t bytes, uint64_t other) {
+	return bytes!=other ? __builtin_clzll(bytes ^ other) / CHAR_BIT : sizeof(uint64_t);
+}
+
+/**
+ * Sort the keys sharing their first depth bytes, whose next bytes are
+ * loaded, the equal ones by their position. The bytes every key shares
+ * with the one before are put in shared, the sort knows them: the keys
+ * either side of a split share the bytes up to the split.
+ *
+ * It is a multikey quicksort on words: the keys are split by a word at a
+ * time, the shared words are not compared again.
+ */
+static void sorted_sort(patricia_sorted_t* sorted, uint32_t* shared, uint32_t size, uint32_t depth) {
+
+	while(size > 1) {
+		uint32_t position;
+
+		if(size < PATRICIA_SORT_SMALL) {
+			for(position=1; position<size; position++) {
+				patricia_sorted_t moved = sorted[position];
+
+				uint32_t other = position;
+				while(other > 0) {
+					int cmp = strcmp(sorted[other - 1].key + depth, moved.key + depth);
+					if(cmp < 0 || (cmp==0 && sorted[other - 1].index < moved.index)) {
+						break;
+					}
+					sorted[other] = sorted[other - 1];
+					other--;
+				}
+				sorted[other] = moved;
+			}
+
+			for(position=1; position<size; position++) {
+				const patricia_sorted_t* key = sorted + position;
+				const patricia_sorted_t* previous = key - 1;
+				shared[position] = depth + key_shared(previous->key + depth, previous->length - depth, key->key + depth, key->length - depth);
+			}
+			return;
+		}
+
+		const patricia_sorted_t* middle = sorted + size / 2;
+		uint64_t pivot = middle->bytes;
+		bool ended = middle->length < depth + sizeof(uint64_t);
+
+		// [0, less) < pivot, [less, position) == pivot, [greater, size) > pivot
+		uint32_t less = 0;
+		uint32_t greater = size;
+		uint64_t less_max = 0;
+		uint64_t greater_min = UINT64_MAX;
+
+		position = 0;
+		while(position < greater) {
+			uint64_t bytes = sorted[position].bytes;
+			if(bytes < pivot) {
+				less_max = bytes > less_max ? bytes : less_max;
+				sorted_swap(sorted, less++, position++);
+			}
+			else if(bytes > pivot) {
+				greater_min = bytes < greater_min ? bytes : greater_min;
+				sorted_swap(sorted, position, --greater);
+			}
+			else {
+				position++;
+			}
+		}
+
+		if(less > 0) {
+			shared[less] = depth + bytes_shared(less_max, pivot);
+			sorted_sort(sorted, shared, less, depth);
+		}
+		if(greater < size) {
+			shared[greater] = depth + bytes_shared(pivot, greater_min);
+			sorted_sort(sorted + greater, shared + greater, size - greater, depth);
+		}
+
+		sorted += less;
+		shared += less;
+		size = greater - less;
+		if(ended) {
+			// The equal keys
+			qsort(sorted, size, sizeof(patricia_sorted_t), &sorted_index_cmp);
+			for(position=1; position<size; position++) {
+				shared[position] = sorted[position].length + 1;
+			}
+			return;
+		}
+
+		depth += sizeof(uint64_t);
+		for(position=0; position<size; position++) {
+			if(position + PATRICIA_PREFETCH < size) {
+				__builtin_prefetch(sorted[position + PATRICIA_PREFETCH].key + depth);
+			}
+			sorted[position].bytes = sorted_bytes(sorted + position, depth);
+		}
+	}
+}
+
+/**
+ * Link the subtree holding the given entry to the node, after its other
+ * links.
+ */
+static void stack_link(patricia_t* trie, uint32_t node, uint32_t pending, uint32_t key_entry) {
+	node_link(trie, node, key_byte(trie->keys[key_entry], trie->lengths[key_entry], trie->nodes[node].byte), pending);
+}
+
+patricia_t* patricia_init_bulk(const void* const* keys, const void* const* values, uint32_t size, coll_duper_f* key_dupe, coll_unduper_f* key_undupe, void* key_dupe_xtra) {
+
+	patricia_t* trie = patricia_init(key_dupe, key_undupe, key_dupe_xtra);
+
+	patricia_sorted_t* sorted = malloc(sizeof(patricia_sorted_t) * (size + 1));
+	uint32_t* shared = malloc(sizeof(uint32_t) * (size + 1));
+	if(sorted==NULL || shared==NULL) {
+		error(1, errno, "error allocating trie keys");
+	}
+
+	uint32_t sorted_size = 0;
+	uint32_t index;
+	for(index=0; index<size; index++) {
+		if(index + PATRICIA_PREFETCH < size && keys[index + PATRICIA_PREFETCH]!=NULL) {
+			__builtin_prefetch(keys[index + PATRICIA_PREFETCH]);
+		}
+
+		const char* key = keys[index];
+		if(key==NULL || key[0]=='\0') {
+			entry_set(trie, PATRICIA_EMPTY, key, values[index]);
+		}
+		else {
+			sorted[sorted_size].key = key;
+			sorted[sorted_size].length = strlen(key);
+			sorted[sorted_size].index = index;
+			sorted[sorted_size].bytes = sorted_bytes(sorted + sorted_size, 0);
+			sorted_size++;
+		}
+	}
+
+	// The equal keys stay in the given order, the last one is kept
+	sorted_sort(sorted, shared, sorted_size, 0);
+
+	// The keys branch at most once less than they are
+	trie->capacity = pool_capacity(trie->capacity, sorted_size + 1);
+	trie->keys = pool_resize(trie->keys, sizeof(char*), trie->capacity);
+	trie->lengths = pool_resize(trie->lengths, sizeof(uint32_t), trie->capacity);
+	trie->values = pool_resize(trie->values, sizeof(void*), trie->capacity);
+	trie->nodes_capacity = pool_capacity(trie->nodes_capacity, sorted_size);
+	trie->nodes = pool_resize(trie->nodes, sizeof(patricia_node_t), trie->nodes_capacity);
+
+	// The nodes whose last link is still to come, deeper ones on the top
+	uint32_t* stack = NULL;
+	uint32_t stack_size = 0;
+	uint32_t stack_capacity = 0;
+
+	// The last subtree, it is linked when the next key leaves it
+	uint32_t pending = PATRICIA_NONE;
+	uint32_t previous = PATRICIA_NONE;
+	// The bytes shared with the previous key, the skipped ones included
+	uint32_t branch = UINT32_MAX;
+
+	for(index=0; index<sorted_size; index++) {
+		const patricia_sorted_t* key = sorted + index;
+		if(index + PATRICIA_PREFETCH < sorted_size) {
+			__builtin_prefetch(sorted[index + PATRICIA_PREFETCH].key);
+		}
+
+		if(index > 0 && shared[index] < branch) {
+			branch = shared[index];
+		}
+
+		if(index + 1 < sorted_size && shared[index + 1] > key->length) {
+			// Put and replaced, as patricia_put would do
+			trie->key_undupe(trie->key_dupe(key->key, trie->key_dupe_xtra), trie->key_dupe_xtra);
+			continue;
+		}
+
+		uint32_t entry = entry_alloc(trie, key->key, key->length, values[key->index]);
+
+		if(previous!=PATRICIA_NONE) {
+			// The keys branch at the first byte they do not share
+			while(stack_size > 0 && trie->nodes[stack[stack_size - 1]].byte > branch) {
+				uint32_t node = stack[--stack_size];
+				stack_link(trie, node, pending, previous);
+				pending = node;
+			}
+
+			if(stack_size > 0 && trie->nodes[stack[stack_size - 1]].byte==branch) {
+				stack_link(trie, stack[stack_size - 1], pending, previous);
+			}
+			else {
+				uint32_t node = node_alloc(trie, branch);
+				stack_link(trie, node, pending, previous);
+
+				if(stack_size==stack_capacity) {
+					stack_capacity = pool_capacity(stack_capacity, stack_size + 1);
+					stack = pool_resize(stack, sizeof(uint32_t), stack_capacity);
+				}
+				stack[stack_size++] = node;
+			}
+		}
+
+		pending = entry | PATRICIA_LEAF;
+		previous = entry;
+		branch = UINT32_MAX;
+	}
+
+	while(stack_size > 0) {
+		uint32_t node = stack[--stack_size];
+		stack_link(trie, node, pending, previous);
+		pending = node;
+	}
+	trie->root = pending;
+
+	free(stack);
+	free(shared);
+	free(sorted);
+
+	return trie;
+}
+
+/**
+ * Point the trie to a frozen block, the values array is not checked.
+ */
+static void frozen_map(patricia_t* trie, const void* data, void* owned, const void* const* values) {
+
+	const patricia_meta_t* meta = data;
+
+	trie->meta = meta;
+	trie->owned = owned;
+	trie->root = meta->root;
+
+	trie->nodes = (patricia_node_t*)((const char*)data + nodes_offset());
+	trie->nodes_size = meta->nodes_size;
+	trie->nodes_capacity = 0;
+	trie->labels = (uint8_t*)((const char*)data + labels_offset(meta));
+	trie->links = (uint32_t*)((const char*)data + links_offset(meta));
+	trie->edges_size = meta->edges_size;
+	trie->edges_capacity = 0;
+
+	trie->keys = NULL;
+	trie->lengths = NULL;
+	trie->values = NULL;
+	trie->size = meta->size;
+	trie->capacity = 0;
+
+	trie->key_offsets = (const uint32_t*)((const char*)data + key_offsets_offset(meta));
+	trie->key_bytes = (const char*)data + key_bytes_offset(meta);
+	trie->value_indexes = (const uint32_t*)((const char*)data + value_indexes_offset(meta));
+	trie->value_array = values;
+}
+
+/**
+ * @return the link in a frozen trie, from the new numbers of the nodes and
+ * of the entries.
+ */
+static inline uint32_t frozen_link(uint32_t link, const uint32_t* node_ids, const uint32_t* entry_ids) {
+	return link & PATRICIA_LEAF ? entry_ids[link & ~PATRICIA_LEAF] | PATRICIA_LEAF : node_ids[link];
+}
+
+void patricia_freeze(patricia_t* trie, patricia_index_f* value_index, const void* const* values) {
+
+	if(trie->meta!=NULL) {
+		error(1, 0, "trie is already frozen");
+	}
+
+	// The nodes and the entries by their new number, and the other way round
+	uint32_t* node_ids = malloc(sizeof(uint32_t) * (trie->nodes_size + 1));
+	uint32_t* node_order = malloc(sizeof(uint32_t) * (trie->nodes_size + 1));
+	uint32_t* entry_ids = malloc(sizeof(uint32_t) * trie->size);
+	uint32_t* entry_order = malloc(sizeof(uint32_t) * trie->size);
+	if(node_ids==NULL || node_order==NULL || entry_ids==NULL || entry_order==NULL) {
+		error(1, errno, "error allocating frozen trie");
+	}
+
+	patricia_meta_t meta;
+	memset(&meta, 0, sizeof(meta));
+	meta.size = 1;
+	meta.key_bytes_size = 1;
+	entry_ids[PATRICIA_EMPTY] = PATRICIA_EMPTY;
+	entry_order[PATRICIA_EMPTY] = PATRICIA_EMPTY;
+
+	// The nodes are numbered before their links, the entries as they come
+	patricia_frame_t local[PATRICIA_STACK_SIZE];
+	patricia_frame_t* stack = local;
+	uint32_t capacity = PATRICIA_STACK_SIZE;
+	uint32_t size = 0;
+
+	uint32_t next = trie->root;
+	while(next!=PATRICIA_NONE) {
+		if(next & PATRICIA_LEAF) {
+			uint32_t entry = next & ~PATRICIA_LEAF;
+			entry_ids[entry] = meta.size;
+			entry_order[meta.size++] = entry;
+			meta.key_bytes_size += trie->lengths[entry] + 1;
+		}
+		else {
+			if(size==capacity) {
+				stack = stack_grow(stack, local, &capacity);
+			}
+			stack[size].node = next;
+			stack[size].position = 0;
+			size++;
+
+			node_ids[next] = meta.nodes_size;
+			node_order[meta.nodes_size++] = next;
+			meta.edges_size += frozen_capacity(trie->nodes[next].size);
+		}
+
+		next = PATRICIA_NONE;
+		while(size > 0 && next==PATRICIA_NONE) {
+			patricia_frame_t* top = stack + size - 1;
+			const patricia_node_t* node = trie->nodes + top->node;
+			if(top->position==node->size) {
+				size--;
+			}
+			else {
+				next = trie->links[node->edges + top->position++];
+			}
+		}
+	}
+
+	if(stack!=local) {
+		free(stack);
+	}
+
+	size_t block_size = data_size(&meta);
+	void* data = NULL;
+	int result = posix_memalign(&data, PATRICIA_ALIGN, block_size);
+	if(result!=0) {
+		error(1, result, "error allocating frozen trie");
+	}
+	memset(data, 0, block_size);
+	memcpy(data, &meta, sizeof(meta));
+
+	patricia_node_t* nodes = (patricia_node_t*)((char*)data + nodes_offset());
+	uint8_t* labels = (uint8_t*)((char*)data + labels_offset(&meta));
+	uint32_t* links = (uint32_t*)((char*)data + links_offset(&meta));
+	uint32_t* key_offsets = (uint32_t*)((char*)data + key_offsets_offset(&meta));
+	uint32_t* value_indexes = (uint32_t*)((char*)data + value_indexes_offset(&meta));
+	char* key_bytes = (char*)data + key_bytes_offset(&meta);
+
+	uint32_t edges = 0;
+	uint32_t id;
+	for(id=0; id<meta.nodes_size; id++) {
+		const patricia_node_t* node = trie->nodes + node_order[id];
+
+		nodes[id].byte = node->byte;
+		nodes[id].edges = edges;
+		nodes[id].size = node->size;
+		nodes[id].capacity = frozen_capacity(node->size);
+
+		uint32_t position;
+		for(position=0; position<node->size; position++) {
+			labels[edges + position] = trie->labels[node->edges + position];
+			links[edges + position] = frozen_link(trie->links[node->edges + position], node_ids, entry_ids);
+		}
+		edges += nodes[id].capacity;
+	}
+
+	uint32_t offset = 0;
+	for(id=0; id<meta.size; id++) {
+		uint32_t entry = entry_order[id];
+
+		key_offsets[id] = offset;
+		if(trie->keys[entry]!=NULL) {
+			memcpy(key_bytes + offset, trie->keys[entry], trie->lengths[entry]);
+		}
+		offset += trie->lengths[entry] + 1;
+
+		value_indexes[id] = trie->values[entry]!=NULL ? value_index(trie->values[entry]) : PATRICIA_NONE;
+	}
+	key_offsets[meta.size] = offset;
+
+	((patricia_meta_t*)data)->root = trie->root!=PATRICIA_NONE ? frozen_link(trie->root, node_ids, entry_ids) : PATRICIA_NONE;
+
+	free(entry_order);
+	free(entry_ids);
+	free(node_order);
+	free(node_ids);
+
+	uint32_t entry;
+	for(entry=0; entry<trie->size; entry++) {
+		if(trie->keys[entry]!=NULL) {
+			trie->key_undupe((void*)trie->keys[entry], trie->key_dupe_xtra);
+		}
+	}
+	free(trie->nodes);
+	free(trie->labels);
+	free(trie->links);
+	free(trie->keys);
+	free(trie->lengths);
+	free(trie->values);
+
+	frozen_map(trie, data, data, values);
+}
+
+patricia_t* patricia_init_mapped(const void* data, size_t size_of_data, const void* const* values, uint32_t values_size) {
+
+	if(data==NULL || size_of_data < sizeof(patricia_meta_t) || ((uintptr_t)data & (sizeof(uint32_t) - 1))!=0) {
+		return NULL;
+	}
+
+	const patricia_meta_t* meta = data;
+	if(meta->size==0 || meta->size >= PATRICIA_LEAF || meta->nodes_size >= PATRICIA_LEAF || data_size(meta)!=size_of_data) {
+		return NULL;
+	}
+
+	patricia_t* trie = trie_alloc(NULL, NULL, NULL);
+	frozen_map(trie, data, NULL, values);
+
+	// Every link goes down to a later node or to an entry, the searches end
+	bool valid = true;
+	uint32_t root = meta->root;
+	if(root==PATRICIA_NONE) {
+		valid = meta->size==1;
+	}
+	else if(root & PATRICIA_LEAF) {
+		valid = (root & ~PATRICIA_LEAF)!=PATRICIA_EMPTY && (root & ~PATRICIA_LEAF) < meta->size;
+	}
+	else {
+		valid = root < meta->nodes_size;
+	}
+
+	uint32_t id;
+	for(id=0; valid && id<meta->nodes_size; id++) {
+		const patricia_node_t* node = trie->nodes + id;
+		valid = node->size > 0 && node->size <= node->capacity && (uint64_t)node->edges + node->capacity <= meta->edges_size;
+
+		uint32_t position;
+		for(position=0; valid && position<node->size; position++) {
+			uint32_t link = trie->links[node->edges + position];
+			if(link & PATRICIA_LEAF) {
+				valid = (link & ~PATRICIA_LEAF)!=PATRICIA_EMPTY && (link & ~PATRICIA_LEAF) < meta->size;
+			}
+			else {
+				valid = link > id && link < meta->nodes_size;
+			}
+		}
+	}
+
+	uint32_t entry;
+	for(entry=0; valid && entry<meta->size; entry++) {
+		uint32_t offset = trie->key_offsets[entry + 1];
+		valid = offset > trie->key_offsets[entry] && offset <= meta->key_bytes_size && trie->key_bytes[offset - 1]=='\0'
+				&& (trie->value_indexes[entry]==PATRICIA_NONE || trie->value_indexes[entry] < values_size);
+	}
+	valid = valid && trie->key_offsets[0]==0 && trie->key_offsets[meta->size]==meta->key_bytes_size;
+
+	if(!valid) {
+		patricia_free(trie, NULL, NULL);
+		return NULL;
+	}
+
+	return trie;
+}
+
+const void* patricia_data(const patricia_t* trie, size_t* size_of_data) {
+
+	*size_of_data = trie->meta!=NULL ? data_size(trie->meta) : 0;
+
+	return trie->meta;
+}
+
 void patricia_free(patricia_t* trie, coll_unduper_f undupe, void* undupe_data) {
-	node_destroy(trie, trie->root->left, -1, undupe, undupe_data);
-	node_free(trie, trie->root);
+
+	uint32_t entry;
+	for(entry=0; entry<trie->size; entry++) {
+		if(trie->meta==NULL && trie->keys[entry]!=NULL) {
+			trie->key_undupe((void*)trie->keys[entry], trie->key_dupe_xtra);
+		}
+		if(undupe!=NULL && entry_value(trie, entry)!=NULL) {
+			undupe(entry_value(trie, entry), undupe_data);
+		}
+	}
+
+	if(trie->meta!=NULL) {
+		free(trie->owned);
+	}
+	else {
+		free(trie->nodes);
+		free(trie->labels);
+		free(trie->links);
+		free(trie->keys);
+		free(trie->lengths);
+		free(trie->values);
+	}
 	free(trie);
 }
 
 void patricia_put(patricia_t* trie, const void* key, const void* value) {
 
-	patricia_node_t* nearest = node_search(trie->root->left, key, -1);
+	if(trie->meta!=NULL) {
+		error(1, 0, "trie is frozen, it cannot be changed");
+	}
+
+	const char* strkey = key;
+	uint32_t length = strkey!=NULL ? strlen(strkey) : 0;
 
-	if(key_eq(key, nearest->key)) {
-		nearest->key = key;
-		nearest->value = value;
+	if(length==0) {
+		entry_set(trie, PATRICIA_EMPTY, strkey, value);
+	}
+	else if(trie->root==PATRICIA_NONE) {
+		trie->root = entry_alloc(trie, strkey, length, value) | PATRICIA_LEAF;
 	}
 	else {
-		int32_t msd = 0;
-		while(key_isset(key, msd)==key_isset(nearest->key, msd)) msd++;
+		uint32_t parent;
+		uint32_t nearest = entry_search(trie, strkey, length, &parent);
+		uint32_t shared = key_shared(strkey, length, trie->keys[nearest], trie->lengths[nearest]);
 
-		patricia_node_t* new_node = node_alloc(trie, key, value, msd);
-		trie->root->left = node_put(new_node, trie->root->left, trie->root);
+		if(shared > length) {
+			entry_set(trie, nearest, strkey, value);
+		}
+		else {
+			uint32_t leaf = entry_alloc(trie, strkey, length, value) | PATRICIA_LEAF;
+			uint32_t link = link_search(trie, strkey, length, shared);
+			uint32_t current = link!=PATRICIA_NONE ? trie->links[link] : trie->root;
+
+			if(!(current & PATRICIA_LEAF) && trie->nodes[current].byte==shared) {
+				node_link(trie, current, key_byte(strkey, length, shared), leaf);
+			}
+			else {
+				// The keys below current share more bytes, split them off
+				uint32_t node = node_alloc(trie, shared);
+				node_link(trie, node, key_byte(trie->keys[nearest], trie->lengths[nearest], shared), current);
+				node_link(trie, node, key_byte(strkey, length, shared), leaf);
+
+				if(link!=PATRICIA_NONE) {
+					trie->links[link] = node;
+				}
+				else {
+					trie->root = node;
+				}
+			}
+		}
 	}
 }
 
 void* patricia_get(patricia_t* trie, const void* key) {
-	patricia_node_t* nearest = node_search(trie->root->left, key, -1);
-    if (!key_eq(nearest->key, key)) {
-        return NULL;
-    }
-    else {
-    	return nearest->value;
-    }
+
+	const char* strkey = key;
+	uint32_t length = strkey!=NULL ? strlen(strkey) : 0;
+
+	uint32_t entry = PATRICIA_EMPTY;
+	if(length > 0) {
+		if(trie->root==PATRICIA_NONE) {
+			return NULL;
+		}
+
+		uint32_t parent;
+		entry = entry_search(trie, strkey, length, &parent);
+		if(key_shared(strkey, length, entry_key(trie, entry), entry_length(trie, entry)) <= length) {
+			return NULL;
+		}
+	}
+
+	return entry_value(trie, entry);
 }
 
 void* patricia_search(patricia_t* trie, const void* key) {
-	patricia_node_t* nearest = node_search(trie->root->left, key, -1);
-    return nearest->value;
+
+	const char* strkey = key;
+	uint32_t length = strkey!=NULL ? strlen(strkey) : 0;
+
+	if(length==0 || trie->root==PATRICIA_NONE || empty_nearest(trie, strkey, length)) {
+		return entry_value(trie, PATRICIA_EMPTY);
+	}
+
+	uint32_t parent;
+	return entry_value(trie, entry_search(trie, strkey, length, &parent));
 }
 
 bool patricia_foreach(patricia_t* trie, coll_functor_f* functor, void* functor_data) {
-	return node_foreach(trie->root->left, -1, functor, functor_data);
+
+	if(trie->root==PATRICIA_NONE) {
+		return false;
+	}
+
+	functor_visit_data_t visit_data;
+	visit_data.functor = functor;
+	visit_data.functor_data = functor_data;
+
+	return link_foreach(trie, trie->root, &functor_visit, &visit_data);
 }
 
 bool patricia_search_foreach(patricia_t* trie, const void* key, coll_functor_f* functor, void* functor_data) {
-	patricia_node_t* nearest = node_search(trie->root->left, key, -1);
-	return node_foreach(nearest, -1, functor, functor_data);
+
+	const char* strkey = key;
+	uint32_t length = strkey!=NULL ? strlen(strkey) : 0;
+
+	functor_visit_data_t visit_data;
+	visit_data.functor = functor;
+	visit_data.functor_data = functor_data;
+
+	return search_foreach(trie, strkey, length, &functor_visit, &visit_data);
 }
 
+uint32_t patricia_search_nearest(patricia_t* trie, const void* key, uint32_t min_length, uint32_t max_length, patricia_entry_t* entries, uint32_t size) {
 
+	assert(entries!=NULL || size==0);
 
+	const char* strkey = key;
 
+	nearest_visit_data_t visit_data;
+	visit_data.key = strkey;
+	visit_data.length = strkey!=NULL ? strlen(strkey) : 0;
+	visit_data.min_length = min_length;
+	visit_data.max_length = max_length;
+	visit_data.entries = entries;
+	visit_data.size = 0;
+	visit_data.capacity = size;
 
+	if(size > 0) {
+		search_foreach(trie, strkey, visit_data.length, &nearest_visit, &visit_data);
+	}
+
+	return visit_data.size;
+}
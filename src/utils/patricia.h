@@ -29,18 +29,89 @@
 
 typedef struct _patricia_t patricia_t;
 
+/**
+ * An entry found by patricia_search_nearest.
+ */
+typedef struct {
+	const void* key;
+	void* value;
+	uint32_t length;
+	// The bytes shared with the searched key, its length plus one if they
+	// are equal
+	uint32_t shared;
+} patricia_entry_t;
+
+/**
+ * @return the index of the value in the values array of a frozen trie.
+ */
+typedef uint32_t (patricia_index_f)(const void* value);
+
 patricia_t* patricia_init(coll_duper_f* key_dupe, coll_unduper_f* key_undupe, void* dupe_xtra);
 
+/**
+ * Build the trie of the given keys and values at once: the keys are sorted,
+ * and the nodes are made in a pass over them, where the adjacent keys
+ * branch. It is the trie the puts of the keys in the given order make.
+ */
+patricia_t* patricia_init_bulk(const void* const* keys, const void* const* values, uint32_t size, coll_duper_f* key_dupe, coll_unduper_f* key_undupe, void* dupe_xtra);
+
+/**
+ * Map a trie frozen by patricia_freeze from the block of patricia_data.
+ * Nothing is copied, the data and the values must outlive the trie.
+ *
+ * @return the trie or NULL if the data is not a valid one.
+ */
+patricia_t* patricia_init_mapped(const void* data, size_t data_size, const void* const* values, uint32_t values_size);
+
 void patricia_free(patricia_t* trie, coll_unduper_f* undupe, void* undupe_data);
 
+/**
+ * Lay the trie out again in a single read only memory block: the nodes in
+ * depth first order with their exact links, then the entries in key order,
+ * so the ones below a node are a range. The keys are copied in the block and
+ * undupe'd, each value is replaced by its index in the given array, which
+ * must outlive the trie. The trie gives the same results, it cannot be put
+ * anymore.
+ */
+void patricia_freeze(patricia_t* trie, patricia_index_f* value_index, const void* const* values);
+
+/**
+ * @param data_size It is set to the block size.
+ * @return the memory block of a frozen trie, to be mapped by
+ * patricia_init_mapped, or NULL if the trie is not frozen.
+ */
+const void* patricia_data(const patricia_t* trie, size_t* data_size);
+
 void patricia_put(patricia_t* trie, const void* key, const void* value);
 
 void* patricia_get(patricia_t* trie, const void* key);
 
+/**
+ * @return the value of the key a bit-wise trie of the keys reaches searching
+ * the given one: the key bytes are followed while the trie has them, then
+ * the bits of the labels, low bits first. The empty key is the key of zero
+ * bits.
+ */
 void* patricia_search(patricia_t* trie, const void* key);
 
 bool patricia_foreach(patricia_t* trie, coll_functor_f* functor, void* functor_data);
 
+/**
+ * Iterate the nearest key, the one patricia_search reaches, and the keys a
+ * bit-wise trie of the keys branches off its path last; all of them if the
+ * nearest key is the empty one. They depend on the keys only, not on the
+ * order they were put in.
+ */
 bool patricia_search_foreach(patricia_t* trie, const void* key, coll_functor_f* functor, void* functor_data);
 
+/**
+ * Put in entries the nearest of the keys patricia_search_foreach iterates,
+ * the ones with a length in [min_length, max_length]. They are ranked by the
+ * bytes they share with the key, then by their length difference, then by
+ * key; only the first size of them are put, however many keys there are.
+ *
+ * @return the number of entries put.
+ */
+uint32_t patricia_search_nearest(patricia_t* trie, const void* key, uint32_t min_length, uint32_t max_length, patricia_entry_t* entries, uint32_t size);
+
 #endif /* PATRICIA_H_ */
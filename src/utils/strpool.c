@@ -0,0 +1,274 @@
+/* Copyright (C) 2011 Fantayeneh Asres Gizaw, Filippo De Luca
+ *
+ * This file is part of libWURFL.
+ *
+ * libWURFL is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * any later version.
+ *
+ * libWURFL is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with libWURFL.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/* Written by Filippo De Luca <me@filippodeluca.com>.  */
+
+#include "strpool.h"
+
+#include "hashmap-define.h"
+#include "mphf.h"
+#include "error.h"
+
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <assert.h>
+#include <errno.h>
+
+#define STRPOOL_CHUNK_SIZE (64 * 1024)
+
+#define STRPOOL_INIT_CAPACITY 256
+
+extern int errno;
+
+static inline bool string_equals(const char* lstring, const char* rstring) {
+	return strcmp(lstring, rstring)==0;
+}
+
+// interned string -> id
+HASHMAP_DEFINE(strindex, const char*, uint32_t, string_hash, string_equals)
+
+typedef struct _strpool_chunk_t strpool_chunk_t;
+
+struct _strpool_chunk_t {
+	strpool_chunk_t* next;
+	size_t size;
+	size_t used;
+	char data[];
+};
+
+struct _strpool_t {
+	strpool_chunk_t* chunks;
+	const char** strings;
+	// string_hash of every string, NULL if the pool is not indexed
+	uint32_t* hashes;
+	uint32_t size;
+	uint32_t capacity;
+	// NULL if the pool is not indexed or it is frozen
+	strindex_t* index;
+	// A frozen pool finds the id of a string at ids[mphf_get()]
+	mphf_t* mphf;
+	const uint32_t* ids;
+	uint32_t* owned_ids;
+
+	// A mapped pool reads its strings at blob + offsets[id]
+	const char* blob;
+	const uint32_t* offsets;
+};
+
+static char* chunk_alloc(strpool_t* pool, size_t len) {
+
+	strpool_chunk_t* chunk = pool->chunks;
+
+	if(chunk==NULL || chunk->size - chunk->used < len) {
+		size_t size = len > STRPOOL_CHUNK_SIZE ? len : STRPOOL_CHUNK_SIZE;
+
+		chunk = malloc(sizeof(strpool_chunk_t) + size);
+		if(!chunk) {
+			error(1, errno, "error allocating string pool chunk");
+		}
+		chunk->size = size;
+		chunk->used = 0;
+		chunk->next = pool->chunks;
+		pool->chunks = chunk;
+	}
+
+	char* allocated = chunk->data + chunk->used;
+	chunk->used += len;
+
+	return allocated;
+}
+
+strpool_t* strpool_init() {
+
+	strpool_t* pool = malloc(sizeof(strpool_t));
+	if(!pool) {
+		error(1, errno, "error allocating string pool");
+	}
+
+	pool->chunks = NULL;
+	pool->blob = NULL;
+	pool->offsets = NULL;
+	pool->size = 0;
+	pool->capacity = STRPOOL_INIT_CAPACITY;
+	pool->strings = malloc(sizeof(char*) * pool->capacity);
+	pool->hashes = malloc(sizeof(uint32_t) * pool->capacity);
+	if(!pool->strings || !pool->hashes) {
+		error(1, errno, "error allocating string pool index");
+	}
+	pool->index = strindex_init(STRPOOL_INIT_CAPACITY);
+	pool->mphf = NULL;
+	pool->ids = NULL;
+	pool->owned_ids = NULL;
+
+	return pool;
+}
+
+strpool_t* strpool_init_mapped(const char* blob, const uint32_t* offsets, uint32_t size, mphf_t* mphf, const uint32_t* ids) {
+
+	strpool_t* pool = malloc(sizeof(strpool_t));
+	if(!pool) {
+		error(1, errno, "error allocating string pool");
+	}
+
+	pool->chunks = NULL;
+	pool->strings = NULL;
+	pool->hashes = NULL;
+	pool->size = size;
+	pool->capacity = size;
+	pool->blob = blob;
+	pool->offsets = offsets;
+	pool->index = NULL;
+	pool->mphf = mphf;
+	pool->ids = ids;
+	pool->owned_ids = NULL;
+
+	assert(mphf==NULL || mphf_size(mphf)==size);
+
+	return pool;
+}
+
+void strpool_free(strpool_t* pool) {
+
+	if(pool->index!=NULL) {
+		strindex_free(pool->index);
+	}
+	if(pool->mphf!=NULL) {
+		mphf_free(pool->mphf);
+	}
+
+	strpool_chunk_t* chunk = pool->chunks;
+	while(chunk!=NULL) {
+		strpool_chunk_t* next = chunk->next;
+		free(chunk);
+		chunk = next;
+	}
+
+	free(pool->strings);
+	free(pool->hashes);
+	free(pool->owned_ids);
+	free(pool);
+}
+
+uint32_t strpool_add(strpool_t* pool, const char* string) {
+
+	assert(string!=NULL);
+
+	return strpool_add_hashed(pool, string, string_hash(string));
+}
+
+uint32_t strpool_add_hashed(strpool_t* pool, const char* string, uint32_t hash) {
+
+	assert(string!=NULL);
+	assert(pool->index!=NULL);
+
+	const uint32_t* found = strindex_get_hashed(pool->index, string, hash);
+	if(found!=NULL) {
+		return *found;
+	}
+	else {
+
+		if(pool->size==pool->capacity) {
+			pool->capacity *= 2;
+			pool->strings = realloc(pool->strings, sizeof(char*) * pool->capacity);
+			pool->hashes = realloc(pool->hashes, sizeof(uint32_t) * pool->capacity);
+			if(!pool->strings || !pool->hashes) {
+				error(1, errno, "error growing string pool index");
+			}
+		}
+
+		size_t len = strlen(string) + 1;
+		char* interned = chunk_alloc(pool, len);
+		memcpy(interned, string, len);
+
+		uint32_t id = pool->size++;
+		pool->strings[id] = interned;
+		pool->hashes[id] = hash;
+
+		bool added;
+		*strindex_put_hashed(pool->index, interned, hash, &added) = id;
+
+		return id;
+	}
+}
+
+uint32_t strpool_id(const strpool_t* pool, const char* string) {
+
+	if(pool->mphf!=NULL) {
+		uint32_t position = mphf_get(pool->mphf, string);
+		if(position==MPHF_NONE) {
+			return STRPOOL_NONE;
+		}
+
+		// Every string has a position, only the interned one is there
+		uint32_t id = pool->ids[position];
+		return strcmp(strpool_get(pool, id), string)==0 ? id : STRPOOL_NONE;
+	}
+	else {
+		assert(pool->index!=NULL);
+
+		const uint32_t* found = strindex_get(pool->index, string);
+
+		return found!=NULL ? *found : STRPOOL_NONE;
+	}
+}
+
+void strpool_freeze(strpool_t* pool) {
+
+	assert(pool->index!=NULL);
+
+	pool->mphf = mphf_init(pool->strings, pool->size);
+	pool->owned_ids = malloc(sizeof(uint32_t) * (pool->size > 0 ? pool->size : 1));
+	if(!pool->owned_ids) {
+		error(1, errno, "error allocating string pool index");
+	}
+
+	uint32_t id;
+	for(id=0; id<pool->size; id++) {
+		pool->owned_ids[mphf_get(pool->mphf, pool->strings[id])] = id;
+	}
+	pool->ids = pool->owned_ids;
+
+	strindex_free(pool->index);
+	pool->index = NULL;
+}
+
+const mphf_t* strpool_mphf(const strpool_t* pool, const uint32_t** ids) {
+
+	*ids = pool->ids;
+
+	return pool->mphf;
+}
+
+const char* strpool_get(const strpool_t* pool, uint32_t id) {
+
+	assert(id < pool->size);
+
+	return pool->blob==NULL ? pool->strings[id] : pool->blob + pool->offsets[id];
+}
+
+uint32_t strpool_hash(const strpool_t* pool, uint32_t id) {
+
+	assert(id < pool->size);
+
+	return pool->hashes!=NULL ? pool->hashes[id] : string_hash(strpool_get(pool, id));
+}
+
+uint32_t strpool_size(const strpool_t* pool) {
+	return pool->size;
+}
@@ -0,0 +1,116 @@
+/* Copyright (C) 2011 Fantayeneh Asres Gizaw, Filippo De Luca
+ *
+ * This file is part of libWURFL.
+ *
+ * libWURFL is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * any later version.
+ *
+ * libWURFL is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with libWURFL.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/* Written by Filippo De Luca <me@filippodeluca.com>.  */
+
+#ifndef STRPOOL_H_
+#define STRPOOL_H_
+
+#include "utils.h"
+#include "mphf.h"
+
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+/**
+ * The id returned for a string not contained in the pool.
+ */
+#define STRPOOL_NONE UINT32_MAX
+
+/**
+ * The strpool_t type.
+ *
+ * It interns strings and gives each distinct string a dense id, starting
+ * from 0 in insertion order. The interned strings never move, so the
+ * pointers returned by strpool_get() are valid until strpool_free().
+ */
+typedef struct _strpool_t strpool_t;
+
+strpool_t* strpool_init();
+
+/**
+ * Create a read only pool over strings laid out by someone else, like a
+ * snapshot. Nothing is copied: the string id is at blob + offsets[id].
+ *
+ * @param blob The NUL terminated strings.
+ * @param offsets The offset of each string in the blob.
+ * @param size The number of strings.
+ * @param mphf The perfect hash of the strings, the pool frees it. If NULL,
+ *        strpool_id() can not be used on the pool.
+ * @param ids The id of the string at each perfect hash position.
+ */
+strpool_t* strpool_init_mapped(const char* blob, const uint32_t* offsets, uint32_t size, mphf_t* mphf, const uint32_t* ids);
+
+void strpool_free(strpool_t* pool);
+
+/**
+ * Intern a string.
+ *
+ * @param pool The pool to add the string to.
+ * @param string The string to intern, it is copied.
+ *
+ * @return the id of the interned string.
+ */
+uint32_t strpool_add(strpool_t* pool, const char* string);
+
+/**
+ * Intern a string already hashed, like one coming from another pool.
+ *
+ * @param pool The pool to add the string to.
+ * @param string The string to intern, it is copied.
+ * @param hash The string_hash of the string.
+ *
+ * @return the id of the interned string.
+ */
+uint32_t strpool_add_hashed(strpool_t* pool, const char* string, uint32_t hash);
+
+/**
+ * Find the id of a string.
+ *
+ * @return the id of the string or STRPOOL_NONE if it is not interned.
+ */
+uint32_t strpool_id(const strpool_t* pool, const char* string);
+
+/**
+ * Replace the pool index by a perfect hash of its strings: it takes less
+ * memory and strpool_id() probes it once. No string can be added after.
+ */
+void strpool_freeze(strpool_t* pool);
+
+/**
+ * Return the perfect hash of a frozen pool, NULL if it is not frozen.
+ *
+ * @param ids It is set to the id of the string at each position.
+ */
+const mphf_t* strpool_mphf(const strpool_t* pool, const uint32_t** ids);
+
+/**
+ * Return the interned string with the given id.
+ */
+const char* strpool_get(const strpool_t* pool, uint32_t id);
+
+/**
+ * Return the string_hash of the interned string with the given id. It is
+ * stored when the string is interned, so it is not computed again.
+ */
+uint32_t strpool_hash(const strpool_t* pool, uint32_t id);
+
+uint32_t strpool_size(const strpool_t* pool);
+
+#endif /* STRPOOL_H_ */
@@ -18,6 +18,8 @@
  
 /* Written by Filippo De Luca <me@filippodeluca.com>.  */
 
+#include <config.h>
+
 #include "utils.h"
 
 #include "error.h"
@@ -28,6 +30,19 @@
 #include <stdio.h>
 #include <stdbool.h>
 #include <errno.h>
+#include <fcntl.h>
+#include <time.h>
+#include <unistd.h>
+
+#ifdef HAVE_LIBPTHREAD
+#include <pthread.h>
+#endif
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+#define HIGH_BITS UINT64_C(0x8080808080808080)
 
 extern int errno;
 
@@ -47,15 +62,147 @@ void coll_default_unduper(void* item, const void* xtra) {
 
 // Primitive utility functions ********************************************
 
+/*
+ * The string hashing is the wyhash one (final version 4, by Wang Yi): it
+ * reads 8 bytes at time and mixes them by a 64x64->128 bits multiplication.
+ * The seed is random for every process, so who sends the user agents cannot
+ * build a set of strings colliding on the hash tables.
+ */
+
+#define HASH_SECRET0 UINT64_C(0xa0761d6478bd642f)
+#define HASH_SECRET1 UINT64_C(0xe7037ed1a0b428db)
+#define HASH_SECRET2 UINT64_C(0x8ebc6af09c88c6e3)
+#define HASH_SECRET3 UINT64_C(0x589965cc75374cc3)
+
+static inline void hash_mum(uint64_t* a, uint64_t* b) {
+#ifdef __SIZEOF_INT128__
+	__uint128_t r = (__uint128_t)*a * *b;
+	*a = (uint64_t)r;
+	*b = (uint64_t)(r >> 64);
+#else
+	uint64_t ha = *a >> 32, hb = *b >> 32, la = (uint32_t)*a, lb = (uint32_t)*b;
+	uint64_t rh = ha * hb, rm0 = ha * lb, rm1 = hb * la, rl = la * lb;
+	uint64_t t = rl + (rm0 << 32);
+	uint64_t c = t < rl;
+	uint64_t lo = t + (rm1 << 32);
+	c += lo < t;
+	*a = lo;
+	*b = rh + (rm0 >> 32) + (rm1 >> 32) + c;
+#endif
+}
+
+static inline uint64_t hash_mix(uint64_t a, uint64_t b) {
+	hash_mum(&a, &b);
+	return a ^ b;
+}
+
+static inline uint64_t hash_read64(const uint8_t* p) {
+	uint64_t v;
+	memcpy(&v, p, sizeof(v));
+	return v;
+}
+
+static inline uint64_t hash_read32(const uint8_t* p) {
+	uint32_t v;
+	memcpy(&v, p, sizeof(v));
+	return v;
+}
+
+uint64_t hash_bytes(const void* data, size_t size, uint64_t seed) {
+	const uint8_t* p = data;
+	uint64_t a, b;
+
+	seed ^= hash_mix(seed ^ HASH_SECRET0, HASH_SECRET1);
+
+	if(size <= 16) {
+		if(size >= 4) {
+			size_t shift = (size >> 3) << 2;
+			a = (hash_read32(p) << 32) | hash_read32(p + shift);
+			b = (hash_read32(p + size - 4) << 32) | hash_read32(p + size - 4 - shift);
+		}
+		else if(size > 0) {
+			a = ((uint64_t)p[0] << 16) | ((uint64_t)p[size >> 1] << 8) | p[size - 1];
+			b = 0;
+		}
+		else {
+			a = b = 0;
+		}
+	}
+	else {
+		size_t i = size;
+		if(i > 48) {
+			uint64_t seed1 = seed, seed2 = seed;
+			do {
+				seed = hash_mix(hash_read64(p) ^ HASH_SECRET1, hash_read64(p + 8) ^ seed);
+				seed1 = hash_mix(hash_read64(p + 16) ^ HASH_SECRET2, hash_read64(p + 24) ^ seed1);
+				seed2 = hash_mix(hash_read64(p + 32) ^ HASH_SECRET3, hash_read64(p + 40) ^ seed2);
+				p += 48;
+				i -= 48;
+			} while(i > 48);
+			seed ^= seed1 ^ seed2;
+		}
+		while(i > 16) {
+			seed = hash_mix(hash_read64(p) ^ HASH_SECRET1, hash_read64(p + 8) ^ seed);
+			p += 16;
+			i -= 16;
+		}
+		// The last 16 bytes, they may overlap the ones already mixed
+		a = hash_read64(p + i - 16);
+		b = hash_read64(p + i - 8);
+	}
+
+	a ^= HASH_SECRET1;
+	b ^= seed;
+	hash_mum(&a, &b);
+
+	return hash_mix(a ^ HASH_SECRET0 ^ size, b ^ HASH_SECRET1);
+}
+
+static uint64_t process_seed;
+
+static void hash_seed_init() {
+	uint64_t seed = 0;
+
+	int fd = open("/dev/urandom", O_RDONLY);
+	if(fd >= 0) {
+		if(read(fd, &seed, sizeof(seed)) != sizeof(seed)) {
+			seed = 0;
+		}
+		close(fd);
+	}
+
+	// Without urandom the seed is still different for every process
+	seed ^= hash_mix((uint64_t)time(NULL) ^ HASH_SECRET2, (uint64_t)getpid() ^ HASH_SECRET3);
+	seed ^= hash_mix((uint64_t)(uintptr_t)&seed, HASH_SECRET0);
+
+	process_seed = seed;
+}
+
+#ifdef HAVE_LIBPTHREAD
+static pthread_once_t process_seed_once = PTHREAD_ONCE_INIT;
+#else
+static bool process_seed_ready = false;
+#endif
+
+uint64_t hash_seed() {
+#ifdef HAVE_LIBPTHREAD
+	pthread_once(&process_seed_once, &hash_seed_init);
+#else
+	if(!process_seed_ready) {
+		hash_seed_init();
+		process_seed_ready = true;
+	}
+#endif
+
+	return process_seed;
+}
+
 uint32_t string_hash(const void* item) {
-   unsigned long h;
-   char* string = (char*)item;
+	const char* string = item;
+
+	uint64_t hash = hash_bytes(string, strlen(string), hash_seed());
 
-   h = 0;
-   while (*string) {
-      h = h * 37UL + (char) *string++;
-   }
-   return h;
+	return (uint32_t)(hash ^ (hash >> 32));
 }
 
 int string_cmp(const void* litem, const void *ritem) {
@@ -125,6 +272,39 @@ char* strrev(char* dst, const char* src) {
 	return dst;
 }
 
+bool string_is_ascii(const char* string, size_t len) {
+
+	const char* end = string + len;
+
+#ifdef __SSE2__
+	while(end - string >= 16) {
+		__m128i block = _mm_loadu_si128((const __m128i*)string);
+		if(_mm_movemask_epi8(block)!=0) {
+			return false;
+		}
+		string += 16;
+	}
+#endif
+
+	while(end - string >= 8) {
+		uint64_t block;
+		memcpy(&block, string, sizeof(block));
+		if((block & HIGH_BITS)!=0) {
+			return false;
+		}
+		string += 8;
+	}
+
+	while(string < end) {
+		if((unsigned char)*string & 0x80) {
+			return false;
+		}
+		string++;
+	}
+
+	return true;
+}
+
 /**
  * Robert Jenkins' 32 bit integer hash function
  */
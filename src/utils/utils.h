@@ -98,7 +98,26 @@ void coll_nop_unduper(void* item, const void* xtra);
 void coll_default_unduper(void* item, const void* xtra);
 
 /**
- * Calculate the hash for a string.
+ * Calculate the 64 bits hash of a memory block.
+ *
+ * @param data The memory block to calculate hash from.
+ * @param size The memory block size.
+ * @param seed The seed, different seeds give unrelated hashes.
+ * @return The hash of the block.
+ */
+uint64_t hash_bytes(const void* data, size_t size, uint64_t seed);
+
+/**
+ * Return the hashing seed of this process. It is chosen randomly the first
+ * time, so the hashes change from a process to another.
+ *
+ * @return The seed used by string_hash.
+ */
+uint64_t hash_seed();
+
+/**
+ * Calculate the hash for a string. The hash is seeded by hash_seed(), it
+ * is the same for the whole process life only.
  *
  * @param string The string to calculate hash from.
  * @return hashing code obtained from the given string
@@ -128,6 +147,15 @@ bool ref_eq(const void* litem, const void *ritem);
 
 char* strrev(char* dst, const char *src);
 
+/**
+ * Check if a string is 7-bit ASCII, 16 or 8 bytes at a time.
+ *
+ * @param string The string to check.
+ * @param len The string length.
+ * @return true if no byte has the high bit set.
+ */
+bool string_is_ascii(const char* string, size_t len);
+
 
 /* Written by Simon Josefsson. */
 
@@ -0,0 +1,232 @@
+/* Copyright (C) 2011 Fantayeneh Asres Gizaw, Filippo De Luca
+ *
+ * This file is part of libWURFL.
+ *
+ * libWURFL is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * any later version.
+ *
+ * libWURFL is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with libWURFL.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/* Written by Filippo De Luca <me@filippodeluca.com>.  */
+
+#include "virtualcap.h"
+
+#include "device.h"
+#include "capstore.h"
+#include "devicedef.h"
+#include "utils/strpool.h"
+
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+
+#define ROBOT_ROOT_ID "generic_web_crawler"
+
+typedef bool (*virtualcap_eval_f)(const capstore_t* store, const devicedef_t* devicedef);
+
+typedef bool (*virtualcap_user_agent_eval_f)(const char* user_agent);
+
+typedef struct {
+	const char* name;
+	uint64_t flag;
+	virtualcap_eval_f eval;
+	virtualcap_user_agent_eval_f user_agent_eval;
+} virtualcap_t;
+
+/*
+ * The capabilities the virtual capabilities are derived from.
+ */
+static const char* sources[] = {
+	"is_wireless_device",
+	"is_tablet",
+	"pointing_method",
+	"resolution_width",
+	"device_os",
+	"ux_full_desktop",
+	"is_bot",
+	NULL
+};
+
+static const char* smartphone_oses[] = {
+	"iOS",
+	"Android",
+	"Windows Phone OS",
+	"RIM OS",
+	"Symbian OS",
+	"webOS",
+	"MeeGo",
+	"Bada OS",
+	NULL
+};
+
+// Capability readers, a missing capability is false ********************
+
+static const char* cap_value(const capstore_t* store, const devicedef_t* devicedef, const char* name) {
+
+	uint32_t capability = capstore_capability(store, name);
+
+	return capability!=STRPOOL_NONE ? capstore_value(store, devicedef, capability) : NULL;
+}
+
+static bool cap_true(const capstore_t* store, const devicedef_t* devicedef, const char* name) {
+
+	bool value = false;
+	uint32_t capability = capstore_capability(store, name);
+
+	return capability!=STRPOOL_NONE && capstore_bool(store, devicedef, capability, &value) && value;
+}
+
+static bool cap_false(const capstore_t* store, const devicedef_t* devicedef, const char* name) {
+
+	bool value = true;
+	uint32_t capability = capstore_capability(store, name);
+
+	return capability!=STRPOOL_NONE && capstore_bool(store, devicedef, capability, &value) && !value;
+}
+
+static bool cap_equals(const capstore_t* store, const devicedef_t* devicedef, const char* name, const char* expected) {
+
+	const char* value = cap_value(store, devicedef, name);
+
+	return value!=NULL && strcmp(value, expected)==0;
+}
+
+static bool cap_int_at_least(const capstore_t* store, const devicedef_t* devicedef, const char* name, int32_t min) {
+
+	int32_t value = 0;
+	uint32_t capability = capstore_capability(store, name);
+
+	return capability!=STRPOOL_NONE && capstore_int(store, devicedef, capability, &value) && value >= min;
+}
+
+// Virtual capabilities **************************************************
+
+static bool is_mobile(const capstore_t* store, const devicedef_t* devicedef) {
+	return cap_true(store, devicedef, "is_wireless_device");
+}
+
+static bool is_tablet(const capstore_t* store, const devicedef_t* devicedef) {
+	return cap_true(store, devicedef, "is_tablet");
+}
+
+static bool is_touchscreen(const capstore_t* store, const devicedef_t* devicedef) {
+	return cap_equals(store, devicedef, "pointing_method", "touchscreen");
+}
+
+static bool is_smartphone(const capstore_t* store, const devicedef_t* devicedef) {
+
+	if(!is_mobile(store, devicedef) || !cap_false(store, devicedef, "is_tablet")
+			|| !is_touchscreen(store, devicedef)
+			|| !cap_int_at_least(store, devicedef, "resolution_width", 320)) {
+		return false;
+	}
+
+	const char* device_os = cap_value(store, devicedef, "device_os");
+	if(device_os!=NULL) {
+		const char** os = smartphone_oses;
+		while(*os) {
+			if(strcmp(device_os, *os)==0) {
+				return true;
+			}
+			os++;
+		}
+	}
+
+	return false;
+}
+
+static bool is_full_desktop(const capstore_t* store, const devicedef_t* devicedef) {
+	return cap_true(store, devicedef, "ux_full_desktop");
+}
+
+static bool is_robot(const capstore_t* store, const devicedef_t* devicedef) {
+
+	if(cap_true(store, devicedef, "is_bot")) {
+		return true;
+	}
+
+	const devicedef_t* ancestor = devicedef;
+	while(ancestor!=NULL) {
+		if(strcmp(ancestor->id, ROBOT_ROOT_ID)==0) {
+			return true;
+		}
+		ancestor = capstore_fall_back(store, ancestor);
+	}
+
+	return false;
+}
+
+/**
+ * The request User-Agent is not known here, so the device one is used: an
+ * Android WebView has the "; wv)" token, an iOS UIWebView has the Mobile/
+ * token but not the Safari/ one.
+ */
+static bool is_app_webview(const char* user_agent) {
+
+	if(user_agent==NULL) {
+		return false;
+	}
+
+	if(strstr(user_agent, "Android")!=NULL && strstr(user_agent, "; wv)")!=NULL) {
+		return true;
+	}
+
+	return (strstr(user_agent, "iPhone")!=NULL || strstr(user_agent, "iPad")!=NULL)
+			&& strstr(user_agent, "Mobile/")!=NULL
+			&& strstr(user_agent, "Safari/")==NULL;
+}
+
+static const virtualcap_t virtualcaps[] = {
+	{"is_mobile", DEVICE_VIRTUAL_IS_MOBILE, &is_mobile, NULL},
+	{"is_smartphone", DEVICE_VIRTUAL_IS_SMARTPHONE, &is_smartphone, NULL},
+	{"is_tablet", DEVICE_VIRTUAL_IS_TABLET, &is_tablet, NULL},
+	{"is_touchscreen", DEVICE_VIRTUAL_IS_TOUCHSCREEN, &is_touchscreen, NULL},
+	{"is_full_desktop", DEVICE_VIRTUAL_IS_FULL_DESKTOP, &is_full_desktop, NULL},
+	{"is_robot", DEVICE_VIRTUAL_IS_ROBOT, &is_robot, NULL},
+	{"is_app_webview", DEVICE_VIRTUAL_IS_APP_WEBVIEW, NULL, &is_app_webview},
+	{NULL, 0, NULL, NULL}
+};
+
+uint64_t virtualcap_eval(const capstore_t* store, const devicedef_t* devicedef) {
+
+	uint64_t flags = 0;
+
+	const virtualcap_t* virtualcap = virtualcaps;
+	while(virtualcap->name) {
+		bool value = virtualcap->eval!=NULL ? virtualcap->eval(store, devicedef) : virtualcap->user_agent_eval(devicedef->user_agent);
+		if(value) {
+			flags |= virtualcap->flag;
+		}
+		virtualcap++;
+	}
+
+	return flags;
+}
+
+uint64_t virtualcap_flag(const char* name) {
+
+	const virtualcap_t* virtualcap = virtualcaps;
+	while(virtualcap->name) {
+		if(strcmp(virtualcap->name, name)==0) {
+			return virtualcap->flag;
+		}
+		virtualcap++;
+	}
+
+	return 0;
+}
+
+const char** virtualcap_sources() {
+
+	return sources;
+}
@@ -0,0 +1,49 @@
+/* Copyright (C) 2011 Fantayeneh Asres Gizaw, Filippo De Luca
+ *
+ * This file is part of libWURFL.
+ *
+ * libWURFL is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * any later version.
+ *
+ * libWURFL is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with libWURFL.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/* Written by Filippo De Luca <me@filippodeluca.com>.  */
+
+#ifndef VIRTUALCAP_H_
+#define VIRTUALCAP_H_
+
+#include "capstore.h"
+#include "devicedef.h"
+
+#include <stdint.h>
+
+/**
+ * Evaluate every virtual capability of the device. It is called once per
+ * device, when the capstore_t is built.
+ *
+ * @return the DEVICE_VIRTUAL_* flags the device has.
+ */
+uint64_t virtualcap_eval(const capstore_t* store, const devicedef_t* devicedef);
+
+/**
+ * @return the DEVICE_VIRTUAL_* flag of the virtual capability with the given
+ *         name, 0 if there is no such virtual capability.
+ */
+uint64_t virtualcap_flag(const char* name);
+
+/**
+ * @return the NULL terminated array of the capabilities the virtual
+ *         capabilities are derived from.
+ */
+const char** virtualcap_sources();
+
+#endif /* VIRTUALCAP_H_ */
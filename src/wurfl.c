@@ -25,7 +25,13 @@
 #include "normalizer.h"
 #include "device-impl.h"
 #include "devicedef.h"
+#include "capstore.h"
+#include "virtualcap.h"
 #include "utils/utils.h"
+#include "utils/strpool.h"
+#include "utils/hashtable.h"
+#include "utils/arena.h"
+#include "snapshot.h"
 #include "utils/functors.h"
 #include "utils/error.h"
 
@@ -35,16 +41,61 @@
 #include <stdbool.h>
 #include <assert.h>
 #include <errno.h>
+#include <unistd.h>
+
+#include <config.h>
+
+#ifdef HAVE_LIBPTHREAD
+#include <pthread.h>
+#endif
 
 extern int errno;
 
+#define SNAPSHOT_NONE UINT32_MAX
+
+#define SNAPSHOT_ACTUAL_DEVICE_ROOT 0x01
+
+/**
+ * The fewest devices worth a normalizing thread.
+ */
+#define NORMALIZE_MIN_DEVICES 4096
+
+typedef struct {
+	// Offsets in the SNAPSHOT_DEVICE_STRINGS section, or SNAPSHOT_NONE
+	uint32_t id;
+	uint32_t user_agent;
+	uint32_t fall_back;
+	uint32_t flags;
+} snapshot_device_t;
+
 struct _wurfl_t {
+	// It owns the devices of the current generation
+	arena_t* arena;
+	// The mapped snapshot the wurfl was loaded from, or NULL
+	snapshot_t* snapshot;
 	hashmap_t* devices;
-	hashtable_t* capabilities;
+	strpool_t* capabilities;
+	hashtable_t* filter;
+	capstore_mode_t capstore_mode;
+	wurfl_parser_t parser;
+	int threads;
+	capstore_t* capstore;
 	matcher_t* matcher;
 	normalizer_t* normalizer;
 };
 
+typedef struct {
+	normalizer_t* normalizer;
+	// The normalized user agents are allocated here
+	arena_t* arena;
+} normalize_data_t;
+
+typedef struct {
+	resource_t* resource;
+	parser_data_t rdata;
+	normalize_data_t normalize;
+} patch_data_t;
+
 /* Hidden function in interface due to threadsafe */
 
 void wurfl_reload(wurfl_t* wurfl, const char* root, const char** patches);
@@ -58,38 +109,251 @@ static bool patch_device(const void* item, void* xtra);
 
 static bool normalize_device(const void* item, void* xtra);
 
+static bool release_capabilities(const void* item, void* xtra);
+
 static void free_device(void* item, const void* xtra);
 
-static void init_devices(wurfl_t* wurfl, const char* main_path);
+static void init_devices(wurfl_t* wurfl, resource_t* root);
+
+static void normalize_devices(wurfl_t* wurfl, hashmap_t* devices);
+
+static void init_patch(wurfl_t* wurfl, patch_data_t* patch, const char* path, bool shared);
+
+static void* parse_patch(void* xtra);
+
+static void apply_patch(wurfl_t* wurfl, patch_data_t* patch);
+
+static wurfl_t* init_resource(resource_t* root, const char** patch_paths, const wurfl_options_t* options);
+
+static hashtable_t* init_filter(const char** capabilities);
+
+static int processors();
 
 wurfl_t* wurfl_init(const char* main_path, const char** patch_paths) {
 
+	return wurfl_init_options(main_path, patch_paths, NULL);
+}
+
+wurfl_t* wurfl_init_options(const char* main_path, const char** patch_paths, const wurfl_options_t* options) {
+
+	resource_t* root = resource_open(main_path);
+	wurfl_t* wurfl = init_resource(root, patch_paths, options);
+	resource_close(root);
+
+	return wurfl;
+}
+
+wurfl_t* wurfl_init_mem(const void* root, size_t root_size, const char** patch_paths, const wurfl_options_t* options) {
+
+	resource_t* resource = resource_open_mem(root, root_size, "memory buffer");
+	wurfl_t* wurfl = init_resource(resource, patch_paths, options);
+	resource_close(resource);
+
+	return wurfl;
+}
+
+wurfl_t* wurfl_init_fd(int root, const char** patch_paths, const wurfl_options_t* options) {
+
+	resource_t* resource = resource_open_fd(root, "file descriptor");
+	wurfl_t* wurfl = init_resource(resource, patch_paths, options);
+	resource_close(resource);
+
+	return wurfl;
+}
+
+static wurfl_t* init_resource(resource_t* root, const char** patch_paths, const wurfl_options_t* options) {
+
 	wurfl_t* wurfl = malloc(sizeof(wurfl_t));
 	if(wurfl==NULL) {
 		error(1,errno,"error allocating memory to wurfl");
 	}
 
+	wurfl->filter = options!=NULL ? init_filter(options->capabilities) : NULL;
+	wurfl->capstore_mode = options!=NULL && options->capabilities_mode==WURFL_CAPABILITIES_LAZY ? CAPSTORE_LAZY : CAPSTORE_FLAT;
+	wurfl->parser = options!=NULL ? options->parser : WURFL_PARSER_AUTO;
+	wurfl->threads = options!=NULL && options->threads > 0 ? options->threads : processors();
 	wurfl->normalizer = normalizer_init();
+	wurfl->arena = arena_init();
+	wurfl->snapshot = NULL;
 	wurfl->devices = hashmap_init(&string_eq, &string_hash, NULL);
-	wurfl->capabilities = hashtable_init(&string_eq, &string_hash, NULL);
+	wurfl->capabilities = strpool_init();
 
 
-	init_devices(wurfl, main_path);
+	init_devices(wurfl, root);
 	wurfl_npatch(wurfl, patch_paths);
 
-	wurfl->matcher = matcher_init(wurfl->devices);
+	wurfl->capstore = capstore_init(wurfl->devices, wurfl->capabilities, wurfl->capstore_mode);
+	hashmap_foreach_value(wurfl->devices, &release_capabilities, NULL);
+	strpool_freeze(wurfl->capabilities);
+	wurfl->matcher = matcher_init(capstore_devices(wurfl->capstore), capstore_devices_size(wurfl->capstore));
 
-	fprintf(stdout, "wurfl initialized with %d devices and %d capabilities\n", hashmap_size(wurfl->devices), hashtable_size(wurfl->capabilities));
+	fprintf(stdout, "wurfl initialized with %d devices and %d capabilities\n", hashmap_size(wurfl->devices), strpool_size(wurfl->capabilities));
 
 	return wurfl;
 }
 
+wurfl_t* wurfl_init_snapshot(const char* path) {
+
+	wurfl_t* wurfl = malloc(sizeof(wurfl_t));
+	if(wurfl==NULL) {
+		error(1,errno,"error allocating memory to wurfl");
+	}
+
+	wurfl->filter = NULL;
+	wurfl->parser = WURFL_PARSER_AUTO;
+	wurfl->threads = processors();
+	wurfl->normalizer = normalizer_init();
+	wurfl->arena = arena_init();
+	wurfl->snapshot = snapshot_open(path);
+	wurfl->devices = hashmap_init(&string_eq, &string_hash, NULL);
+
+	size_t devices_size;
+	const snapshot_device_t* snapshot_devices = snapshot_section(wurfl->snapshot, SNAPSHOT_DEVICES, &devices_size);
+	if(devices_size % sizeof(snapshot_device_t)!=0) {
+		error(2, 0, "snapshot %s has a corrupted section %d", path, SNAPSHOT_DEVICES);
+	}
+	devices_size /= sizeof(snapshot_device_t);
+
+	size_t strings_size;
+	const char* strings = snapshot_section(wurfl->snapshot, SNAPSHOT_DEVICE_STRINGS, &strings_size);
+	if(devices_size==0 || strings==NULL || strings_size==0 || strings[strings_size - 1]!='\0') {
+		error(2, 0, "snapshot %s has no devices", path);
+	}
+
+	size_t capabilities_size;
+	snapshot_section(wurfl->snapshot, SNAPSHOT_CAPABILITY_OFFSETS, &capabilities_size);
+	capabilities_size /= sizeof(uint32_t);
+	const uint32_t* capability_ids;
+	mphf_t* capabilities_mphf = snapshot_mphf(wurfl->snapshot, SNAPSHOT_CAPABILITY_MPHF, SNAPSHOT_CAPABILITY_MPHF_IDS, capabilities_size, &capability_ids);
+	wurfl->capabilities = snapshot_strpool(wurfl->snapshot, SNAPSHOT_CAPABILITY_NAMES, SNAPSHOT_CAPABILITY_OFFSETS, capabilities_size, capabilities_mphf, capability_ids);
+
+	devicedef_t** devices = malloc(sizeof(devicedef_t*) * devices_size);
+	if(!devices) {
+		error(1, errno, "error allocating snapshot devices");
+	}
+
+	size_t index;
+	for(index=0; index<devices_size; index++) {
+		const snapshot_device_t* snapshot_device = snapshot_devices + index;
+		if(snapshot_device->id >= strings_size
+				|| (snapshot_device->user_agent!=SNAPSHOT_NONE && snapshot_device->user_agent >= strings_size)
+				|| (snapshot_device->fall_back!=SNAPSHOT_NONE && snapshot_device->fall_back >= strings_size)) {
+			error(2, 0, "snapshot %s has a corrupted device", path);
+		}
+
+		// The strings stay in the snapshot
+		devicedef_t* devicedef = arena_alloc(wurfl->arena, sizeof(devicedef_t));
+		devicedef->id = (char*)strings + snapshot_device->id;
+		devicedef->user_agent = snapshot_device->user_agent!=SNAPSHOT_NONE ? (char*)strings + snapshot_device->user_agent : NULL;
+		devicedef->fall_back = snapshot_device->fall_back!=SNAPSHOT_NONE ? (char*)strings + snapshot_device->fall_back : NULL;
+		devicedef->actual_device_root = (snapshot_device->flags & SNAPSHOT_ACTUAL_DEVICE_ROOT)!=0;
+		devicedef->capabilities = NULL;
+		devicedef->capabilities_size = 0;
+
+		devices[index] = devicedef;
+		hashmap_put(wurfl->devices, devicedef->id, devicedef);
+	}
+
+	wurfl->capstore = capstore_init_snapshot(wurfl->snapshot, devices, devices_size, wurfl->capabilities);
+	// A reload keeps the mode the snapshot was written with
+	wurfl->capstore_mode = capstore_mode(wurfl->capstore);
+	wurfl->matcher = matcher_init_snapshot(wurfl->snapshot, capstore_devices(wurfl->capstore), capstore_devices_size(wurfl->capstore));
+
+	free(devices);
+
+	error(0,0, "loaded %d devices from snapshot %s", hashmap_size(wurfl->devices), path);
+
+	return wurfl;
+}
+
+static uint32_t snapshot_string(char** strings, size_t* size, size_t* capacity, const char* string) {
+
+	if(string==NULL) {
+		return SNAPSHOT_NONE;
+	}
+
+	size_t len = strlen(string) + 1;
+	while(*size + len > *capacity) {
+		*capacity *= 2;
+		*strings = realloc(*strings, *capacity);
+		if(!*strings) {
+			error(1, errno, "error growing snapshot strings");
+		}
+	}
+
+	if(*size + len > SNAPSHOT_NONE) {
+		error(1, 0, "too many device strings for a snapshot");
+	}
+
+	uint32_t offset = *size;
+	memcpy(*strings + offset, string, len);
+	*size += len;
+
+	return offset;
+}
+
+void wurfl_snapshot_write(const wurfl_t* wurfl, const char* path) {
+
+	uint32_t devices_size = capstore_devices_size(wurfl->capstore);
+
+	snapshot_device_t* snapshot_devices = malloc(sizeof(snapshot_device_t) * devices_size);
+	size_t strings_size = 0;
+	size_t strings_capacity = 64 * 1024;
+	char* strings = malloc(strings_capacity);
+	if(!snapshot_devices || !strings) {
+		error(1, errno, "error allocating snapshot devices");
+	}
+
+	// The devices are in capstore index order
+	uint32_t index;
+	for(index=0; index<devices_size; index++) {
+		const devicedef_t* devicedef = capstore_device(wurfl->capstore, index);
+		snapshot_device_t* snapshot_device = snapshot_devices + index;
+
+		snapshot_device->id = snapshot_string(&strings, &strings_size, &strings_capacity, devicedef->id);
+		snapshot_device->user_agent = snapshot_string(&strings, &strings_size, &strings_capacity, devicedef->user_agent);
+		snapshot_device->fall_back = snapshot_string(&strings, &strings_size, &strings_capacity, devicedef->fall_back);
+		snapshot_device->flags = devicedef->actual_device_root ? SNAPSHOT_ACTUAL_DEVICE_ROOT : 0;
+	}
+
+	snapshot_writer_t* writer = snapshot_writer_init(path);
+	snapshot_writer_strpool(writer, SNAPSHOT_CAPABILITY_NAMES, SNAPSHOT_CAPABILITY_OFFSETS, wurfl->capabilities);
+	const uint32_t* capability_ids;
+	const mphf_t* capabilities_mphf = strpool_mphf(wurfl->capabilities, &capability_ids);
+	snapshot_writer_mphf(writer, SNAPSHOT_CAPABILITY_MPHF, SNAPSHOT_CAPABILITY_MPHF_IDS, capabilities_mphf, capability_ids);
+	snapshot_writer_section(writer, SNAPSHOT_DEVICES, snapshot_devices, sizeof(snapshot_device_t) * devices_size);
+	snapshot_writer_section(writer, SNAPSHOT_DEVICE_STRINGS, strings, strings_size);
+	capstore_write(wurfl->capstore, writer);
+	matcher_write(wurfl->matcher, writer);
+	snapshot_writer_close(writer);
+
+	free(strings);
+	free(snapshot_devices);
+}
+
+bool wurfl_snapshot_verify(const char* path) {
+
+	snapshot_t* snapshot = snapshot_open(path);
+	bool verified = snapshot_verify(snapshot);
+	snapshot_close(snapshot);
+
+	return verified;
+}
+
 void wurfl_free(wurfl_t* wurfl) {
 
 	normalizer_free(wurfl->normalizer);
 	matcher_free(wurfl->matcher);
-	hashtable_free(wurfl->capabilities, &coll_default_unduper, NULL);
+	capstore_free(wurfl->capstore);
 	hashmap_free(wurfl->devices, &free_device, NULL);
+	arena_free(wurfl->arena);
+	strpool_free(wurfl->capabilities);
+	if(wurfl->snapshot!=NULL) {
+		snapshot_close(wurfl->snapshot);
+	}
+	if(wurfl->filter!=NULL) {
+		hashtable_free(wurfl->filter, &coll_default_unduper, NULL);
+	}
 
 	free(wurfl);
 }
@@ -106,38 +370,240 @@ device_t* wurfl_match(const wurfl_t* wurfl, const char* user_agent) {
 
 		devicedef_t* matched = matcher_match(wurfl->matcher, normalized_ua);
 
-		return device_init(wurfl->devices, matched);
+		return device_init(wurfl->capstore, matched);
 	}
 }
 
 void wurfl_reload(wurfl_t* wurfl, const char* root, const char** patches) {
 
-	hashtable_free(wurfl->capabilities, &coll_default_unduper, NULL);
+	matcher_free(wurfl->matcher);
+	capstore_free(wurfl->capstore);
 	hashmap_free(wurfl->devices, &free_device, NULL);
+	arena_free(wurfl->arena);
+	strpool_free(wurfl->capabilities);
+	if(wurfl->snapshot!=NULL) {
+		snapshot_close(wurfl->snapshot);
+		wurfl->snapshot = NULL;
+	}
 
-	init_devices(wurfl, root);
+	wurfl->arena = arena_init();
+	wurfl->devices = hashmap_init(&string_eq, &string_hash, NULL);
+	wurfl->capabilities = strpool_init();
+
+	resource_t* resource = resource_open(root);
+	init_devices(wurfl, resource);
+	resource_close(resource);
 	wurfl_npatch(wurfl, patches);
+
+	wurfl->capstore = capstore_init(wurfl->devices, wurfl->capabilities, wurfl->capstore_mode);
+	hashmap_foreach_value(wurfl->devices, &release_capabilities, NULL);
+	strpool_freeze(wurfl->capabilities);
+	wurfl->matcher = matcher_init(capstore_devices(wurfl->capstore), capstore_devices_size(wurfl->capstore));
+}
+
+#ifdef HAVE_LIBPTHREAD
+
+typedef struct {
+	patch_data_t* patches;
+	size_t patches_size;
+	size_t first;
+	size_t step;
+} patch_worker_t;
+
+static void* parse_patches(void* xtra) {
+
+	patch_worker_t* worker = (patch_worker_t*)xtra;
+
+	size_t index;
+	for(index=worker->first; index<worker->patches_size; index+=worker->step) {
+		parse_patch(worker->patches + index);
+	}
+
+	return NULL;
 }
 
+/**
+ * Parse the patches on different threads, then apply them in the given
+ * order. The first patch is parsed on this thread in the wurfl names pool
+ * and arena, every other one in its own.
+ */
+static void npatch_parallel(wurfl_t* wurfl, const char** paths, size_t patches_size) {
+
+	size_t workers_size = patches_size < (size_t)wurfl->threads ? patches_size : (size_t)wurfl->threads;
+
+	patch_data_t* patches = malloc(sizeof(patch_data_t) * patches_size);
+	patch_worker_t* workers = malloc(sizeof(patch_worker_t) * workers_size);
+	pthread_t* threads = malloc(sizeof(pthread_t) * workers_size);
+	if(!patches || !workers || !threads) {
+		error(1, errno, "error allocating patches");
+	}
+
+	parser_init();
+
+	size_t index;
+	for(index=0; index<patches_size; index++) {
+		init_patch(wurfl, patches + index, paths[index], index==0);
+		// The patches parsed together take a thread each
+		patches[index].rdata.threads = 1;
+	}
+
+	for(index=0; index<workers_size; index++) {
+		workers[index].patches = patches;
+		workers[index].patches_size = patches_size;
+		workers[index].first = index;
+		workers[index].step = workers_size;
+	}
+
+	size_t started;
+	for(started=1; started<workers_size; started++) {
+		if(pthread_create(threads + started, NULL, &parse_patches, workers + started)!=0) {
+			break;
+		}
+	}
+	// The workers without a thread run here
+	parse_patches(workers);
+	for(index=started; index<workers_size; index++) {
+		parse_patches(workers + index);
+	}
+	for(index=1; index<started; index++) {
+		pthread_join(threads[index], NULL);
+	}
+
+	for(index=0; index<patches_size; index++) {
+		apply_patch(wurfl, patches + index);
+	}
+
+	free(patches);
+	free(workers);
+	free(threads);
+}
+
+typedef struct {
+	devicedef_t** devices;
+	uint32_t devices_size;
+	normalize_data_t data;
+} normalize_part_t;
+
+static bool collect_device(const void* item, void* xtra) {
+
+	normalize_part_t* part = (normalize_part_t*)xtra;
+	part->devices[part->devices_size++] = (devicedef_t*)item;
+
+	return false;
+}
+
+static void* normalize_part(void* xtra) {
+
+	normalize_part_t* part = (normalize_part_t*)xtra;
+
+	uint32_t index;
+	for(index=0; index<part->devices_size; index++) {
+		normalize_device(part->devices[index], &part->data);
+	}
+
+	return NULL;
+}
+
+/**
+ * Normalize slices of the devices on different threads, the first one on
+ * this thread. Every other slice has its own normalizer, not to wait on
+ * the regex lock, and its own arena, merged in the wurfl one at the end.
+ */
+static bool normalize_parallel(wurfl_t* wurfl, hashmap_t* devices) {
+
+	uint32_t devices_size = hashmap_size(devices);
+	uint32_t parts_size = devices_size / NORMALIZE_MIN_DEVICES;
+	if(parts_size > (uint32_t)wurfl->threads) {
+		parts_size = wurfl->threads;
+	}
+	if(parts_size < 2) {
+		return false;
+	}
+
+	normalize_part_t all;
+	all.devices = malloc(sizeof(devicedef_t*) * devices_size);
+	normalize_part_t* parts = malloc(sizeof(normalize_part_t) * parts_size);
+	pthread_t* threads = malloc(sizeof(pthread_t) * parts_size);
+	if(!all.devices || !parts || !threads) {
+		error(1, errno, "error allocating normalizing parts");
+	}
+
+	all.devices_size = 0;
+	hashmap_foreach_value(devices, &collect_device, &all);
+
+	uint32_t index;
+	for(index=0; index<parts_size; index++) {
+		uint32_t first = (uint64_t)devices_size * index / parts_size;
+		uint32_t last = (uint64_t)devices_size * (index + 1) / parts_size;
+
+		parts[index].devices = all.devices + first;
+		parts[index].devices_size = last - first;
+		parts[index].data.normalizer = index==0 ? wurfl->normalizer : normalizer_init();
+		parts[index].data.arena = index==0 ? wurfl->arena : arena_init();
+	}
+
+	uint32_t started;
+	for(started=1; started<parts_size; started++) {
+		if(pthread_create(threads + started, NULL, &normalize_part, parts + started)!=0) {
+			break;
+		}
+	}
+	// The parts without a thread are normalized here
+	normalize_part(parts);
+	for(index=started; index<parts_size; index++) {
+		normalize_part(parts + index);
+	}
+	for(index=1; index<started; index++) {
+		pthread_join(threads[index], NULL);
+	}
+
+	for(index=1; index<parts_size; index++) {
+		arena_merge(wurfl->arena, parts[index].data.arena);
+		normalizer_free(parts[index].data.normalizer);
+	}
+
+	free(all.devices);
+	free(parts);
+	free(threads);
+
+	return true;
+}
+
+#endif
+
 void wurfl_npatch(wurfl_t* wurfl, const char** patches) {
 
-	const char **patch = patches;
-	while(patch && *patch) {
-		wurfl_patch(wurfl, *patch);
-		patch++;
+	size_t patches_size = 0;
+	while(patches && patches[patches_size]) {
+		patches_size++;
+	}
+
+#ifdef HAVE_LIBPTHREAD
+	if(patches_size > 1 && wurfl->threads > 1) {
+		npatch_parallel(wurfl, patches, patches_size);
+		return;
+	}
+#endif
+
+	size_t index;
+	for(index=0; index<patches_size; index++) {
+		wurfl_patch(wurfl, patches[index]);
 	}
 }
 
 void wurfl_patch(wurfl_t* wurfl, const char* patch) {
 
-	parser_data_t rdata;
-	rdata.devices = hashmap_init(&string_eq, &string_hash, NULL);
-	rdata.capabilities = wurfl->capabilities;
-	parse_resource(patch, &rdata);
+	patch_data_t data;
+	init_patch(wurfl, &data, patch, true);
+	parse_patch(&data);
+	apply_patch(wurfl, &data);
+}
 
-	hashmap_foreach_value(rdata.devices, &normalize_device, wurfl->normalizer);
-	hashmap_foreach_value(rdata.devices, &patch_device, wurfl->devices);
+device_t* wurfl_get_device(const wurfl_t* wurfl, const char* id) {
 
+	const devicedef_t* devicedef = id!=NULL ? capstore_device_by_id(wurfl->capstore, id) : NULL;
+
+	return devicedef!=NULL ? device_init(wurfl->capstore, devicedef) : NULL;
 }
 
 size_t wurfl_size(wurfl_t* wurfl) {
@@ -145,19 +611,152 @@ size_t wurfl_size(wurfl_t* wurfl) {
 }
 
 size_t wurfl_capabilities_size(wurfl_t* wurfl) {
-	return hashtable_size(wurfl->capabilities);
+	return strpool_size(wurfl->capabilities);
 }
 
 // Support functions ******************************************************
 
-static void init_devices(wurfl_t* wurfl, const char* path) {
+static void init_devices(wurfl_t* wurfl, resource_t* root) {
 
 	parser_data_t rdata;
 	rdata.devices = wurfl->devices;
 	rdata.capabilities = wurfl->capabilities;
-	parse_resource(path, &rdata);
+	rdata.filter = wurfl->filter;
+	rdata.arena = wurfl->arena;
+	rdata.libxml2_only = wurfl->parser==WURFL_PARSER_LIBXML2;
+	rdata.threads = wurfl->threads;
+	parse_resource(root, &rdata);
+	error(0,0, "parsed %d devices", hashmap_size(rdata.devices));
+
+	normalize_devices(wurfl, rdata.devices);
+}
+
+static void normalize_devices(wurfl_t* wurfl, hashmap_t* devices) {
+
+#ifdef HAVE_LIBPTHREAD
+	if(normalize_parallel(wurfl, devices)) {
+		return;
+	}
+#endif
 
-	hashmap_foreach_value(rdata.devices, &normalize_device, wurfl->normalizer);
+	normalize_data_t data = {wurfl->normalizer, wurfl->arena};
+	hashmap_foreach_value(devices, &normalize_device, &data);
+}
+
+/**
+ * Prepare the patch parsing. A patch not shared with the wurfl names pool
+ * and arena can be parsed on any thread, it gets its own.
+ */
+static void init_patch(wurfl_t* wurfl, patch_data_t* patch, const char* path, bool shared) {
+
+	patch->resource = resource_open(path);
+
+	patch->rdata.devices = hashmap_init(&string_eq, &string_hash, NULL);
+	patch->rdata.capabilities = shared ? wurfl->capabilities : strpool_init();
+	patch->rdata.filter = wurfl->filter;
+	patch->rdata.arena = shared ? wurfl->arena : arena_init();
+	patch->rdata.libxml2_only = wurfl->parser==WURFL_PARSER_LIBXML2;
+	patch->rdata.threads = wurfl->threads;
+
+	patch->normalize.normalizer = wurfl->normalizer;
+	patch->normalize.arena = patch->rdata.arena;
+}
+
+static void* parse_patch(void* xtra) {
+
+	patch_data_t* patch = (patch_data_t*)xtra;
+
+	parse_resource(patch->resource, &patch->rdata);
+	resource_close(patch->resource);
+
+	hashmap_foreach_value(patch->rdata.devices, &normalize_device, &patch->normalize);
+
+	return NULL;
+}
+
+static bool remap_device(const void* item, void* xtra) {
+
+	devicedef_remap_capabilities((devicedef_t*)item, (const uint32_t*)xtra);
+
+	return false;
+}
+
+/**
+ * Patch the wurfl devices with the parsed ones. The capability names of a
+ * patch with its own pool are added to the wurfl one in their order.
+ */
+static void apply_patch(wurfl_t* wurfl, patch_data_t* patch) {
+
+	parser_data_t* rdata = &patch->rdata;
+	// It is reported here, the patches can be parsed on different threads
+	error(0,0, "parsed %d devices", hashmap_size(rdata->devices));
+
+	if(rdata->capabilities!=wurfl->capabilities) {
+		uint32_t names_size = strpool_size(rdata->capabilities);
+		uint32_t* ids = malloc(sizeof(uint32_t) * (names_size + 1));
+		if(!ids) {
+			error(1, errno, "error allocating capability ids");
+		}
+
+		uint32_t id;
+		for(id=0; id<names_size; id++) {
+			ids[id] = strpool_add_hashed(wurfl->capabilities, strpool_get(rdata->capabilities, id), strpool_hash(rdata->capabilities, id));
+		}
+		hashmap_foreach_value(rdata->devices, &remap_device, ids);
+
+		free(ids);
+		strpool_free(rdata->capabilities);
+	}
+	if(rdata->arena!=wurfl->arena) {
+		arena_merge(wurfl->arena, rdata->arena);
+	}
+
+	hashmap_foreach_value(rdata->devices, &patch_device, wurfl->devices);
+
+	hashmap_free(rdata->devices, NULL, NULL);
+}
+
+static int processors() {
+
+	long online = sysconf(_SC_NPROCESSORS_ONLN);
+
+	return online > 0 ? (int)online : 1;
+}
+
+static void* filter_duper(const void* item, const void* xtra) {
+
+	char* name = strdup((const char*)item);
+	if(!name) {
+		error(1, errno, "error allocating capability filter name");
+	}
+
+	return name;
+}
+
+static void add_filter(hashtable_t* filter, const char** capabilities) {
+
+	const char** capability = capabilities;
+	while(*capability) {
+		if(!hashtable_contains(filter, (void*)*capability)) {
+			hashtable_add(filter, *capability, &filter_duper, NULL);
+		}
+		capability++;
+	}
+}
+
+static hashtable_t* init_filter(const char** capabilities) {
+
+	hashtable_t* filter = NULL;
+
+	if(capabilities!=NULL) {
+		filter = hashtable_init(&string_eq, &string_hash, NULL);
+
+		add_filter(filter, capabilities);
+		// The virtual capabilities are evaluated on their sources
+		add_filter(filter, virtualcap_sources());
+	}
+
+	return filter;
 }
 
 static bool patch_device(const void* item, void* xtra) {
@@ -165,29 +764,36 @@ static bool patch_device(const void* item, void* xtra) {
 	devicedef_t* patcher = (devicedef_t*)item;
 	hashmap_t* devices = (hashmap_t*)xtra;
 
-	devicedef_t* patching = hashmap_get(devices, patcher->id);
+	uint32_t hash = hashmap_hash(devices, patcher->id);
+	devicedef_t* patching = hashmap_get_hashed(devices, patcher->id, hash);
 	if(patching) {
 		devicedef_patch(patching, patcher);
 	}
 	else {
-		hashmap_put(devices, patcher->id, patcher);
+		hashmap_put_hashed(devices, patcher->id, hash, patcher);
 	}
 
 	return false;
 }
 
+static bool release_capabilities(const void* item, void* xtra) {
+
+	devicedef_release_capabilities((devicedef_t*)item);
+
+	return false;
+}
+
 static bool normalize_device(const void* item, void* xtra) {
 
 	devicedef_t* device = (devicedef_t*)item;
-	normalizer_t* normalizer = (normalizer_t*)xtra;
+	normalize_data_t* data = (normalize_data_t*)xtra;
 
 	if(device->user_agent!=NULL) {
 
 		char tmp[8 * 1024];
-		normalizer_apply(normalizer, tmp, device->user_agent);
+		normalizer_apply(data->normalizer, tmp, device->user_agent);
 		if(strcmp(tmp, device->user_agent)!=0) {
-			free(device->user_agent);
-			device->user_agent = strdup(tmp);
+			device->user_agent = arena_strdup(data->arena, tmp);
 		}
 	}
 
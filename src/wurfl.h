@@ -29,6 +29,57 @@ typedef struct _request_t {
 
 typedef struct _wurfl_t wurfl_t;
 
+typedef enum {
+	/**
+	 * Every device holds the value of every capability, inherited ones
+	 * included. It is the fastest and the default one.
+	 */
+	WURFL_CAPABILITIES_FLAT = 0,
+	/**
+	 * Every device holds only the capabilities it overrides, the inherited
+	 * ones are looked up through the fall_back chain. It uses far less
+	 * memory.
+	 */
+	WURFL_CAPABILITIES_LAZY
+} wurfl_capabilities_mode_t;
+
+typedef enum {
+	/**
+	 * The plain files and memory buffers are parsed by a scanner made for
+	 * the WURFL schema. The compressed files and streams, and the documents
+	 * the scanner does not understand, are parsed by libxml2.
+	 */
+	WURFL_PARSER_AUTO = 0,
+	/**
+	 * Everything is parsed by libxml2.
+	 */
+	WURFL_PARSER_LIBXML2
+} wurfl_parser_t;
+
+typedef struct {
+	/**
+	 * The NULL terminated array of capability or group names to load. The
+	 * other capabilities are dropped while parsing. If NULL all the
+	 * capabilities are loaded. The capabilities the virtual capabilities
+	 * are derived from, like is_wireless_device or pointing_method, are
+	 * always loaded, so the virtual capabilities do not depend on it.
+	 */
+	const char** capabilities;
+	/**
+	 * How the device capabilities are stored in memory.
+	 */
+	wurfl_capabilities_mode_t capabilities_mode;
+	/**
+	 * How the XML is parsed.
+	 */
+	wurfl_parser_t parser;
+	/**
+	 * The threads parsing a plain document at the same time, 0 for one
+	 * per processor. The small documents are parsed on a single thread.
+	 */
+	int threads;
+} wurfl_options_t;
+
 /**
  * This function init the wurfl with the given main file and patches
  * @param root It is the wurfl main file path.
@@ -38,6 +89,74 @@ typedef struct _wurfl_t wurfl_t;
  */
 wurfl_t* wurfl_init(const char* root, const char** patches);
 
+/**
+ * This function init the wurfl with the given main file, patches and
+ * options.
+ * @param root It is the wurfl main file path.
+ * @param patches It is the NULL terminated array of patches paths.
+ * @param options The load options, if NULL the defaults are used.
+ *
+ * @return intialized wurfl.
+ */
+wurfl_t* wurfl_init_options(const char* root, const char** patches, const wurfl_options_t* options);
+
+/**
+ * This function init the wurfl with the main file content already in
+ * memory. The buffer is read in place, it can be released once the
+ * function returns.
+ * @param root It is the wurfl main file content, plain or compressed.
+ * @param root_size It is the root size.
+ * @param patches It is the NULL terminated array of patches paths.
+ * @param options The load options, if NULL the defaults are used.
+ *
+ * @return intialized wurfl.
+ */
+wurfl_t* wurfl_init_mem(const void* root, size_t root_size, const char** patches, const wurfl_options_t* options);
+
+/**
+ * This function init the wurfl reading the main file from a file
+ * descriptor, from its current position. A regular file is mapped and
+ * parsed in place. The file descriptor is not closed.
+ * @param root It is the wurfl main file descriptor, plain or compressed.
+ * @param patches It is the NULL terminated array of patches paths.
+ * @param options The load options, if NULL the defaults are used.
+ *
+ * @return intialized wurfl.
+ */
+wurfl_t* wurfl_init_fd(int root, const char** patches, const wurfl_options_t* options);
+
+/**
+ * This function init the wurfl from a snapshot written by
+ * wurfl_snapshot_write. The snapshot is mapped in memory, not parsed, so it
+ * is ready in a few milliseconds and its pages are shared by every process
+ * using the same file.
+ * @param path It is the snapshot path.
+ *
+ * @return intialized wurfl.
+ */
+wurfl_t* wurfl_init_snapshot(const char* path);
+
+/**
+ * This function writes the loaded wurfl to a snapshot file. A snapshot
+ * can be read only by the same libwurfl version on the same platform. An
+ * existing snapshot is replaced at once, the processes that mapped it keep
+ * the old one until they init again.
+ * @param wurfl The wurfl to write.
+ * @param path It is the snapshot path.
+ */
+void wurfl_snapshot_write(const wurfl_t* wurfl, const char* path);
+
+/**
+ * This function reads a whole snapshot file and checks its checksum.
+ * wurfl_init_snapshot checks only the snapshot header, so it does not read
+ * the pages it does not use; a snapshot copied from elsewhere can be
+ * verified once before the processes init from it.
+ * @param path It is the snapshot path.
+ *
+ * @return true if the snapshot is not corrupted.
+ */
+bool wurfl_snapshot_verify(const char* path);
+
 /**
  * This function destroy the wurfl
  * @param wufl The wurfl to free.
@@ -54,6 +173,16 @@ void wurfl_free(wurfl_t* wurfl);
  */
 device_t* wurfl_match(const wurfl_t* wurfl, const char* user_agent);
 
+/**
+ * This function obtains a device by its WURFL id.
+ *
+ * @param wurfl The wurfl to query.
+ * @param id The device id, like "generic".
+ *
+ * @return the device_t with the given id, NULL if there is none.
+ */
+device_t* wurfl_get_device(const wurfl_t* wurfl, const char* id);
+
 /**
  * This function return the wurfl devices size.
  *